@@ -0,0 +1,574 @@
+/*
+ * bench_decode.c - microbenchmarks for the pg_filedump decode callbacks
+ *					and formatting kernels.
+ *
+ * Copyright (c) 2011-2024, PostgreSQL Global Development Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The decode callbacks are static, so this harness is built as a single
+ * translation unit together with pg_filedump.c, decode.c, stringinfo.c and
+ * memory.c, and linked with the other objects of the program.  Allocations
+ * made by decode.c, stringinfo.c and memory.c are counted by routing
+ * malloc, realloc and palloc through counting wrappers.
+ *
+ * Every kernel is run over an in-memory corpus laid out the way the values
+ * are stored in a tuple, and the best of several passes is reported in
+ * nanoseconds and allocations per value.
+ */
+
+#define main pg_filedump_main
+#include "pg_filedump.c"
+#undef main
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static uint64 benchAllocs = 0;
+
+static void *
+bench_malloc(size_t size)
+{
+	benchAllocs++;
+	return (malloc) (size);
+}
+
+static void *
+bench_realloc(void *ptr, size_t size)
+{
+	benchAllocs++;
+	return (realloc) (ptr, size);
+}
+
+static void *
+bench_palloc(size_t size)
+{
+	benchAllocs++;
+	return (palloc) (size);
+}
+
+#define malloc(size) bench_malloc(size)
+#define realloc(ptr, size) bench_realloc(ptr, size)
+#define palloc(size) bench_palloc(size)
+
+#include "decode.c"
+#include "stringinfo.c"
+#include "memory.c"
+
+#undef malloc
+#undef realloc
+#undef palloc
+
+/* Number of values in each corpus and passes over it */
+#define BENCH_VALUES		(1024 * 1024)
+#define BENCH_PASSES		5
+
+/* Clear the COPY line every so many values, as FormatDecode does per row */
+#define BENCH_VALUES_PER_ROW	16
+
+typedef struct BenchCorpus
+{
+	char	   *data;
+	Size		size;
+	Size		maxsize;
+	uint64		nvalues;
+}			BenchCorpus;
+
+static uint64 benchRandomState = 0x9E3779B97F4A7C15ULL;
+
+static int	benchDevNull = -1;
+static int	benchStdout = -1;
+
+static uint64
+BenchRandom(void)
+{
+	benchRandomState ^= benchRandomState >> 12;
+	benchRandomState ^= benchRandomState << 25;
+	benchRandomState ^= benchRandomState >> 27;
+	return benchRandomState * UINT64CONST(2685821657736338717);
+}
+
+static double
+BenchNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Send stdout to /dev/null while a printing kernel is measured */
+static void
+BenchMuteStdout(bool mute)
+{
+	fflush(stdout);
+	if (mute)
+	{
+		if (benchDevNull < 0)
+			benchDevNull = open("/dev/null", O_WRONLY);
+		benchStdout = dup(STDOUT_FILENO);
+		dup2(benchDevNull, STDOUT_FILENO);
+	}
+	else
+	{
+		dup2(benchStdout, STDOUT_FILENO);
+		close(benchStdout);
+	}
+}
+
+static void
+CorpusInit(BenchCorpus *corpus)
+{
+	corpus->maxsize = 1024 * 1024;
+	corpus->data = (malloc) (corpus->maxsize);
+	corpus->size = 0;
+	corpus->nvalues = 0;
+	if (!corpus->data)
+	{
+		perror("malloc");
+		exit(1);
+	}
+}
+
+static void
+CorpusFree(BenchCorpus *corpus)
+{
+	(free) (corpus->data);
+}
+
+/* Append one value, zero padded to the given alignment like in a tuple */
+static void
+CorpusAppend(BenchCorpus *corpus, const void *value, Size size, int align)
+{
+	Size		start = TYPEALIGN(align, corpus->size);
+
+	while (start + size > corpus->maxsize)
+	{
+		corpus->maxsize *= 2;
+		corpus->data = (realloc) (corpus->data, corpus->maxsize);
+		if (!corpus->data)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memset(corpus->data + corpus->size, 0, start - corpus->size);
+	memcpy(corpus->data + start, value, size);
+	corpus->size = start + size;
+	corpus->nvalues++;
+}
+
+/* Append a varlena with a short header if it fits, a 4-byte one otherwise */
+static void
+CorpusAppendVarlena(BenchCorpus *corpus, const char *value, Size size)
+{
+	char		buffer[VARHDRSZ + 4096];
+
+	if (size + VARHDRSZ_SHORT <= VARATT_SHORT_MAX)
+	{
+		SET_VARSIZE_SHORT(buffer, size + VARHDRSZ_SHORT);
+		memcpy(buffer + VARHDRSZ_SHORT, value, size);
+		CorpusAppend(corpus, buffer, size + VARHDRSZ_SHORT, 1);
+	}
+	else
+	{
+		SET_VARSIZE(buffer, size + VARHDRSZ);
+		memcpy(buffer + VARHDRSZ, value, size);
+		CorpusAppend(corpus, buffer, size + VARHDRSZ, ALIGNOF_INT);
+	}
+}
+
+/* Append an inline compressed varlena using the given method */
+static void
+CorpusAppendCompressed(BenchCorpus *corpus, const char *value, int size, int cmid)
+{
+	char		buffer[2 * VARHDRSZ + PGLZ_MAX_OUTPUT(4096)];
+	uint32		tcinfo = ((uint32) size) | ((uint32) cmid << VARLENA_EXTSIZE_BITS);
+	int32		clen = -1;
+
+	if (cmid == TOAST_PGLZ_COMPRESSION_ID)
+		clen = pglz_compress(value, size, buffer + 2 * VARHDRSZ,
+							 PGLZ_strategy_always);
+#if PG_VERSION_NUM >= 140000 && defined(USE_LZ4)
+	else
+		clen = LZ4_compress_default(value, buffer + 2 * VARHDRSZ, size,
+									PGLZ_MAX_OUTPUT(4096));
+#endif
+
+	if (clen <= 0)
+	{
+		printf("Error: could not compress benchmark value.\n");
+		exit(1);
+	}
+
+	SET_VARSIZE_COMPRESSED(buffer, clen + 2 * VARHDRSZ);
+	memcpy(buffer + VARHDRSZ, &tcinfo, sizeof(uint32));
+	CorpusAppend(corpus, buffer, clen + 2 * VARHDRSZ, ALIGNOF_INT);
+}
+
+static void
+BenchText(char *buffer, int len, bool escapes)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+	int			i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (escapes && (BenchRandom() % 8) == 0)
+			buffer[i] = "\t\n\r\\"[BenchRandom() % 4];
+		else
+			buffer[i] = alphabet[BenchRandom() % (sizeof(alphabet) - 1)];
+	}
+}
+
+static void
+BenchReport(const char *name, uint64 nvalues, double bestNs, uint64 allocs)
+{
+	printf("%-28s %12.1f %12.3f\n", name, bestNs / nvalues,
+		   (double) allocs / nvalues);
+}
+
+/* Run a decode callback over every value of the corpus */
+static void
+BenchCallback(const char *name, decode_callback_t callback, BenchCorpus *corpus)
+{
+	double		best = 0;
+	uint64		allocs = 0;
+	int			pass;
+
+	CopyClear();
+
+	for (pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		const char *ptr = corpus->data;
+		unsigned int remaining = corpus->size;
+		uint64		n = 0;
+		uint64		startAllocs = benchAllocs;
+		double		start = BenchNow();
+		double		elapsed;
+
+		while (remaining > 0)
+		{
+			unsigned int processed = 0;
+			int			ret = callback(ptr, remaining, &processed);
+
+			if (ret < 0 || processed == 0)
+			{
+				printf("Error: %s callback returned %d at value " UINT64_FORMAT ".\n",
+					   name, ret, n);
+				exit(1);
+			}
+			ptr += processed;
+			remaining -= processed;
+
+			if (++n % BENCH_VALUES_PER_ROW == 0)
+				CopyClear();
+		}
+		elapsed = BenchNow() - start;
+
+		if (pass == 0 || elapsed < best)
+		{
+			best = elapsed;
+			allocs = benchAllocs - startAllocs;
+		}
+	}
+
+	BenchReport(name, corpus->nvalues, best, allocs);
+}
+
+static void
+BenchFixed(const char *name, decode_callback_t callback, Size size, int align)
+{
+	BenchCorpus corpus;
+	uint64		i;
+
+	CorpusInit(&corpus);
+	for (i = 0; i < BENCH_VALUES; i++)
+	{
+		uint64		value[2] = {BenchRandom(), BenchRandom()};
+
+		/* keep bools and dates sane, the others accept any bit pattern */
+		if (callback == decode_bool)
+			value[0] &= 1;
+		else if (callback == decode_date)
+			value[0] %= 100000;
+		else if (callback == decode_time || callback == decode_timetz)
+			value[0] %= USECS_PER_DAY;
+		else if (callback == decode_timestamp || callback == decode_timestamptz)
+			value[0] %= INT64CONST(3155760000000000);
+		CorpusAppend(&corpus, value, size, align);
+	}
+	BenchCallback(name, callback, &corpus);
+	CorpusFree(&corpus);
+}
+
+static void
+BenchStrings(const char *name, int minlen, int maxlen, int cmid)
+{
+	BenchCorpus corpus;
+	char		text[4096];
+	uint64		i;
+	uint64		nvalues = maxlen > 1000 ? BENCH_VALUES / 16 : BENCH_VALUES;
+
+	CorpusInit(&corpus);
+	for (i = 0; i < nvalues; i++)
+	{
+		int			len = minlen + BenchRandom() % (maxlen - minlen + 1);
+
+		if (cmid < 0)
+		{
+			BenchText(text, len, true);
+			CorpusAppendVarlena(&corpus, text, len);
+		}
+		else
+		{
+			/* repetitive text, so that it compresses */
+			int			j;
+
+			for (j = 0; j < len; j++)
+				text[j] = "postgres heap tuple "[(j + i) % 20];
+			CorpusAppendCompressed(&corpus, text, len, cmid);
+		}
+	}
+	BenchCallback(name, decode_string, &corpus);
+	CorpusFree(&corpus);
+}
+
+static void
+BenchNumeric(void)
+{
+	BenchCorpus corpus;
+	uint64		i;
+
+	CorpusInit(&corpus);
+	for (i = 0; i < BENCH_VALUES; i++)
+	{
+		char		buffer[NUMERIC_HDRSZ_SHORT + 8 * sizeof(NumericDigit)];
+		NumericDigit *digits = (NumericDigit *) (buffer + VARHDRSZ_SHORT + sizeof(uint16));
+		int			ndigits = 1 + BenchRandom() % 6;
+		int			weight = (int) (BenchRandom() % 6) - 2;
+		int			dscale = BenchRandom() % 10;
+		uint16		header;
+		int			j;
+
+		for (j = 0; j < ndigits; j++)
+			digits[j] = BenchRandom() % NBASE;
+		if (digits[0] == 0)
+			digits[0] = 1;
+		if (digits[ndigits - 1] == 0)
+			digits[ndigits - 1] = 1;
+
+		header = NUMERIC_SHORT | (dscale << NUMERIC_SHORT_DSCALE_SHIFT) |
+			((BenchRandom() & 1) ? NUMERIC_SHORT_SIGN_MASK : 0) |
+			(weight < 0 ? NUMERIC_SHORT_WEIGHT_SIGN_MASK : 0) |
+			(weight & NUMERIC_SHORT_WEIGHT_MASK);
+		memcpy(buffer + VARHDRSZ_SHORT, &header, sizeof(uint16));
+		SET_VARSIZE_SHORT(buffer, VARHDRSZ_SHORT + sizeof(uint16) +
+						  ndigits * sizeof(NumericDigit));
+		CorpusAppend(&corpus, buffer, VARSIZE_SHORT(buffer), 1);
+	}
+	BenchCallback("decode_numeric", decode_numeric, &corpus);
+	CorpusFree(&corpus);
+}
+
+/* decode_array() with the element decoder of int[] */
+static int
+decode_int_array(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	static const AttributeDecoder element = {DECODE_TYPE, decode_int};
+
+	return decode_array(&element, buffer, buff_size, out_size);
+}
+
+/* int[] values of up to 2000 elements, reported per element */
+static void
+BenchIntArrays(void)
+{
+	BenchCorpus corpus;
+	static char buffer[ARRAY_OVERHEAD_NONULLS(1) + 2000 * sizeof(int32)];
+	ArrayHeader *header = (ArrayHeader *) buffer;
+	int32	   *elements = (int32 *) (buffer + ARRAY_OVERHEAD_NONULLS(1));
+	uint64		nelements = 0;
+	uint64		i;
+
+	CorpusInit(&corpus);
+	for (i = 0; i < BENCH_VALUES / 1000; i++)
+	{
+		int			nitems = 1 + BenchRandom() % 2000;
+		int			lbound = 1;
+		int			j;
+
+		for (j = 0; j < nitems; j++)
+			elements[j] = (int32) BenchRandom();
+
+		header->ndim = 1;
+		header->dataoffset = 0;
+		header->elemtype = 23;	/* int4 */
+		memcpy(buffer + sizeof(ArrayHeader), &nitems, sizeof(int));
+		memcpy(buffer + sizeof(ArrayHeader) + sizeof(int), &lbound, sizeof(int));
+		SET_VARSIZE(buffer, ARRAY_OVERHEAD_NONULLS(1) + nitems * sizeof(int32));
+		CorpusAppend(&corpus, buffer, VARSIZE(buffer), ALIGNOF_INT);
+		nelements += nitems;
+	}
+	corpus.nvalues = nelements;
+	BenchCallback("decode_array (int)", decode_int_array, &corpus);
+	CorpusFree(&corpus);
+}
+
+static void
+BenchNames(void)
+{
+	BenchCorpus corpus;
+	char		name[NAMEDATALEN];
+	uint64		i;
+
+	CorpusInit(&corpus);
+	for (i = 0; i < BENCH_VALUES; i++)
+	{
+		memset(name, 0, sizeof(name));
+		BenchText(name, 4 + BenchRandom() % 20, false);
+		CorpusAppend(&corpus, name, NAMEDATALEN, 1);
+	}
+	BenchCallback("decode_name", decode_name, &corpus);
+	CorpusFree(&corpus);
+}
+
+static void
+BenchCopyAppendEncode(void)
+{
+	static char text[BENCH_VALUES_PER_ROW * 256];
+	double		best = 0;
+	uint64		allocs = 0;
+	int			pass;
+
+	BenchText(text, sizeof(text), true);
+	CopyClear();
+
+	for (pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		uint64		startAllocs = benchAllocs;
+		double		start = BenchNow();
+		double		elapsed;
+		uint64		i;
+
+		for (i = 0; i < BENCH_VALUES; i++)
+		{
+			CopyAppendEncode(text + (i % BENCH_VALUES_PER_ROW) * 256, 256);
+			if ((i + 1) % BENCH_VALUES_PER_ROW == 0)
+				CopyClear();
+		}
+		elapsed = BenchNow() - start;
+
+		if (pass == 0 || elapsed < best)
+		{
+			best = elapsed;
+			allocs = benchAllocs - startAllocs;
+		}
+	}
+
+	BenchReport("CopyAppendEncode (256B)", BENCH_VALUES, best, allocs);
+}
+
+/* FormatBinary and pg_checksum_page are measured per 8kB page */
+static void
+BenchPages(void)
+{
+	int			npages = 4096;
+	char	   *pages = (malloc) ((Size) npages * BLCKSZ);
+	double		bestBinary = 0;
+	double		bestChecksum = 0;
+	uint64		allocsBinary = 0;
+	volatile uint16 sum = 0;
+	int			pass;
+	int			i;
+
+	if (!pages)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < npages * BLCKSZ; i++)
+		pages[i] = (char) BenchRandom();
+
+	for (pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		uint64		startAllocs = benchAllocs;
+		double		start;
+		double		elapsed;
+
+		BenchMuteStdout(true);
+		start = BenchNow();
+		for (i = 0; i < npages; i++)
+			FormatBinary(pages + (Size) i * BLCKSZ, BLCKSZ, 0);
+		fflush(stdout);
+		elapsed = BenchNow() - start;
+		BenchMuteStdout(false);
+		if (pass == 0 || elapsed < bestBinary)
+		{
+			bestBinary = elapsed;
+			allocsBinary = benchAllocs - startAllocs;
+		}
+
+		start = BenchNow();
+		for (i = 0; i < npages; i++)
+			sum += pg_checksum_page(pages + (Size) i * BLCKSZ, i);
+		elapsed = BenchNow() - start;
+		if (pass == 0 || elapsed < bestChecksum)
+			bestChecksum = elapsed;
+	}
+
+	BenchReport("FormatBinary (page)", npages, bestBinary, allocsBinary);
+	BenchReport("pg_checksum_page (page)", npages, bestChecksum, 0);
+	(free) (pages);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *filter = argc > 1 ? argv[1] : NULL;
+
+	printf("%-28s %12s %12s\n", "kernel", "ns/value", "allocs/value");
+	printf("%s\n", "----------------------------------------------------");
+
+#define BENCH(name, call) \
+	do { \
+		if (filter == NULL || strstr(name, filter) != NULL) \
+			call; \
+	} while (0)
+
+	BENCH("decode_smallint", BenchFixed("decode_smallint", decode_smallint, sizeof(int16), ALIGNOF_SHORT));
+	BENCH("decode_int", BenchFixed("decode_int", decode_int, sizeof(int32), ALIGNOF_INT));
+	BENCH("decode_uint", BenchFixed("decode_uint", decode_uint, sizeof(uint32), ALIGNOF_INT));
+	BENCH("decode_bigint", BenchFixed("decode_bigint", decode_bigint, sizeof(int64), ALIGNOF_LONG));
+	BENCH("decode_float4", BenchFixed("decode_float4", decode_float4, sizeof(float4), ALIGNOF_INT));
+	BENCH("decode_float8", BenchFixed("decode_float8", decode_float8, sizeof(float8), ALIGNOF_DOUBLE));
+	BENCH("decode_bool", BenchFixed("decode_bool", decode_bool, sizeof(bool), 1));
+	BENCH("decode_uuid", BenchFixed("decode_uuid", decode_uuid, 16, 1));
+	BENCH("decode_macaddr", BenchFixed("decode_macaddr", decode_macaddr, 6, ALIGNOF_INT));
+	BENCH("decode_date", BenchFixed("decode_date", decode_date, sizeof(int32), ALIGNOF_INT));
+	BENCH("decode_time", BenchFixed("decode_time", decode_time, sizeof(int64), ALIGNOF_DOUBLE));
+	BENCH("decode_timetz", BenchFixed("decode_timetz", decode_timetz, sizeof(int64) + sizeof(int32), ALIGNOF_DOUBLE));
+	BENCH("decode_timestamp", BenchFixed("decode_timestamp", decode_timestamp, sizeof(int64), ALIGNOF_DOUBLE));
+	BENCH("decode_timestamptz", BenchFixed("decode_timestamptz", decode_timestamptz, sizeof(int64), ALIGNOF_DOUBLE));
+	BENCH("decode_numeric", BenchNumeric());
+	BENCH("decode_array (int)", BenchIntArrays());
+	BENCH("decode_name", BenchNames());
+	BENCH("decode_string (short)", BenchStrings("decode_string (short)", 0, 100, -1));
+	BENCH("decode_string (long)", BenchStrings("decode_string (long)", 200, 2000, -1));
+	BENCH("extract_data (pglz)", BenchStrings("extract_data (pglz)", 1000, 4000, TOAST_PGLZ_COMPRESSION_ID));
+#if PG_VERSION_NUM >= 140000 && defined(USE_LZ4)
+	BENCH("extract_data (lz4)", BenchStrings("extract_data (lz4)", 1000, 4000, TOAST_LZ4_COMPRESSION_ID));
+#endif
+	BENCH("CopyAppendEncode", BenchCopyAppendEncode());
+	BENCH("FormatBinary pg_checksum_page", BenchPages());
+
+	return 0;
+}
@@ -0,0 +1,1092 @@
+/*
+ * gen_relation.c - generate synthetic heap, toast, btree and gin relation
+ *					files for the pg_filedump benchmark suite.
+ *
+ * Copyright (c) 2011-2024, PostgreSQL Global Development Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The files are written without a running server.  Every page carries a
+ * valid checksum, so the generated relations can be fed to all of the
+ * pg_filedump modes, including -k.  The heap has the layout
+ *
+ *	 id int, ts timestamp, amount numeric, flag bool, score float8,
+ *	 uid uuid, note text, payload text
+ *
+ * with nulls, short and long varlena headers, inline compressed values and
+ * external values (compressed and uncompressed) stored in a matching toast
+ * relation.  A btree index on "id" and a gin posting tree over all heap
+ * TIDs are generated alongside.  A manifest describing the files is written
+ * for bench/run_bench.pl.
+ */
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "access/gin_private.h"
+#include "access/htup_details.h"
+#include "access/itup.h"
+#include "access/nbtree.h"
+#if PG_VERSION_NUM >= 140000
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#include "access/toast_compression.h"
+#endif
+#if PG_VERSION_NUM >= 130000
+#include "access/heaptoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+#include "common/pg_lzcompress.h"
+#include "storage/bufpage.h"
+
+/*	checksum_impl.h uses Assert, which doesn't work outside the server */
+#undef Assert
+#define Assert(X)
+
+#include "storage/checksum.h"
+#include "storage/checksum_impl.h"
+#include "decode.h"
+
+#if PG_VERSION_NUM < 140000
+#define TOAST_PGLZ_COMPRESSION_ID	0
+#define TOAST_LZ4_COMPRESSION_ID	1
+#define VARLENA_EXTSIZE_BITS		30
+#endif
+
+/* File names of the generated relations, chosen like relfilenodes */
+#define HEAP_RELFILENODE	16384
+#define TOAST_RELFILENODE	16385
+#define BTREE_RELFILENODE	16386
+#define GIN_RELFILENODE		16387
+
+/* Type string to pass to pg_filedump -D for the generated heap */
+#define HEAP_ATTRTYPES		"int,timestamp,numeric,bool,float8,uuid,text,text"
+#define HEAP_NATTS			8
+
+/* Leave some free space on btree pages, like the default fillfactor */
+#define BTREE_FILL_PERCENT	90
+
+typedef union GenPage
+{
+	char		data[BLCKSZ];
+	double		force_align_d;
+	int64		force_align_i64;
+}			GenPage;
+
+typedef struct RelationWriter
+{
+	FILE	   *fp;
+	char		path[MAXPGPATH];
+	GenPage		page;
+	BlockNumber nblocks;
+	uint64		ntuples;
+}			RelationWriter;
+
+/*
+ * Heap tuple under construction.  Attribute data is aligned relative to
+ * data[0], which is fine since t_hoff is always MAXALIGNed.
+ */
+typedef struct TupleBuilder
+{
+	char		data[BLCKSZ];
+	Size		len;
+	int			natts;
+	bool		hasnull;
+	uint16		infomask;
+	bits8		bits[BITMAPLEN(HEAP_NATTS)];
+}			TupleBuilder;
+
+/* Generation statistics reported in the manifest */
+static uint64 nullValues = 0;
+static uint64 compressedValues = 0;
+static uint64 externalValues = 0;
+
+static uint64 randomState = 0x2545F4914F6CDD1DULL;
+static Oid	nextValueId = 100000;
+
+static RelationWriter heapRel;
+static RelationWriter toastRel;
+
+/* TIDs of all heap tuples, used to fill btree and gin */
+static ItemPointerData *heapTids = NULL;
+static uint64 nheapTids = 0;
+static uint64 maxHeapTids = 0;
+
+static const char *const words[] = {
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+	"elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+	"et", "dolore", "magna", "aliqua", "postgres", "heap", "tuple", "page",
+	"checksum", "toast", "chunk", "index", "vacuum", "xmin", "xmax"
+};
+
+/* xorshift64*, good enough and reproducible across platforms */
+static uint64
+NextRandom(void)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return randomState * UINT64CONST(2685821657736338717);
+}
+
+static int
+RandomInt(int max)
+{
+	return (int) (NextRandom() % (uint64) max);
+}
+
+/* Fill buffer with compressible text of the given length */
+static void
+RandomText(char *buffer, int len)
+{
+	int			pos = 0;
+
+	while (pos < len)
+	{
+		const char *word = words[RandomInt(lengthof(words))];
+		int			wlen = strlen(word);
+
+		if (pos + wlen + 1 > len)
+			wlen = len - pos;
+		memcpy(buffer + pos, word, wlen);
+		pos += wlen;
+		if (pos < len)
+			buffer[pos++] = (RandomInt(16) == 0) ? '\n' : ' ';
+	}
+}
+
+static void
+OpenRelation(RelationWriter *rel, const char *dir, Oid relfilenode)
+{
+	snprintf(rel->path, sizeof(rel->path), "%s/%u", dir, relfilenode);
+	rel->fp = fopen(rel->path, "wb");
+	if (!rel->fp)
+	{
+		printf("Error: Could not create file <%s>.\n", rel->path);
+		exit(1);
+	}
+	rel->nblocks = 0;
+	rel->ntuples = 0;
+}
+
+static void
+CloseRelation(RelationWriter *rel)
+{
+	if (fclose(rel->fp) != 0)
+	{
+		printf("Error: Could not write file <%s>.\n", rel->path);
+		exit(1);
+	}
+}
+
+/* Local equivalent of the backend's PageInit() */
+static void
+InitPage(Page page, Size specialSize)
+{
+	PageHeader	phdr = (PageHeader) page;
+
+	specialSize = MAXALIGN(specialSize);
+	memset(page, 0, BLCKSZ);
+	phdr->pd_lower = SizeOfPageHeaderData;
+	phdr->pd_upper = BLCKSZ - specialSize;
+	phdr->pd_special = BLCKSZ - specialSize;
+	PageSetPageSizeAndVersion(page, BLCKSZ, PG_PAGE_LAYOUT_VERSION);
+}
+
+/* Free space on page for a new item including its line pointer */
+static Size
+PageFreeSpace(Page page)
+{
+	PageHeader	phdr = (PageHeader) page;
+	int			space = (int) phdr->pd_upper - (int) phdr->pd_lower;
+
+	if (space < (int) sizeof(ItemIdData))
+		return 0;
+	return (Size) (space - sizeof(ItemIdData));
+}
+
+/* Append item at the end of the line pointer array */
+static OffsetNumber
+AddItem(Page page, const char *item, Size size)
+{
+	PageHeader	phdr = (PageHeader) page;
+	OffsetNumber offnum = PageGetMaxOffsetNumber(page) + 1;
+	ItemId		itemId;
+	unsigned int upper;
+
+	if (MAXALIGN(size) > PageFreeSpace(page))
+		return InvalidOffsetNumber;
+
+	upper = phdr->pd_upper - MAXALIGN(size);
+	itemId = PageGetItemId(page, offnum);
+	ItemIdSetNormal(itemId, upper, size);
+	memcpy(page + upper, item, size);
+
+	phdr->pd_lower += sizeof(ItemIdData);
+	phdr->pd_upper = upper;
+
+	return offnum;
+}
+
+/* Checksum the current page and write it out as the next block */
+static void
+WritePage(RelationWriter *rel, BlockNumber blkno)
+{
+	PageHeader	phdr = (PageHeader) rel->page.data;
+
+	phdr->pd_checksum = pg_checksum_page(rel->page.data, blkno);
+
+	if (fseeko(rel->fp, (off_t) blkno * BLCKSZ, SEEK_SET) != 0 ||
+		fwrite(rel->page.data, 1, BLCKSZ, rel->fp) != BLCKSZ)
+	{
+		printf("Error: Could not write block %u of <%s>.\n", blkno, rel->path);
+		exit(1);
+	}
+
+	if (blkno >= rel->nblocks)
+		rel->nblocks = blkno + 1;
+}
+
+static void
+FlushHeapPage(RelationWriter *rel)
+{
+	if (PageGetMaxOffsetNumber(rel->page.data) == 0)
+		return;
+
+	WritePage(rel, rel->nblocks);
+	InitPage(rel->page.data, 0);
+}
+
+/*
+ * Place a finished heap tuple on the current page of rel, starting a new
+ * page when it does not fit.  The tuple's t_ctid is set to its own TID.
+ */
+static void
+StoreHeapTuple(RelationWriter *rel, HeapTupleHeader htup, Size size)
+{
+	OffsetNumber offnum;
+
+	if (MAXALIGN(size) > PageFreeSpace(rel->page.data))
+		FlushHeapPage(rel);
+
+	offnum = PageGetMaxOffsetNumber(rel->page.data) + 1;
+	ItemPointerSet(&htup->t_ctid, rel->nblocks, offnum);
+	if (AddItem(rel->page.data, (char *) htup, size) == InvalidOffsetNumber)
+	{
+		printf("Error: tuple of %u bytes does not fit on an empty page.\n",
+			   (unsigned int) size);
+		exit(1);
+	}
+	rel->ntuples++;
+
+	if (rel == &heapRel)
+	{
+		if (nheapTids == maxHeapTids)
+		{
+			maxHeapTids = maxHeapTids ? maxHeapTids * 2 : 65536;
+			heapTids = realloc(heapTids, maxHeapTids * sizeof(ItemPointerData));
+			if (!heapTids)
+			{
+				perror("realloc");
+				exit(1);
+			}
+		}
+		ItemPointerSet(&heapTids[nheapTids++], rel->nblocks, offnum);
+	}
+}
+
+static void
+BeginTuple(TupleBuilder *tb)
+{
+	tb->len = 0;
+	tb->natts = 0;
+	tb->hasnull = false;
+	tb->infomask = 0;
+	memset(tb->bits, 0, sizeof(tb->bits));
+}
+
+static void
+AlignTuple(TupleBuilder *tb, int align)
+{
+	Size		aligned = TYPEALIGN(align, tb->len);
+
+	memset(tb->data + tb->len, 0, aligned - tb->len);
+	tb->len = aligned;
+}
+
+static void
+AddNull(TupleBuilder *tb)
+{
+	tb->hasnull = true;
+	tb->natts++;
+	nullValues++;
+}
+
+static void
+AddFixed(TupleBuilder *tb, const void *value, Size size, int align)
+{
+	AlignTuple(tb, align);
+	memcpy(tb->data + tb->len, value, size);
+	tb->len += size;
+	tb->bits[tb->natts >> 3] |= (1 << (tb->natts & 0x07));
+	tb->natts++;
+}
+
+/* Add an uncompressed inline varlena, packed to a short header if possible */
+static void
+AddVarlena(TupleBuilder *tb, const char *value, Size size)
+{
+	char	   *ptr;
+
+	if (size + VARHDRSZ_SHORT <= VARATT_SHORT_MAX)
+	{
+		ptr = tb->data + tb->len;
+		SET_VARSIZE_SHORT(ptr, size + VARHDRSZ_SHORT);
+		memcpy(ptr + VARHDRSZ_SHORT, value, size);
+		tb->len += size + VARHDRSZ_SHORT;
+	}
+	else
+	{
+		AlignTuple(tb, ALIGNOF_INT);
+		ptr = tb->data + tb->len;
+		SET_VARSIZE(ptr, size + VARHDRSZ);
+		memcpy(ptr + VARHDRSZ, value, size);
+		tb->len += size + VARHDRSZ;
+	}
+	tb->bits[tb->natts >> 3] |= (1 << (tb->natts & 0x07));
+	tb->infomask |= HEAP_HASVARWIDTH;
+	tb->natts++;
+}
+
+/*
+ * Compress value with the given method into dest, prefixed by the 4-byte
+ * raw size and method word used both inline and in external values.
+ * Returns the total size written or -1 if the value is not compressible.
+ */
+static int
+CompressValue(const char *value, int size, int cmid, char *dest)
+{
+	int32		clen = -1;
+	uint32		tcinfo = ((uint32) size) | ((uint32) cmid << VARLENA_EXTSIZE_BITS);
+
+	if (cmid == TOAST_LZ4_COMPRESSION_ID)
+	{
+#if PG_VERSION_NUM >= 140000 && defined(USE_LZ4)
+		clen = LZ4_compress_default(value, dest + sizeof(uint32), size,
+									LZ4_compressBound(size));
+		if (clen <= 0)
+			clen = -1;
+#endif
+	}
+	else
+		clen = pglz_compress(value, size, dest + sizeof(uint32),
+							 PGLZ_strategy_always);
+
+	if (clen < 0 || clen + sizeof(uint32) >= (Size) size)
+		return -1;
+
+	memcpy(dest, &tcinfo, sizeof(uint32));
+	return clen + sizeof(uint32);
+}
+
+static int
+CompressionMethod(void)
+{
+#if PG_VERSION_NUM >= 140000 && defined(USE_LZ4)
+	if (RandomInt(2))
+		return TOAST_LZ4_COMPRESSION_ID;
+#endif
+	return TOAST_PGLZ_COMPRESSION_ID;
+}
+
+/* Add an inline compressed varlena, falling back to plain storage */
+static void
+AddCompressed(TupleBuilder *tb, const char *value, int size)
+{
+	char	   *cbuf = malloc(PGLZ_MAX_OUTPUT(size) + size + 2 * sizeof(uint32));
+	int			clen;
+
+	if (!cbuf)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	clen = CompressValue(value, size, CompressionMethod(), cbuf);
+	if (clen < 0)
+		AddVarlena(tb, value, size);
+	else
+	{
+		char	   *ptr;
+
+		AlignTuple(tb, ALIGNOF_INT);
+		ptr = tb->data + tb->len;
+		SET_VARSIZE_COMPRESSED(ptr, clen + VARHDRSZ);
+		memcpy(ptr + VARHDRSZ, cbuf, clen);
+		tb->len += clen + VARHDRSZ;
+		tb->bits[tb->natts >> 3] |= (1 << (tb->natts & 0x07));
+		tb->infomask |= HEAP_HASVARWIDTH;
+		tb->natts++;
+		compressedValues++;
+	}
+
+	free(cbuf);
+}
+
+/*
+ * Finish the tuple into out and return its total size.  All tuples are
+ * committed; a few are marked as deleted by a later transaction so that
+ * the -o switch has something to skip.
+ */
+static Size
+FinishTuple(TupleBuilder *tb, HeapTupleHeader out, TransactionId xmin)
+{
+	Size		hoff = SizeofHeapTupleHeader;
+	uint16		infomask = tb->infomask | HEAP_XMIN_COMMITTED;
+
+	if (tb->hasnull)
+	{
+		infomask |= HEAP_HASNULL;
+		hoff += BITMAPLEN(tb->natts);
+	}
+	hoff = MAXALIGN(hoff);
+
+	memset(out, 0, hoff);
+	out->t_choice.t_heap.t_xmin = xmin;
+	if (RandomInt(32) == 0)
+	{
+		out->t_choice.t_heap.t_xmax = xmin + 1;
+		infomask |= HEAP_XMAX_COMMITTED;
+	}
+	else
+		infomask |= HEAP_XMAX_INVALID;
+	out->t_infomask = infomask;
+	HeapTupleHeaderSetNatts(out, tb->natts);
+	out->t_hoff = hoff;
+	if (tb->hasnull)
+		memcpy(out->t_bits, tb->bits, BITMAPLEN(tb->natts));
+	memcpy((char *) out + hoff, tb->data, tb->len);
+
+	return hoff + tb->len;
+}
+
+/* Write value as chunk tuples (chunk_id, chunk_seq, chunk_data) */
+static void
+StoreToastValue(Oid valueid, const char *data, int32 size)
+{
+	static union
+	{
+		HeapTupleHeaderData hdr;
+		char		data[TOAST_MAX_CHUNK_SIZE + 64];
+		double		force_align_d;
+	}			chunk;
+	int32		chunkSeq = 0;
+	int32		offset = 0;
+
+	while (offset < size)
+	{
+		int32		chunkSize = Min(TOAST_MAX_CHUNK_SIZE, size - offset);
+		Size		hoff = MAXALIGN(SizeofHeapTupleHeader);
+		char	   *ptr = chunk.data + hoff;
+
+		memset(chunk.data, 0, hoff);
+		chunk.hdr.t_choice.t_heap.t_xmin = FirstNormalTransactionId;
+		chunk.hdr.t_infomask = HEAP_HASVARWIDTH | HEAP_XMIN_COMMITTED |
+			HEAP_XMAX_INVALID;
+		HeapTupleHeaderSetNatts(&chunk.hdr, 3);
+		chunk.hdr.t_hoff = hoff;
+
+		memcpy(ptr, &valueid, sizeof(Oid));
+		memcpy(ptr + sizeof(Oid), &chunkSeq, sizeof(int32));
+		/* chunk_data has plain storage, so it always has a 4-byte header */
+		ptr += sizeof(Oid) + sizeof(int32);
+		SET_VARSIZE(ptr, chunkSize + VARHDRSZ);
+		memcpy(ptr + VARHDRSZ, data + offset, chunkSize);
+
+		StoreHeapTuple(&toastRel, &chunk.hdr,
+					   hoff + sizeof(Oid) + sizeof(int32) + VARHDRSZ + chunkSize);
+
+		offset += chunkSize;
+		chunkSeq++;
+	}
+}
+
+/* Move a value out of line and add the on-disk TOAST pointer to tb */
+static void
+AddExternal(TupleBuilder *tb, const char *value, int size, bool compress)
+{
+	varatt_external toast_ptr;
+	char	   *cbuf = NULL;
+	const char *stored = value;
+	int32		extsize = size;
+	int			cmid = CompressionMethod();
+	char	   *ptr;
+
+	if (compress)
+	{
+		int			clen;
+
+		cbuf = malloc(PGLZ_MAX_OUTPUT(size) + size + 2 * sizeof(uint32));
+		if (!cbuf)
+		{
+			perror("malloc");
+			exit(1);
+		}
+		clen = CompressValue(value, size, cmid, cbuf);
+		if (clen > 0)
+		{
+			stored = cbuf;
+			extsize = clen;
+		}
+		else
+			compress = false;
+	}
+
+	toast_ptr.va_rawsize = size + VARHDRSZ;
+#if PG_VERSION_NUM >= 140000
+	if (compress)
+		VARATT_EXTERNAL_SET_SIZE_AND_COMPRESS_METHOD(toast_ptr, extsize, cmid);
+	else
+		toast_ptr.va_extinfo = extsize;
+#else
+	toast_ptr.va_extsize = extsize;
+#endif
+	toast_ptr.va_valueid = nextValueId++;
+	toast_ptr.va_toastrelid = TOAST_RELFILENODE;
+
+	StoreToastValue(toast_ptr.va_valueid, stored, extsize);
+
+	ptr = tb->data + tb->len;
+	SET_VARTAG_EXTERNAL(ptr, VARTAG_ONDISK);
+	memcpy(VARDATA_EXTERNAL(ptr), &toast_ptr, sizeof(toast_ptr));
+	tb->len += VARHDRSZ_EXTERNAL + sizeof(toast_ptr);
+	tb->bits[tb->natts >> 3] |= (1 << (tb->natts & 0x07));
+	tb->infomask |= HEAP_HASVARWIDTH | HEAP_HASEXTERNAL;
+	tb->natts++;
+	externalValues++;
+
+	free(cbuf);
+}
+
+/* Build a numeric datum for cents / 100 with display scale 2 */
+static void
+AddNumeric(TupleBuilder *tb, int64 cents)
+{
+	NumericDigit digits[8];
+	NumericDigit buf[8];
+	int			ndigits = 0;
+	int			nint = 0;
+	int			weight;
+	bool		negative = cents < 0;
+	uint64		absval = negative ? -cents : cents;
+	uint64		intpart = absval / 100;
+	NumericDigit frac = (NumericDigit) ((absval % 100) * 100);
+	char		datum[NUMERIC_HDRSZ_SHORT + sizeof(digits)];
+	uint16		header;
+	int			i;
+
+	while (intpart > 0)
+	{
+		buf[nint++] = (NumericDigit) (intpart % NBASE);
+		intpart /= NBASE;
+	}
+	for (i = nint - 1; i >= 0; i--)
+		digits[ndigits++] = buf[i];
+	weight = nint - 1;
+	if (frac != 0)
+		digits[ndigits++] = frac;
+
+	/* strip trailing zero digits, as make_result() does */
+	while (ndigits > 0 && digits[ndigits - 1] == 0)
+		ndigits--;
+	if (ndigits == 0)
+	{
+		weight = 0;
+		negative = false;
+	}
+
+	header = NUMERIC_SHORT | (2 << NUMERIC_SHORT_DSCALE_SHIFT) |
+		(negative ? NUMERIC_SHORT_SIGN_MASK : 0) |
+		(weight < 0 ? NUMERIC_SHORT_WEIGHT_SIGN_MASK : 0) |
+		(weight & NUMERIC_SHORT_WEIGHT_MASK);
+
+	memcpy(datum, &header, sizeof(uint16));
+	memcpy(datum + sizeof(uint16), digits, ndigits * sizeof(NumericDigit));
+	AddVarlena(tb, datum, sizeof(uint16) + ndigits * sizeof(NumericDigit));
+}
+
+static void
+GenerateHeapTuple(int32 id)
+{
+	static TupleBuilder tb;
+	static union
+	{
+		HeapTupleHeaderData hdr;
+		char		data[BLCKSZ];
+		double		force_align_d;
+	}			tuple;
+	static char text[64 * 1024];
+	int64		ts;
+	bool		flag;
+	double		score;
+	unsigned char uid[16];
+	int			len;
+	int			i;
+
+	BeginTuple(&tb);
+
+	/* id int */
+	AddFixed(&tb, &id, sizeof(int32), ALIGNOF_INT);
+
+	/* ts timestamp, roughly 2020 onward, advancing with id */
+	ts = INT64CONST(631152000000000) + (int64) id * 1000000 + RandomInt(1000000);
+	AddFixed(&tb, &ts, sizeof(int64), ALIGNOF_DOUBLE);
+
+	/* amount numeric */
+	if (RandomInt(20) == 0)
+		AddNull(&tb);
+	else
+		AddNumeric(&tb, (int64) RandomInt(200000000) - 20000000);
+
+	/* flag bool */
+	flag = RandomInt(2);
+	AddFixed(&tb, &flag, sizeof(bool), 1);
+
+	/* score float8 */
+	score = (double) RandomInt(1000000) / 997.0;
+	AddFixed(&tb, &score, sizeof(double), ALIGNOF_DOUBLE);
+
+	/* uid uuid */
+	for (i = 0; i < 16; i++)
+		uid[i] = (unsigned char) RandomInt(256);
+	AddFixed(&tb, uid, sizeof(uid), 1);
+
+	/* note text: mostly short, some long, a few inline compressed */
+	i = RandomInt(100);
+	if (i < 10)
+		AddNull(&tb);
+	else if (i < 70)
+	{
+		len = RandomInt(60);
+		RandomText(text, len);
+		AddVarlena(&tb, text, len);
+	}
+	else if (i < 95)
+	{
+		len = 100 + RandomInt(500);
+		RandomText(text, len);
+		AddVarlena(&tb, text, len);
+	}
+	else
+	{
+		len = 1000 + RandomInt(2000);
+		RandomText(text, len);
+		AddCompressed(&tb, text, len);
+	}
+
+	/* payload text: short, occasionally moved to the toast relation */
+	i = RandomInt(100);
+	if (i < 2)
+	{
+		len = 4000 + RandomInt(40000);
+		RandomText(text, len);
+		AddExternal(&tb, text, len, i == 0);
+	}
+	else
+	{
+		len = 8 + RandomInt(24);
+		RandomText(text, len);
+		AddVarlena(&tb, text, len);
+	}
+
+	StoreHeapTuple(&heapRel, &tuple.hdr,
+				   FinishTuple(&tb, &tuple.hdr, FirstNormalTransactionId + id));
+}
+
+static void
+InitBtreePage(Page page, uint16 flags, uint32 level,
+			  BlockNumber prev, BlockNumber next)
+{
+	BTPageOpaque opaque;
+
+	InitPage(page, sizeof(BTPageOpaqueData));
+	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	opaque->btpo_prev = prev;
+	opaque->btpo_next = next;
+#if PG_VERSION_NUM >= 140000
+	opaque->btpo_level = level;
+#else
+	opaque->btpo.level = level;
+#endif
+	opaque->btpo_flags = flags;
+	opaque->btpo_cycleid = 0;
+}
+
+/* Add an int4 key index tuple, or a key-less one for "minus infinity" */
+static void
+AddIndexTuple(Page page, const int32 *key, BlockNumber blkno, OffsetNumber offnum)
+{
+	union
+	{
+		IndexTupleData itup;
+		char		data[32];
+	}			tuple;
+	Size		size = sizeof(IndexTupleData);
+
+	memset(tuple.data, 0, sizeof(tuple.data));
+	ItemPointerSet(&tuple.itup.t_tid, blkno, offnum);
+	if (key)
+	{
+		size = INTALIGN(size);
+		memcpy(tuple.data + size, key, sizeof(int32));
+		size += sizeof(int32);
+	}
+	size = MAXALIGN(size);
+	tuple.itup.t_info = size;
+
+	if (AddItem(page, tuple.data, size) == InvalidOffsetNumber)
+	{
+		printf("Error: index page overflow.\n");
+		exit(1);
+	}
+}
+
+/*
+ * Write a btree over heap ids.  The heap ids are dense and ascending, so
+ * the key of heap tuple n is simply n + 1.
+ */
+static void
+GenerateBtree(const char *dir, uint64 *ntuples, BlockNumber *nblocks)
+{
+	RelationWriter rel;
+	Size		itemSpace = MAXALIGN(sizeof(IndexTupleData) + sizeof(int32)) +
+		sizeof(ItemIdData);
+	Size		usable = (BLCKSZ - SizeOfPageHeaderData -
+						  MAXALIGN(sizeof(BTPageOpaqueData)));
+	uint64		perPage = (usable * BTREE_FILL_PERCENT / 100) / itemSpace - 1;
+	uint64		nchildren;
+	int32	   *childKeys;
+	BlockNumber firstChild = 1;
+	BlockNumber levelStart;
+	uint32		level = 0;
+	BTMetaPageData *meta;
+	uint64		i;
+
+	OpenRelation(&rel, dir, BTREE_RELFILENODE);
+
+	/* Leaf level */
+	nchildren = (nheapTids + perPage - 1) / perPage;
+	if (nchildren == 0)
+		nchildren = 1;
+	for (i = 0; i < nchildren; i++)
+	{
+		BlockNumber blkno = firstChild + i;
+		uint64		first = i * perPage;
+		uint64		last = Min(first + perPage, nheapTids);
+		uint16		flags = BTP_LEAF | (nchildren == 1 ? BTP_ROOT : 0);
+		uint64		j;
+
+		InitBtreePage(rel.page.data, flags, 0,
+					  i == 0 ? P_NONE : blkno - 1,
+					  i == nchildren - 1 ? P_NONE : blkno + 1);
+
+		/* high key on every page but the rightmost */
+		if (i < nchildren - 1)
+		{
+			int32		hikey = (int32) (last + 1);
+
+			AddIndexTuple(rel.page.data, &hikey, InvalidBlockNumber, 0);
+		}
+		for (j = first; j < last; j++)
+		{
+			int32		key = (int32) (j + 1);
+
+			AddIndexTuple(rel.page.data, &key,
+						  ItemPointerGetBlockNumber(&heapTids[j]),
+						  ItemPointerGetOffsetNumber(&heapTids[j]));
+			rel.ntuples++;
+		}
+		WritePage(&rel, blkno);
+	}
+
+	/* Internal levels, until everything fits on the root page */
+	childKeys = malloc(nchildren * sizeof(int32));
+	if (!childKeys)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < nchildren; i++)
+		childKeys[i] = (int32) (i * perPage + 1);
+
+	levelStart = firstChild;
+	while (nchildren > 1)
+	{
+		uint64		nparents = (nchildren + perPage - 1) / perPage;
+		BlockNumber parentStart = levelStart + nchildren;
+
+		level++;
+		for (i = 0; i < nparents; i++)
+		{
+			BlockNumber blkno = parentStart + i;
+			uint64		first = i * perPage;
+			uint64		last = Min(first + perPage, nchildren);
+			uint64		j;
+
+			InitBtreePage(rel.page.data, nparents == 1 ? BTP_ROOT : 0, level,
+						  i == 0 ? P_NONE : blkno - 1,
+						  i == nparents - 1 ? P_NONE : blkno + 1);
+
+			if (i < nparents - 1)
+				AddIndexTuple(rel.page.data, &childKeys[last],
+							  InvalidBlockNumber, 0);
+
+			/* the first downlink on each page is "minus infinity" */
+			for (j = first; j < last; j++)
+				AddIndexTuple(rel.page.data, j == first ? NULL : &childKeys[j],
+							  levelStart + j, P_HIKEY);
+			WritePage(&rel, blkno);
+
+			/* the parent's first key is the one of its first child */
+			childKeys[i] = childKeys[first];
+		}
+
+		levelStart = parentStart;
+		nchildren = nparents;
+	}
+	free(childKeys);
+
+	/* Meta page */
+	InitBtreePage(rel.page.data, BTP_META, 0, P_NONE, P_NONE);
+	meta = BTPageGetMeta(rel.page.data);
+	meta->btm_magic = BTREE_MAGIC;
+	meta->btm_version = BTREE_VERSION;
+	meta->btm_root = levelStart;
+	meta->btm_level = level;
+	meta->btm_fastroot = levelStart;
+	meta->btm_fastlevel = level;
+	((PageHeader) rel.page.data)->pd_lower =
+		((char *) meta + sizeof(BTMetaPageData)) - rel.page.data;
+	WritePage(&rel, BTREE_METAPAGE);
+
+	CloseRelation(&rel);
+	*ntuples = rel.ntuples;
+	*nblocks = rel.nblocks;
+}
+
+/* Varbyte encoding as in ginpostinglist.c */
+static int
+EncodeVarbyte(uint64 val, unsigned char *ptr)
+{
+	unsigned char *p = ptr;
+
+	while (val > 0x7F)
+	{
+		*(p++) = 0x80 | (val & 0x7F);
+		val >>= 7;
+	}
+	*(p++) = (unsigned char) val;
+
+	return p - ptr;
+}
+
+static uint64
+TidToUint64(ItemPointer tid)
+{
+	return ((uint64) ItemPointerGetBlockNumber(tid) << 11) |
+		ItemPointerGetOffsetNumber(tid);
+}
+
+/* Write a gin meta page followed by compressed posting tree leaf pages */
+static void
+GenerateGin(const char *dir, uint64 *ntuples, BlockNumber *nblocks)
+{
+	RelationWriter rel;
+	GinMetaPageData *meta;
+	Size		maxData = BLCKSZ - MAXALIGN(SizeOfPageHeaderData) -
+		MAXALIGN(sizeof(ItemPointerData)) - MAXALIGN(sizeof(GinPageOpaqueData));
+	uint64		next = 0;
+	BlockNumber blkno = 1;
+
+	OpenRelation(&rel, dir, GIN_RELFILENODE);
+
+	while (next < nheapTids)
+	{
+		Page		page = rel.page.data;
+		GinPageOpaque opaque;
+		Pointer		ptr;
+		Pointer		endptr;
+
+		InitPage(page, sizeof(GinPageOpaqueData));
+		opaque = GinPageGetOpaque(page);
+		opaque->flags = GIN_DATA | GIN_LEAF | GIN_COMPRESSED;
+		opaque->rightlink = InvalidBlockNumber;
+
+		ptr = (Pointer) GinDataLeafPageGetPostingList(page);
+		endptr = ptr + maxData;
+
+		/* Fill the page with segments of up to 384 bytes */
+		while (next < nheapTids &&
+			   ptr + offsetof(GinPostingList, bytes) + 16 <= endptr)
+		{
+			GinPostingList *seg = (GinPostingList *) ptr;
+			Size		room = Min(384, endptr - ptr) - offsetof(GinPostingList, bytes);
+			uint64		prev = TidToUint64(&heapTids[next]);
+			unsigned char encoded[10];
+			int			n;
+
+			seg->first = heapTids[next++];
+			seg->nbytes = 0;
+			while (next < nheapTids)
+			{
+				uint64		val = TidToUint64(&heapTids[next]);
+
+				n = EncodeVarbyte(val - prev, encoded);
+				if (seg->nbytes + n > room)
+					break;
+				memcpy(seg->bytes + seg->nbytes, encoded, n);
+				seg->nbytes += n;
+				prev = val;
+				next++;
+			}
+			rel.ntuples += 1;
+			ptr = (Pointer) GinNextPostingListSegment(seg);
+		}
+
+		/* right bound is the first TID on the next page */
+		if (next < nheapTids)
+		{
+			*GinDataPageGetRightBound(page) = heapTids[next];
+			opaque->rightlink = blkno + 1;
+		}
+		else
+			ItemPointerSetMax(GinDataPageGetRightBound(page));
+
+		((PageHeader) page)->pd_lower = ptr - page;
+		WritePage(&rel, blkno++);
+	}
+
+	/* Meta page */
+	InitPage(rel.page.data, sizeof(GinPageOpaqueData));
+	GinPageGetOpaque(rel.page.data)->flags = GIN_META;
+	GinPageGetOpaque(rel.page.data)->rightlink = InvalidBlockNumber;
+	meta = GinPageGetMeta(rel.page.data);
+	meta->head = meta->tail = InvalidBlockNumber;
+	meta->nDataPages = blkno - 1;
+	meta->ginVersion = GIN_CURRENT_VERSION;
+	((PageHeader) rel.page.data)->pd_lower =
+		((char *) meta + sizeof(GinMetaPageData)) - rel.page.data;
+	WritePage(&rel, GIN_METAPAGE_BLKNO);
+
+	CloseRelation(&rel);
+	*ntuples = rel.ntuples;
+	*nblocks = rel.nblocks;
+}
+
+static void
+Usage(void)
+{
+	printf("\nUsage: gen_relation [-s sizemb] [-r seed] directory\n\n"
+		   "Generate synthetic relation files for the pg_filedump benchmarks\n"
+		   "  -s  Size of the heap relation in megabytes (default 64)\n"
+		   "  -r  Seed for the pseudo random generator\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64		sizeMb = 64;
+	const char *dir = NULL;
+	char		manifestPath[MAXPGPATH];
+	FILE	   *manifest;
+	uint64		btreeTuples,
+				ginSegments;
+	BlockNumber btreeBlocks,
+				ginBlocks;
+	int32		id = 0;
+	int			i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			sizeMb = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			randomState = strtoull(argv[++i], NULL, 10) | 1;
+		else if (argv[i][0] != '-' && dir == NULL)
+			dir = argv[i];
+		else
+		{
+			Usage();
+			exit(1);
+		}
+	}
+
+	if (dir == NULL || sizeMb == 0)
+	{
+		Usage();
+		exit(1);
+	}
+
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+	{
+		printf("Error: Could not create directory <%s>.\n", dir);
+		exit(1);
+	}
+
+	OpenRelation(&heapRel, dir, HEAP_RELFILENODE);
+	OpenRelation(&toastRel, dir, TOAST_RELFILENODE);
+	InitPage(heapRel.page.data, 0);
+	InitPage(toastRel.page.data, 0);
+
+	while ((uint64) heapRel.nblocks * BLCKSZ < sizeMb * 1024 * 1024)
+		GenerateHeapTuple(++id);
+
+	FlushHeapPage(&heapRel);
+	FlushHeapPage(&toastRel);
+	CloseRelation(&heapRel);
+	CloseRelation(&toastRel);
+
+	GenerateBtree(dir, &btreeTuples, &btreeBlocks);
+	GenerateGin(dir, &ginSegments, &ginBlocks);
+
+	snprintf(manifestPath, sizeof(manifestPath), "%s/manifest", dir);
+	manifest = fopen(manifestPath, "w");
+	if (!manifest)
+	{
+		printf("Error: Could not create file <%s>.\n", manifestPath);
+		exit(1);
+	}
+	fprintf(manifest,
+			"heap %u %u " UINT64_FORMAT "\n"
+			"toast %u %u " UINT64_FORMAT "\n"
+			"btree %u %u " UINT64_FORMAT "\n"
+			"gin %u %u " UINT64_FORMAT "\n"
+			"attrtypes %s\n"
+			"nulls " UINT64_FORMAT "\n"
+			"compressed " UINT64_FORMAT "\n"
+			"external " UINT64_FORMAT "\n",
+			HEAP_RELFILENODE, heapRel.nblocks, heapRel.ntuples,
+			TOAST_RELFILENODE, toastRel.nblocks, toastRel.ntuples,
+			BTREE_RELFILENODE, btreeBlocks, btreeTuples,
+			GIN_RELFILENODE, ginBlocks, ginSegments,
+			HEAP_ATTRTYPES, nullValues, compressedValues, externalValues);
+	fclose(manifest);
+
+	printf("Generated " UINT64_FORMAT " heap tuples in %u blocks, "
+		   UINT64_FORMAT " external values in %u toast blocks\n",
+		   heapRel.ntuples, heapRel.nblocks, externalValues, toastRel.nblocks);
+
+	return 0;
+}
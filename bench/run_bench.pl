@@ -0,0 +1,119 @@
+#!/usr/bin/perl
+#
+# run_bench.pl - end-to-end throughput benchmarks for pg_filedump
+#
+# Generates synthetic relation files with bench/gen_relation and times the
+# major pg_filedump modes on them.  Throughput is reported in MB/s of input
+# and in tuples/s; the best of several runs is used to reduce noise.
+#
+# Usage: run_bench.pl [--size MB] [--repeat N] [--dir DIR] [--keep]
+#                     [--filedump PATH] [--generator PATH] [--help]
+
+use strict;
+use warnings;
+use File::Basename;
+use File::Path qw(remove_tree);
+use File::Spec;
+use Getopt::Long;
+use Time::HiRes qw(time);
+
+my $size = 64;
+my $repeat = 3;
+my $dir = 'tmp_bench';
+my $keep = 0;
+my $srcdir = dirname(dirname(File::Spec->rel2abs($0)));
+my $filedump = File::Spec->catfile($srcdir, 'pg_filedump');
+my $generator = File::Spec->catfile($srcdir, 'bench', 'gen_relation');
+my $help = 0;
+my $usage = "Usage: $0 [--size MB] [--repeat N] [--dir DIR] [--keep]\n"
+  . "          [--filedump PATH] [--generator PATH]\n";
+
+GetOptions(
+    'size=i' => \$size,
+    'repeat=i' => \$repeat,
+    'dir=s' => \$dir,
+    'keep' => \$keep,
+    'filedump=s' => \$filedump,
+    'generator=s' => \$generator,
+    'help' => \$help,
+) or die $usage;
+
+if ($help)
+{
+    print $usage;
+    exit 0;
+}
+
+die "pg_filedump not found at $filedump, run make first\n" unless -x $filedump;
+die "generator not found at $generator, run make bench/gen_relation first\n"
+    unless -x $generator;
+
+print "Generating ${size}MB of synthetic relations in $dir\n";
+system($generator, '-s', $size, $dir) == 0
+    or die "Error: could not generate relation files\n";
+
+# manifest lines are "<kind> <relfilenode> <blocks> <tuples>" or "<key> <value>"
+my (%rel, %info);
+open(my $mf, '<', "$dir/manifest") or die "Error: could not read manifest: $!\n";
+while (<$mf>)
+{
+    chomp;
+    my @f = split / /;
+    if (@f == 4)
+    {
+        $rel{$f[0]} = { file => "$dir/$f[1]", blocks => $f[2], tuples => $f[3] };
+    }
+    else
+    {
+        $info{$f[0]} = $f[1];
+    }
+}
+close($mf);
+
+my $types = $info{attrtypes};
+my $heap = $rel{heap};
+
+my @modes = (
+    [ 'heap -d',       'heap',  [ '-d' ] ],
+    [ 'heap -f',       'heap',  [ '-f' ] ],
+    [ 'heap -i',       'heap',  [ '-i' ] ],
+    [ 'heap -k',       'heap',  [ '-k' ] ],
+    [ 'heap -D',       'heap',  [ '-D', $types ] ],
+    [ 'heap -D -t',    'heap',  [ '-D', $types, '-t' ] ],
+    [ 'toast -i',      'toast', [ '-i' ] ],
+    [ 'btree -i',      'btree', [ '-i' ] ],
+    [ 'gin -i',        'gin',   [ '-i' ] ],
+);
+
+printf "\n%-14s %10s %10s %10s %14s\n", 'mode', 'MB', 'seconds', 'MB/s', 'tuples/s';
+printf "%s\n", '-' x 62;
+
+foreach my $mode (@modes)
+{
+    my ($name, $kind, $options) = @$mode;
+    my $r = $rel{$kind};
+    my $best;
+
+    for (1 .. $repeat)
+    {
+        my $start = time();
+        my $rc = system("'$filedump' @{[ map { qq('$_') } @$options ]} '$r->{file}' > /dev/null");
+        my $elapsed = time() - $start;
+
+        # pg_filedump exits with 1 after reporting any error in the file
+        warn "Warning: pg_filedump $name exited with status " . ($rc >> 8) . "\n"
+            if $rc != 0 && $_ == 1;
+        $best = $elapsed if !defined $best || $elapsed < $best;
+    }
+
+    my $mb = (-s $r->{file}) / (1024 * 1024);
+    my $tuples = $r->{tuples};
+
+    printf "%-14s %10.1f %10.3f %10.1f %14.0f\n",
+        $name, $mb, $best, $mb / $best, $tuples / $best;
+}
+
+printf "\n%d heap tuples, %d nulls, %d inline compressed, %d external values\n",
+    $heap->{tuples}, $info{nulls}, $info{compressed}, $info{external};
+
+remove_tree($dir) unless $keep;
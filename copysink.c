@@ -0,0 +1,302 @@
+/*
+ * Streaming of decoded rows into a database for pg_filedump
+ *
+ * With --copy-target, the rows decoded with -D are not printed as COPY:
+ * lines but sent to a table of a running server with COPY FROM STDIN,
+ * which spares writing them to a file, stripping the prefix and loading
+ * them with psql.  Rows are collected into batches that a sender thread
+ * takes from a bounded queue and passes to libpq, so that decoding and
+ * sending run concurrently.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "libpq-fe.h"
+
+/* Size at which a batch of rows is queued for sending */
+#define COPY_BATCH_SIZE		(1024 * 1024)
+
+/* Smallest batch size under a tight --max-memory */
+#define COPY_BATCH_MIN_SIZE	(8 * 1024)
+
+/* Batches queued before decoding waits for the sender */
+#define COPY_QUEUE_LENGTH	8
+
+typedef struct CopyBatch
+{
+	char	   *data;
+	size_t		len;
+	uint64		rows;
+} CopyBatch;
+
+/* --copy-target: connection string of the server rows are copied into */
+char	   *copyConninfo = NULL;
+
+/* --copy-table: table, optionally with a column list, to copy into */
+char	   *copyTable = NULL;
+
+static PGconn *copyConn = NULL;
+
+/* Size of the batches, set by CopySinkStart() */
+static size_t copyBatchSize = COPY_BATCH_SIZE;
+
+/* Batch being filled by the main thread */
+static CopyBatch *currentBatch = NULL;
+
+/* Queue of batches waiting for the sender thread */
+static CopyBatch *queue[COPY_QUEUE_LENGTH];
+static int	queueHead = 0;
+static int	queueLength = 0;
+static bool queueDone = false;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queueNotFull = PTHREAD_COND_INITIALIZER;
+
+static pthread_t senderThread;
+
+/* Set by the sender thread, read after it is joined */
+static uint64 rowsSent = 0;
+static char *sendError = NULL;
+
+/* Batches are tracked, and freed by the sender thread */
+static CopyBatch *
+CopyBatchCreate(void)
+{
+	CopyBatch  *batch = TrackedAlloc(sizeof(CopyBatch));
+
+	if (batch == NULL || (batch->data = TrackedAlloc(copyBatchSize)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	batch->len = 0;
+	batch->rows = 0;
+	return batch;
+}
+
+static void
+CopyBatchFree(CopyBatch *batch)
+{
+	TrackedFree(batch->data);
+	TrackedFree(batch);
+}
+
+/* Queue a batch for the sender thread, waiting while the queue is full */
+static void
+CopyQueuePut(CopyBatch *batch)
+{
+	pthread_mutex_lock(&queueLock);
+	while (queueLength == COPY_QUEUE_LENGTH)
+		pthread_cond_wait(&queueNotFull, &queueLock);
+	queue[(queueHead + queueLength) % COPY_QUEUE_LENGTH] = batch;
+	queueLength++;
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueLock);
+}
+
+/* Take the next batch, or NULL once the queue is done and empty */
+static CopyBatch *
+CopyQueueTake(void)
+{
+	CopyBatch  *batch = NULL;
+
+	pthread_mutex_lock(&queueLock);
+	while (queueLength == 0 && !queueDone)
+		pthread_cond_wait(&queueNotEmpty, &queueLock);
+	if (queueLength > 0)
+	{
+		batch = queue[queueHead];
+		queueHead = (queueHead + 1) % COPY_QUEUE_LENGTH;
+		queueLength--;
+		pthread_cond_signal(&queueNotFull);
+	}
+	pthread_mutex_unlock(&queueLock);
+
+	return batch;
+}
+
+/*
+ * Send the queued batches until the queue is done, then end the COPY.
+ * After an error the batches are still taken, so that decoding does not
+ * block, but dropped.
+ */
+static void *
+CopySenderMain(void *arg)
+{
+	CopyBatch  *batch;
+	PGresult   *res;
+
+	while ((batch = CopyQueueTake()) != NULL)
+	{
+		if (sendError == NULL)
+		{
+			if (PQputCopyData(copyConn, batch->data, batch->len) == 1)
+				rowsSent += batch->rows;
+			else
+				sendError = strdup(PQerrorMessage(copyConn));
+		}
+		CopyBatchFree(batch);
+	}
+
+	if (PQputCopyEnd(copyConn, sendError ? "pg_filedump failed" : NULL) != 1 &&
+		sendError == NULL)
+		sendError = strdup(PQerrorMessage(copyConn));
+
+	while ((res = PQgetResult(copyConn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK && sendError == NULL)
+			sendError = strdup(PQresultErrorMessage(res));
+		PQclear(res);
+	}
+
+	return NULL;
+}
+
+/*
+ * Connect to the --copy-target server and start copying into --copy-table.
+ * Returns 0 on success, or -1 after printing an error.
+ */
+int
+CopySinkStart(void)
+{
+	char	   *query;
+	PGresult   *res;
+
+	copyConn = PQconnectdb(copyConninfo);
+	if (PQstatus(copyConn) != CONNECTION_OK)
+	{
+		printf("Error: Unable to connect to the copy target: %s",
+			   PQerrorMessage(copyConn));
+		PQfinish(copyConn);
+		copyConn = NULL;
+		return -1;
+	}
+
+	query = malloc(strlen(copyTable) + sizeof("COPY  FROM STDIN"));
+	if (query == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	sprintf(query, "COPY %s FROM STDIN", copyTable);
+	res = PQexec(copyConn, query);
+	free(query);
+
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+	{
+		printf("Error: Unable to start copying into <%s>: %s", copyTable,
+			   PQresultErrorMessage(res));
+		PQclear(res);
+		PQfinish(copyConn);
+		copyConn = NULL;
+		return -1;
+	}
+	PQclear(res);
+
+	if (pthread_create(&senderThread, NULL, CopySenderMain, NULL) != 0)
+	{
+		printf("Error: Unable to start the copy sender thread.\n");
+		PQfinish(copyConn);
+		copyConn = NULL;
+		return -1;
+	}
+
+	/*
+	 * The batches being filled, queued and sent take a share of the memory
+	 * budget
+	 */
+	copyBatchSize = MemoryBudgetShare(COPY_BATCH_SIZE * (COPY_QUEUE_LENGTH + 2)) /
+		(COPY_QUEUE_LENGTH + 2);
+	copyBatchSize = Max(copyBatchSize, COPY_BATCH_MIN_SIZE);
+
+	currentBatch = CopyBatchCreate();
+	return 0;
+}
+
+/*
+ * Add a decoded row in COPY text format to the rows being sent.  A row
+ * larger than a batch is sent on its own, and as the rows before it were
+ * already sent, not fitting into the memory budget is fatal.
+ */
+void
+CopySinkRow(const char *row, int len)
+{
+	if (currentBatch->len > 0 &&
+		currentBatch->len + len + 1 > copyBatchSize)
+	{
+		CopyQueuePut(currentBatch);
+		currentBatch = CopyBatchCreate();
+	}
+
+	if (len + 1 > copyBatchSize)
+	{
+		Size		growth = len + 1 - copyBatchSize;
+		char	   *data;
+
+		ToastCacheRelease(growth);
+		if (!MemoryBudgetAllows(growth))
+		{
+			printf("Error: Row of %d bytes for --copy-target exceeds memory "
+				   "budget of %zu bytes.\n", len, maxMemory);
+			exit(1);
+		}
+
+		if ((data = TrackedRealloc(currentBatch->data, len + 1)) == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+		currentBatch->data = data;
+	}
+
+	memcpy(currentBatch->data + currentBatch->len, row, len);
+	currentBatch->len += len;
+	currentBatch->data[currentBatch->len++] = '\n';
+	currentBatch->rows++;
+}
+
+/*
+ * Send the remaining rows, end the COPY and report the number of rows
+ * copied.  Returns 0 on success, or 1 if the rows could not be copied.
+ */
+int
+CopySinkFinish(void)
+{
+	int			rc = 0;
+
+	if (copyConn == NULL)
+		return 0;
+
+	if (currentBatch->len > 0)
+		CopyQueuePut(currentBatch);
+	else
+		CopyBatchFree(currentBatch);
+	currentBatch = NULL;
+
+	pthread_mutex_lock(&queueLock);
+	queueDone = true;
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueLock);
+	pthread_join(senderThread, NULL);
+
+	if (sendError != NULL)
+	{
+		printf("\nError: Unable to copy rows into <%s>: %s", copyTable,
+			   sendError);
+		free(sendError);
+		sendError = NULL;
+		rc = 1;
+	}
+	else
+		printf("\n*** Copied " UINT64_FORMAT " rows into %s ***\n", rowsSent,
+			   copyTable);
+
+	PQfinish(copyConn);
+	copyConn = NULL;
+
+	return rc;
+}
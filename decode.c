@@ -19,10 +19,17 @@
 #endif
 #include <datatype/timestamp.h>
 #include <common/pg_lzcompress.h>
+#if PG_VERSION_NUM >= 120000
+#include <common/shortest_dec.h>
+#endif
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <assert.h>
+#include <sys/socket.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define ATTRTYPES_STR_MAX_LEN (1024-1)
 
@@ -90,12 +97,18 @@ decode_timestamp(const char *buffer, unsigned int buff_size, unsigned int *out_s
 static int
 decode_timestamptz(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
+static int
+decode_interval(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
 static int
 decode_float4(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
 static int
 decode_float8(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
+static int
+decode_money(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
 static int
 decode_bool(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
@@ -117,126 +130,216 @@ decode_name(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 static int
 decode_numeric(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
+static int
+decode_bytea(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_inet(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_cidr(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_bit(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_jsonb(const char *buffer, unsigned int buff_size, unsigned int *out_size);
+
 static int
 extract_data(const char *buffer, unsigned int buff_size, unsigned int *out_size, int (*parse_value)(const char *, int));
 
 static int
 decode_ignore(const char *buffer, unsigned int buff_size, unsigned int *out_size);
 
-static int	ncallbacks = 0;
-static decode_callback_t callbacks[ATTRTYPES_STR_MAX_LEN / 2] =
+typedef enum
 {
-	NULL
-};
+	DECODE_TYPE,				/* decoded by the callback */
+	DECODE_ARRAY,				/* type[], elements decoded by element */
+	DECODE_RECORD,				/* record(...), a nested tuple of fields */
+	DECODE_SKIP,				/* skip:typlen:align, not printed */
+	DECODE_RAW					/* raw:typlen:align or type:raw, stored bytes */
+} DecodeKind;
+
+/*
+ * Decoder of a single attribute.  Attributes of types unknown to us are
+ * described by their typlen and alignment instead of a callback.
+ */
+typedef struct AttributeDecoder
+{
+	DecodeKind	kind;
+	decode_callback_t callback;
+	struct AttributeDecoder *element;	/* element of an array */
+	struct AttributeDecoder *fields;	/* fields of a record */
+	int			nfields;
+	int			typlen;			/* > 0 fixed, -1 varlena, -2 cstring */
+	int			alignment;		/* in bytes */
+	bool		base64;			/* raw bytes in base64 instead of hex */
+	bool		stored;			/* raw bytes as stored, not decompressed */
+}			AttributeDecoder;
+
+static int
+DecodeAttribute(const AttributeDecoder *decoder, const char *buffer,
+				unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_array(const AttributeDecoder *element, const char *buffer,
+			 unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_record(const AttributeDecoder *decoder, const char *buffer,
+			  unsigned int buff_size, unsigned int *out_size);
+
+static int
+decode_generic(const AttributeDecoder *decoder, const char *buffer,
+			   unsigned int buff_size, unsigned int *out_size);
+
+static int	ncallbacks = 0;
+static AttributeDecoder callbacks[ATTRTYPES_STR_MAX_LEN / 2];
+
+/* Decoders put aside by SwapAttributeTypes() */
+static int	otherNcallbacks = 0;
+static AttributeDecoder otherCallbacks[lengthof(callbacks)];
 
 typedef struct
 {
 	char	   *name;
 	decode_callback_t callback;
+	int			typlen;			/* as in pg_type, for the raw modifier */
+	char		typalign;
 }			ParseCallbackTableItem;
 
 static ParseCallbackTableItem callback_table[] =
 {
 	{
-		"smallserial", &decode_smallint
+		"smallserial", &decode_smallint, 2, 's'
+	},
+	{
+		"smallint", &decode_smallint, 2, 's'
+	},
+	{
+		"int", &decode_int, 4, 'i'
+	},
+	{
+		"oid", &decode_uint, 4, 'i'
+	},
+	{
+		"xid", &decode_uint, 4, 'i'
+	},
+	{
+		"enum", &decode_uint, 4, 'i'
+	},
+	{
+		"serial", &decode_int, 4, 'i'
+	},
+	{
+		"bigint", &decode_bigint, 8, 'd'
+	},
+	{
+		"bigserial", &decode_bigint, 8, 'd'
+	},
+	{
+		"time", &decode_time, 8, 'd'
 	},
 	{
-		"smallint", &decode_smallint
+		"timetz", &decode_timetz, 12, 'd'
 	},
 	{
-		"int", &decode_int
+		"date", &decode_date, 4, 'i'
 	},
 	{
-		"oid", &decode_uint
+		"timestamp", &decode_timestamp, 8, 'd'
 	},
 	{
-		"xid", &decode_uint
+		"timestamptz", &decode_timestamptz, 8, 'd'
 	},
 	{
-		"serial", &decode_int
+		"interval", &decode_interval, 16, 'd'
 	},
 	{
-		"bigint", &decode_bigint
+		"real", &decode_float4, 4, 'i'
 	},
 	{
-		"bigserial", &decode_bigint
+		"float4", &decode_float4, 4, 'i'
 	},
 	{
-		"time", &decode_time
+		"float8", &decode_float8, 8, 'd'
 	},
 	{
-		"timetz", &decode_timetz
+		"float", &decode_float8, 8, 'd'
 	},
 	{
-		"date", &decode_date
+		"money", &decode_money, 8, 'd'
 	},
 	{
-		"timestamp", &decode_timestamp
+		"bool", &decode_bool, 1, 'c'
 	},
 	{
-		"timestamptz", &decode_timestamptz
+		"uuid", &decode_uuid, 16, 'c'
 	},
 	{
-		"real", &decode_float4
+		"macaddr", &decode_macaddr, 6, 'i'
 	},
 	{
-		"float4", &decode_float4
+		"name", &decode_name, NAMEDATALEN, 'c'
 	},
 	{
-		"float8", &decode_float8
+		"numeric", &decode_numeric, -1, 'i'
 	},
 	{
-		"float", &decode_float8
+		"char", &decode_char, 1, 'c'
 	},
 	{
-		"bool", &decode_bool
+		"bytea", &decode_bytea, -1, 'i'
 	},
 	{
-		"uuid", &decode_uuid
+		"jsonb", &decode_jsonb, -1, 'i'
 	},
 	{
-		"macaddr", &decode_macaddr
+		"inet", &decode_inet, -1, 'i'
 	},
 	{
-		"name", &decode_name
+		"cidr", &decode_cidr, -1, 'i'
 	},
 	{
-		"numeric", &decode_numeric
+		"bit", &decode_bit, -1, 'i'
 	},
 	{
-		"char", &decode_char
+		"varbit", &decode_bit, -1, 'i'
 	},
 	{
-		"~", &decode_ignore
+		"~", &decode_ignore, 0, 0
 	},
 
 	/* internally all string types are stored the same way */
 	{
-		"charn", &decode_string
+		"charn", &decode_string, -1, 'i'
 	},
 	{
-		"varchar", &decode_string
+		"varchar", &decode_string, -1, 'i'
 	},
 	{
-		"varcharn", &decode_string
+		"varcharn", &decode_string, -1, 'i'
 	},
 	{
-		"text", &decode_string
+		"text", &decode_string, -1, 'i'
 	},
 	{
-		"json", &decode_string
+		"json", &decode_string, -1, 'i'
 	},
 	{
-		"xml", &decode_string
+		"xml", &decode_string, -1, 'i'
 	},
 	{
-		NULL, NULL
+		NULL, NULL, 0, 0
 	},
 };
 
 static StringInfoData copyString;
 static bool copyStringInitDone = false;
 
+/* Set while CollectToastPointers() walks a tuple, gets the pointers found */
+static void (*toastCollect) (const varatt_external *pointer) = NULL;
+
 /* Used by some PostgreSQL macro definitions */
 #if PG_VERSION_NUM < 160000
 void
@@ -286,6 +389,274 @@ CopyAppend(const char *str)
 	appendStringInfoString(&copyString, str);
 }
 
+/* Start a new value in the current COPY line */
+static void
+CopyAppendSeparator(void)
+{
+	/* Make sure init is done */
+	CopyAppend(NULL);
+
+	if (copyString.data[0] != '\0')
+		appendStringInfoCharMacro(&copyString, '\t');
+}
+
+/* CopyAppend version for strings of known length */
+static void
+CopyAppendLen(const char *str, int len)
+{
+	CopyAppendSeparator();
+	appendBinaryStringInfo(&copyString, str, len);
+}
+
+/*
+ * Start appending a value of at most maxlen bytes to the current COPY line.
+ * Returns the position to write the value to; CopyAppendEnd() must be
+ * called with the end of the written value.
+ */
+static char *
+CopyAppendBegin(int maxlen)
+{
+	CopyAppendSeparator();
+	enlargeStringInfo(&copyString, maxlen);
+	return copyString.data + copyString.len;
+}
+
+/* Finish a value started with CopyAppendBegin() */
+static void
+CopyAppendEnd(char *end)
+{
+	copyString.len = end - copyString.data;
+	*end = '\0';
+}
+
+/*
+ * Compute how many bytes the current COPY line grows by to take len more
+ * bytes, as enlargeStringInfo() would enlarge it.  Returns false if the
+ * line cannot hold them at all.
+ */
+static bool
+CopyLineGrowth(Size len, Size *growth)
+{
+	Size		needed;
+	Size		newlen;
+
+	CopyAppend(NULL);
+
+	if (len >= MaxAllocSize - (Size) copyString.len)
+		return false;
+
+	needed = (Size) copyString.len + len + 1;
+	if (needed <= (Size) copyString.maxlen)
+	{
+		*growth = 0;
+		return true;
+	}
+
+	for (newlen = 2 * (Size) copyString.maxlen; newlen < needed; newlen *= 2)
+		;
+	if (newlen > MaxAllocSize)
+		newlen = MaxAllocSize;
+
+	*growth = newlen - copyString.maxlen;
+	return true;
+}
+
+/*
+ * Memory taken by reading a TOAST value, not counting the growth of the
+ * COPY line: the buffer it is read into, the one it is decompressed into
+ * and its COPY text, escaped or in hex, which takes up to twice its size.
+ * The TOAST prefetch reserves as much for each value it reads ahead.
+ */
+Size
+ToastValueMemory(const varatt_external *pointer)
+{
+	Size		needed = pointer->va_rawsize;
+
+	if (VARATT_EXTERNAL_IS_COMPRESSED(*pointer))
+		needed += pointer->va_rawsize;
+
+	return needed + 2 * (Size) pointer->va_rawsize + 1;
+}
+
+/*
+ * Check that a TOAST value and its COPY text fit into the memory budget,
+ * evicting cached values to make room, and enlarge the COPY line for the
+ * text.  in_memory tells that the value was already read.  Otherwise the
+ * value is skipped with a warning and false is returned.
+ */
+static bool
+ToastValueFits(const varatt_external *pointer, bool in_memory)
+{
+	Size		copy_needed = 2 * (Size) pointer->va_rawsize + 1;
+	Size		copy_growth = 0;
+	bool		copy_fits = CopyLineGrowth(copy_needed, &copy_growth);
+	Size		needed;
+
+	needed = in_memory ? copy_needed : ToastValueMemory(pointer);
+	needed += copy_growth;
+
+	/* Cached values give way to the value being read */
+	ToastCacheRelease(needed);
+
+	if (!copy_fits || !MemoryBudgetAllows(needed))
+	{
+		printf("WARNING: TOAST value of %d bytes exceeds memory budget, "
+			   "skipped.\n", pointer->va_rawsize);
+		CopyAppend("(TOAST value exceeds memory budget)");
+		dumpStats.overBudget++;
+		return false;
+	}
+
+	/* Enlarge the line now, so that appending the value stays within */
+	enlargeStringInfo(&copyString, (int) copy_needed);
+	return true;
+}
+
+/* "00" to "99", used by the hand-rolled number formatters */
+static const char digitPairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Write value (0 to 99) as two digits and return the new end of string */
+static inline char *
+WriteDigits2(char *cp, int value)
+{
+	memcpy(cp, &digitPairs[value * 2], 2);
+	return cp + 2;
+}
+
+/* Write value (0 to 9999) as four digits */
+static inline char *
+WriteDigits4(char *cp, int value)
+{
+	cp = WriteDigits2(cp, value / 100);
+	return WriteDigits2(cp, value % 100);
+}
+
+/* Write value (0 to 999999) as six digits */
+static inline char *
+WriteDigits6(char *cp, int value)
+{
+	cp = WriteDigits2(cp, value / 10000);
+	return WriteDigits4(cp, value % 10000);
+}
+
+/* Write an unsigned 32-bit integer, two digits per step */
+static inline char *
+WriteUInt32(char *cp, uint32 value)
+{
+	char		buf[10];
+	char	   *end = buf + sizeof(buf);
+	char	   *p = end;
+
+	while (value >= 100)
+	{
+		uint32		q = value / 100;
+
+		p -= 2;
+		memcpy(p, &digitPairs[(value - q * 100) * 2], 2);
+		value = q;
+	}
+	if (value >= 10)
+	{
+		p -= 2;
+		memcpy(p, &digitPairs[value * 2], 2);
+	}
+	else
+		*--p = '0' + value;
+
+	memcpy(cp, p, end - p);
+	return cp + (end - p);
+}
+
+/* Write a signed 32-bit integer */
+static inline char *
+WriteInt32(char *cp, int32 value)
+{
+	uint32		uvalue = (uint32) value;
+
+	if (value < 0)
+	{
+		*cp++ = '-';
+		uvalue = 0 - uvalue;
+	}
+	return WriteUInt32(cp, uvalue);
+}
+
+/* Write an unsigned 64-bit integer, two digits per step */
+static inline char *
+WriteUInt64(char *cp, uint64 value)
+{
+	char		buf[20];
+	char	   *end = buf + sizeof(buf);
+	char	   *p = end;
+
+	/* Leave the leading digits to the cheaper 32-bit divisions */
+	while (value > PG_UINT32_MAX)
+	{
+		uint64		q = value / 100;
+
+		p -= 2;
+		memcpy(p, &digitPairs[(value - q * 100) * 2], 2);
+		value = q;
+	}
+
+	cp = WriteUInt32(cp, (uint32) value);
+	memcpy(cp, p, end - p);
+	return cp + (end - p);
+}
+
+/* Write a signed 64-bit integer */
+static inline char *
+WriteInt64(char *cp, int64 value)
+{
+	uint64		uvalue = (uint64) value;
+
+	if (value < 0)
+	{
+		*cp++ = '-';
+		uvalue = 0 - uvalue;
+	}
+	return WriteUInt64(cp, uvalue);
+}
+
+/*
+ * Write a time of day given in microseconds as HH:MM:SS.FFFFFF, time must be
+ * between zero and 100 hours
+ */
+static char *
+WriteTime(char *cp, int64 time)
+{
+	int			sec = (int) (time / USECS_PER_SEC);
+
+	cp = WriteDigits2(cp, sec / SECS_PER_HOUR);
+	*cp++ = ':';
+	cp = WriteDigits2(cp, (sec / SECS_PER_MINUTE) % MINS_PER_HOUR);
+	*cp++ = ':';
+	cp = WriteDigits2(cp, sec % SECS_PER_MINUTE);
+	*cp++ = '.';
+	return WriteDigits6(cp, (int) (time % USECS_PER_SEC));
+}
+
+/* Write a date as YYYY-MM-DD, year must be between 1 and 9999 */
+static char *
+WriteDate(char *cp, int year, int month, int day)
+{
+	cp = WriteDigits4(cp, year);
+	*cp++ = '-';
+	cp = WriteDigits2(cp, month);
+	*cp++ = '-';
+	return WriteDigits2(cp, day);
+}
+
 /*
  * Append given string to current COPY line and encode special symbols
  * like \r, \n, \t and \\.
@@ -295,7 +666,7 @@ CopyAppendEncode(const char *str, int orig_len)
 {
 	int			curr_offset = 0;
 	int			len = orig_len;
-	char	   *tmp_buff = malloc(2 * orig_len + 1);
+	char	   *tmp_buff = TrackedAlloc(2 * orig_len + 1);
 
 	if (tmp_buff == NULL)
 	{
@@ -330,7 +701,7 @@ CopyAppendEncode(const char *str, int orig_len)
 		else if (*str == '\t')
 		{
 			tmp_buff[curr_offset] = '\\';
-			tmp_buff[curr_offset + 1] = 'r';
+			tmp_buff[curr_offset + 1] = 't';
 			curr_offset += 2;
 		}
 		else if (*str == '\\')
@@ -352,7 +723,7 @@ CopyAppendEncode(const char *str, int orig_len)
 
 	tmp_buff[curr_offset] = '\0';
 	CopyAppend(tmp_buff);
-	free(tmp_buff);
+	TrackedFree(tmp_buff);
 
 	return 0;
 }
@@ -365,156 +736,212 @@ CopyAppendEncode(const char *str, int orig_len)
   } while(0)
 
 /*
- * Decode a numeric type and append the result to current COPY line
+ * Four decimal digits of every NBASE digit, filled in on first use of
+ * CopyAppendNumeric
  */
-static int
-CopyAppendNumeric(const char *buffer, int num_size)
+static char nbaseDigits[NBASE * DEC_DIGITS];
+static bool nbaseDigitsDone = false;
+
+static void
+InitNBaseDigits(void)
+{
+	int			i;
+
+	for (i = 0; i < NBASE; i++)
+	{
+		WriteDigits2(&nbaseDigits[i * DEC_DIGITS], i / 100);
+		WriteDigits2(&nbaseDigits[i * DEC_DIGITS + 2], i % 100);
+	}
+	nbaseDigitsDone = true;
+}
+
+/*
+ * Write a corrupted NBASE digit (negative or >= NBASE) the way the generic
+ * division code always did, optionally suppressing leading zeroes
+ */
+static char *
+WriteBadNumericDigit(char *cp, NumericDigit dig, bool suppress)
+{
+	NumericDigit d1;
+	bool		putit = !suppress;
+
+	d1 = dig / 1000;
+	dig -= d1 * 1000;
+	putit |= (d1 > 0);
+	if (putit)
+		*cp++ = d1 + '0';
+	d1 = dig / 100;
+	dig -= d1 * 100;
+	putit |= (d1 > 0);
+	if (putit)
+		*cp++ = d1 + '0';
+	d1 = dig / 10;
+	dig -= d1 * 10;
+	putit |= (d1 > 0);
+	if (putit)
+		*cp++ = d1 + '0';
+	*cp++ = dig + '0';
+
+	return cp;
+}
+
+/* Write all four decimal digits of an NBASE digit */
+static inline char *
+WriteNumericDigit(char *cp, NumericDigit dig)
+{
+	if (dig < 0 || dig >= NBASE)
+		return WriteBadNumericDigit(cp, dig, false);
+
+	memcpy(cp, &nbaseDigits[dig * DEC_DIGITS], DEC_DIGITS);
+	return cp + DEC_DIGITS;
+}
+
+/* Write an NBASE digit without leading zeroes */
+static inline char *
+WriteFirstNumericDigit(char *cp, NumericDigit dig)
+{
+	int			skip;
+
+	if (dig < 0 || dig >= NBASE)
+		return WriteBadNumericDigit(cp, dig, true);
+
+	skip = (dig >= 1000) ? 0 : (dig >= 100) ? 1 : (dig >= 10) ? 2 : 3;
+	memcpy(cp, &nbaseDigits[dig * DEC_DIGITS + skip], DEC_DIGITS - skip);
+	return cp + DEC_DIGITS - skip;
+}
+
+/*
+ * Fetch NBASE digit d of a numeric, digits beyond the stored ones are zero.
+ * The datum may be unaligned, hence the memcpy.
+ */
+static inline NumericDigit
+GetNumericDigit(const char *digits, int ndigits, int d)
 {
-	struct NumericData *num = (struct NumericData *) malloc(num_size);
+	NumericDigit dig;
+
+	if (d < 0 || d >= ndigits)
+		return 0;
+
+	memcpy(&dig, digits + d * sizeof(NumericDigit), sizeof(NumericDigit));
+	return dig;
+}
 
-	if (num == NULL)
+/*
+ * Append the text of a numeric datum (without varlena header) to the value
+ * being built in the COPY line.
+ *
+ * The header is copied out of the (possibly unaligned) datum and the digits
+ * are written straight into the COPY line buffer.
+ */
+static int
+AppendNumericText(const char *buffer, int num_size)
+{
+	union NumericChoice header;
+	struct NumericData *num = (struct NumericData *) &header;
+	int			header_size;
+	int			sign;
+	int			weight;
+	int			dscale;
+	int			ndigits;
+	int			i;
+	int			d;
+	const char *digits;
+	char	   *cp;
+	char	   *endcp;
+
+	if (num_size < (int) sizeof(uint16))
 		return -2;
 
-	memcpy((char *) num, buffer, num_size);
+	memset(&header, 0, sizeof(header));
+	memcpy(&header, buffer, Min(num_size, (int) sizeof(header)));
 
 	if (NUMERIC_IS_SPECIAL(num))
 	{
-		int	result = -2;
-
 		if (NUMERIC_IS_NINF(num))
-		{
-			CopyAppend("-Infinity");
-			result = 0;
-		}
-		if (NUMERIC_IS_PINF(num))
-		{
-			CopyAppend("Infinity");
-			result = 0;
-		}
-		if (NUMERIC_IS_NAN(num))
-		{
-			CopyAppend("NaN");
-			result = 0;
-		}
+			appendStringInfoString(&copyString, "-Infinity");
+		else if (NUMERIC_IS_PINF(num))
+			appendStringInfoString(&copyString, "Infinity");
+		else if (NUMERIC_IS_NAN(num))
+			appendStringInfoString(&copyString, "NaN");
+		else
+			return -2;
+
+		return 0;
+	}
 
-		free(num);
+	header_size = NUMERIC_HEADER_SIZE(num);
+	if (num_size < header_size)
+		return -2;
 
-		return result;
+	if (num_size == header_size)
+	{
+		/* No digits - compressed zero. */
+		appendBinaryStringInfo(&copyString, "0", 1);
+		return 0;
+	}
+
+	if (!nbaseDigitsDone)
+		InitNBaseDigits();
+
+	sign = NUMERIC_SIGN(num);
+	weight = NUMERIC_WEIGHT(num);
+	dscale = NUMERIC_DSCALE(num);
+	digits = buffer + header_size;
+	ndigits = (num_size - header_size) / sizeof(NumericDigit);
+
+	i = (weight + 1) * DEC_DIGITS;
+	if (i <= 0)
+		i = 1;
+
+	enlargeStringInfo(&copyString, i + dscale + DEC_DIGITS + 2);
+	cp = copyString.data + copyString.len;
+
+	/*
+	 * Output a dash for negative values
+	 */
+	if (sign == NUMERIC_NEG)
+		*cp++ = '-';
+
+	/*
+	 * Output all digits before the decimal point, suppressing extra leading
+	 * decimal zeroes in the first digit
+	 */
+	if (weight < 0)
+	{
+		d = weight + 1;
+		*cp++ = '0';
 	}
 	else
 	{
-		int			sign;
-		int			weight;
-		int			dscale;
-		int			ndigits;
-		int			i;
-		char	   *str;
-		char	   *cp;
-		char	   *endcp;
-		int			d;
-		bool		putit;
-		NumericDigit d1;
-		NumericDigit dig;
-		NumericDigit *digits;
-
-		sign = NUMERIC_SIGN(num);
-		weight = NUMERIC_WEIGHT(num);
-		dscale = NUMERIC_DSCALE(num);
-
-		if (num_size == NUMERIC_HEADER_SIZE(num))
-		{
-			/* No digits - compressed zero. */
-			CopyAppendFmt("%d", 0);
-			free(num);
-			return 0;
-		}
-		else
-		{
-			ndigits = num_size / sizeof(NumericDigit);
-			digits = (NumericDigit *) ((char *) num + NUMERIC_HEADER_SIZE(num));
-			i = (weight + 1) * DEC_DIGITS;
-			if (i <= 0)
-				i = 1;
-
-			str = palloc(i + dscale + DEC_DIGITS + 2);
-			cp = str;
-
-			/*
-			 * Output a dash for negative values
-			 */
-			if (sign == NUMERIC_NEG)
-				*cp++ = '-';
-
-			/*
-			 * Output all digits before the decimal point
-			 */
-			if (weight < 0)
-			{
-				d = weight + 1;
-				*cp++ = '0';
-			}
-			else
-			{
-				for (d = 0; d <= weight; d++)
-				{
-					dig = (d < ndigits) ? digits[d] : 0;
-
-					/*
-					 * In the first digit, suppress extra leading decimal
-					 * zeroes
-					 */
-					putit = (d > 0);
-					d1 = dig / 1000;
-					dig -= d1 * 1000;
-					putit |= (d1 > 0);
-					if (putit)
-						*cp++ = d1 + '0';
-					d1 = dig / 100;
-					dig -= d1 * 100;
-					putit |= (d1 > 0);
-					if (putit)
-						*cp++ = d1 + '0';
-					d1 = dig / 10;
-					dig -= d1 * 10;
-					putit |= (d1 > 0);
-					if (putit)
-						*cp++ = d1 + '0';
-					*cp++ = dig + '0';
-				}
-			}
+		cp = WriteFirstNumericDigit(cp, GetNumericDigit(digits, ndigits, 0));
+		for (d = 1; d <= weight; d++)
+			cp = WriteNumericDigit(cp, GetNumericDigit(digits, ndigits, d));
+	}
 
-			/*
-			 * If requested, output a decimal point and all the digits that
-			 * follow it. We initially put out a multiple of DEC_DIGITS
-			 * digits, then truncate if needed.
-			 */
-			if (dscale > 0)
-			{
-				*cp++ = '.';
-				endcp = cp + dscale;
-				for (i = 0; i < dscale; d++, i += DEC_DIGITS)
-				{
-					dig = (d >= 0 && d < ndigits) ? digits[d] : 0;
-					d1 = dig / 1000;
-					dig -= d1 * 1000;
-					*cp++ = d1 + '0';
-					d1 = dig / 100;
-					dig -= d1 * 100;
-					*cp++ = d1 + '0';
-					d1 = dig / 10;
-					dig -= d1 * 10;
-					*cp++ = d1 + '0';
-					*cp++ = dig + '0';
-				}
-				cp = endcp;
-			}
-			*cp = '\0';
-			CopyAppend(str);
-			pfree(str);
-			free(num);
-			return 0;
-		}
+	/*
+	 * If requested, output a decimal point and all the digits that follow
+	 * it. We initially put out a multiple of DEC_DIGITS digits, then
+	 * truncate if needed.
+	 */
+	if (dscale > 0)
+	{
+		*cp++ = '.';
+		endcp = cp + dscale;
+		for (i = 0; i < dscale; d++, i += DEC_DIGITS)
+			cp = WriteNumericDigit(cp, GetNumericDigit(digits, ndigits, d));
+		cp = endcp;
 	}
+
+	CopyAppendEnd(cp);
+	return 0;
+}
+
+/* Decode a numeric type and append the result to current COPY line */
+static int
+CopyAppendNumeric(const char *buffer, int num_size)
+{
+	CopyAppendSeparator();
+	return AppendNumericText(buffer, num_size);
 }
 
 /* Discard accumulated COPY line */
@@ -527,6 +954,16 @@ CopyClear(void)
 	resetStringInfo(&copyString);
 }
 
+/* Output a decoded row, to the --copy-target or as a COPY: line */
+void
+CopyOutputRow(const char *row, int len)
+{
+	if (copyConninfo != NULL)
+		CopySinkRow(row, len);
+	else
+		printf("COPY: %.*s\n", len, row);
+}
+
 /* Output and then clear accumulated COPY line */
 static void
 CopyFlush(void)
@@ -534,34 +971,259 @@ CopyFlush(void)
 	/* Make sure init is done */
 	CopyAppend(NULL);
 
-	printf("COPY: %s\n", copyString.data);
+	CopyOutputRow(copyString.data, copyString.len);
 	CopyClear();
 }
 
+/* Convert a pg_type.typalign character to bytes, 0 if it is invalid */
+static int
+AlignmentFromTypalign(char typalign)
+{
+	switch (typalign)
+	{
+		case 'c':
+			return 1;
+		case 's':
+			return ALIGNOF_SHORT;
+		case 'i':
+			return ALIGNOF_INT;
+		case 'd':
+			return ALIGNOF_DOUBLE;
+	}
+	return 0;
+}
+
 /*
- * Add a callback to `callbacks` table for given type name
- *
- * Arguments:
- *   type	   - name of a single type, always lowercase
+ * Parse the colon separated options of a raw attribute: "hex" (default) or
+ * "base64" selects the encoding, "stored" prints the value as it is stored
+ * in the tuple, i.e. with its varlena header and before decompression or
+ * TOAST lookup.
  *
  * Return value is:
  *   == 0	   - no error
- *	< 0	   - invalid type name
+ *	< 0	   - invalid option
  */
 static int
-AddTypeCallback(const char *type)
+ParseRawOptions(char *options, AttributeDecoder *decoder)
 {
-	int			idx = 0;
+	char	   *option = options;
 
-	if (*type == '\0')			/* ignore empty strings */
-		return 0;
+	decoder->base64 = false;
+	decoder->stored = false;
 
-	while (callback_table[idx].name != NULL)
+	while (option != NULL && *option != '\0')
 	{
-		if (strcmp(callback_table[idx].name, type) == 0)
+		char	   *next = strchr(option, ':');
+
+		if (next != NULL)
+			*next++ = '\0';
+
+		if (strcmp(option, "hex") == 0)
+			decoder->base64 = false;
+		else if (strcmp(option, "base64") == 0)
+			decoder->base64 = true;
+		else if (strcmp(option, "stored") == 0)
+			decoder->stored = true;
+		else
+		{
+			printf("Error: invalid raw option <%s>, expected hex, base64 or stored\n",
+				   option);
+			return -1;
+		}
+
+		option = next;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse a generic descriptor "skip:<typlen>:<align>" or
+ * "raw:<typlen>:<align>[:<option>...]" for a type we cannot decode.  typlen
+ * is the pg_type.typlen of the type (-1 for varlena, -2 for cstring) and
+ * align its typalign: c, s, i or d.
+ *
+ * Return value is:
+ *   == 0	   - no error
+ *	< 0	   - invalid descriptor
+ */
+static int
+ParseGenericDescriptor(char *type, AttributeDecoder *decoder)
+{
+	char	   *str = strchr(type, ':') + 1;
+	char	   *end;
+	long		typlen = strtol(str, &end, 10);
+	int			alignment = 0;
+	bool		skip = (strncmp(type, "skip:", 5) == 0);
+
+	if (end != str && *end == ':' && end[1] != '\0' &&
+		(end[2] == '\0' || (end[2] == ':' && !skip)))
+		alignment = AlignmentFromTypalign(end[1]);
+
+	if (alignment == 0 || typlen == 0 || typlen < -2 || typlen > BLCKSZ)
+	{
+		printf("Error: invalid type descriptor <%s>, expected skip:<typlen>:<align> "
+			   "or raw:<typlen>:<align>\n", type);
+		printf("typlen is the length of a fixed-width type, -1 for varlena or -2 "
+			   "for cstring types, align is one of c, s, i or d\n");
+		return -1;
+	}
+
+	decoder->kind = skip ? DECODE_SKIP : DECODE_RAW;
+	decoder->callback = NULL;
+	decoder->typlen = (int) typlen;
+	decoder->alignment = alignment;
+	return ParseRawOptions(end[2] == ':' ? end + 3 : end + 2, decoder);
+}
+
+/*
+ * Parse "<type>:raw[:<option>...]", which prints the stored bytes of an
+ * attribute of a known type instead of decoding it
+ *
+ * Return value is:
+ *   == 0	   - no error
+ *	< 0	   - invalid type or modifier
+ */
+static int
+ParseRawModifier(const char *type, char *modifier, AttributeDecoder *decoder)
+{
+	int			idx;
+
+	if (strncmp(modifier, "raw", 3) != 0 ||
+		(modifier[3] != '\0' && modifier[3] != ':'))
+	{
+		printf("Error: invalid modifier <%s> of type <%s>, expected raw\n",
+			   modifier, type);
+		return -1;
+	}
+
+	for (idx = 0; callback_table[idx].name != NULL; idx++)
+	{
+		if (strcmp(callback_table[idx].name, type) == 0)
+			break;
+	}
+
+	if (callback_table[idx].name == NULL || callback_table[idx].typlen == 0)
+	{
+		printf("Error: raw modifier is not supported for type <%s>, use "
+			   "raw:<typlen>:<align> instead\n", type);
+		return -1;
+	}
+
+	decoder->kind = DECODE_RAW;
+	decoder->callback = NULL;
+	decoder->typlen = callback_table[idx].typlen;
+	decoder->alignment = AlignmentFromTypalign(callback_table[idx].typalign);
+	return ParseRawOptions(modifier[3] == ':' ? modifier + 4 : modifier + 3,
+						   decoder);
+}
+
+static int	ParseTypeList(char *list, AttributeDecoder *decoders, int maxdecoders);
+
+/*
+ * Parse the field list of record(...) into decoder
+ *
+ * Return value is:
+ *   == 0	   - no error
+ *	< 0	   - invalid field list
+ */
+static int
+ParseRecord(char *fields, AttributeDecoder *decoder)
+{
+	int			maxfields = 1;
+	int			depth = 0;
+	char	   *p;
+
+	/* Upper bound of the number of fields: top level commas plus one */
+	for (p = fields; *p; p++)
+	{
+		if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		else if (*p == ',' && depth == 0)
+			maxfields++;
+	}
+
+	decoder->kind = DECODE_RECORD;
+	decoder->fields = calloc(maxfields, sizeof(AttributeDecoder));
+	if (decoder->fields == NULL)
+	{
+		perror("calloc");
+		exit(1);
+	}
+
+	decoder->nfields = ParseTypeList(fields, decoder->fields, maxfields);
+	return decoder->nfields < 0 ? -1 : 0;
+}
+
+/*
+ * Set up decoder for given type name
+ *
+ * Arguments:
+ *   type	   - name of a single type, always lowercase; a "[]" suffix
+ *				 denotes an array of that type, record(type,...) a
+ *				 composite type with the given fields, a ":raw"
+ *				 suffix the stored bytes of the type
+ *   decoder	   - decoder to fill in
+ *
+ * Return value is:
+ *   == 0	   - no error
+ *	< 0	   - invalid type name
+ */
+static int
+ParseType(char *type, AttributeDecoder *decoder)
+{
+	int			idx = 0;
+	int			len = strlen(type);
+	char	   *modifier;
+
+	if (strncmp(type, "skip:", 5) == 0 || strncmp(type, "raw:", 4) == 0)
+		return ParseGenericDescriptor(type, decoder);
+
+	/* Colons inside record(...) belong to its fields */
+	modifier = strchr(type, ':');
+	if (modifier != NULL && memchr(type, '(', modifier - type) == NULL)
+	{
+		*modifier = '\0';
+		return ParseRawModifier(type, modifier + 1, decoder);
+	}
+
+	/* As in PostgreSQL, "int[][]" is the same type as "int[]" */
+	if (len > 2 && strcmp(type + len - 2, "[]") == 0)
+	{
+		while (len > 2 && strncmp(type + len - 2, "[]", 2) == 0)
+			len -= 2;
+		type[len] = '\0';
+
+		if (strcmp(type, "~") == 0)
+		{
+			printf("Error: arrays of <~> are not supported\n");
+			return -1;
+		}
+
+		decoder->kind = DECODE_ARRAY;
+		decoder->element = calloc(1, sizeof(AttributeDecoder));
+		if (decoder->element == NULL)
+		{
+			perror("calloc");
+			exit(1);
+		}
+		return ParseType(type, decoder->element);
+	}
+
+	if (strncmp(type, "record(", 7) == 0 && type[len - 1] == ')')
+	{
+		type[len - 1] = '\0';
+		return ParseRecord(type + 7, decoder);
+	}
+
+	while (callback_table[idx].name != NULL)
+	{
+		if (strcmp(callback_table[idx].name, type) == 0)
 		{
-			callbacks[ncallbacks] = callback_table[idx].callback;
-			ncallbacks++;
+			decoder->kind = DECODE_TYPE;
+			decoder->callback = callback_table[idx].callback;
 			return 0;
 		}
 		idx++;
@@ -576,9 +1238,75 @@ AddTypeCallback(const char *type)
 		idx++;
 	}
 	printf("\n");
+	printf("Arrays of any of them except ~ are written as type[], composite types "
+		   "as record(type,...), stored bytes as type:raw, other types can be "
+		   "given as skip:<typlen>:<align> or raw:<typlen>:<align>\n");
 	return -1;
 }
 
+/*
+ * Parse a comma separated list of types into decoders.  Commas inside the
+ * parentheses of record(...) do not separate types, empty entries are
+ * ignored.
+ *
+ * Return value is the number of decoders filled in, or -1 if the list is
+ * invalid.
+ */
+static int
+ParseTypeList(char *list, AttributeDecoder *decoders, int maxdecoders)
+{
+	int			ndecoders = 0;
+	char	   *curr_type = list;
+
+	while (curr_type)
+	{
+		char	   *next_type = NULL;
+		int			depth = 0;
+		char	   *p;
+
+		for (p = curr_type; *p; p++)
+		{
+			if (*p == '(')
+				depth++;
+			else if (*p == ')' && --depth < 0)
+				break;
+			else if (*p == ',' && depth == 0)
+			{
+				next_type = p;
+				break;
+			}
+		}
+
+		if (depth != 0)
+		{
+			printf("Error: unbalanced parentheses in types <%s>\n", curr_type);
+			return -1;
+		}
+
+		if (next_type)
+		{
+			*next_type = '\0';
+			next_type++;
+		}
+
+		if (*curr_type != '\0')	/* ignore empty strings */
+		{
+			if (ndecoders >= maxdecoders)
+			{
+				printf("Error: too many types given\n");
+				return -1;
+			}
+			if (ParseType(curr_type, &decoders[ndecoders]) < 0)
+				return -1;
+			ndecoders++;
+		}
+
+		curr_type = next_type;
+	}
+
+	return ndecoders;
+}
+
 /*
  * Decode attribute types string like "int,timestamp,bool,uuid"
  *
@@ -591,8 +1319,6 @@ AddTypeCallback(const char *type)
 int
 ParseAttributeTypesString(const char *str)
 {
-	char	   *curr_type,
-			   *next_type;
 	char		attrtypes[ATTRTYPES_STR_MAX_LEN + 1];
 	int			i,
 				len = strlen(str);
@@ -608,23 +1334,68 @@ ParseAttributeTypesString(const char *str)
 	for (i = 0; i < len; i++)
 		attrtypes[i] = tolower(attrtypes[i]);
 
-	curr_type = attrtypes;
-	while (curr_type)
+	ncallbacks = ParseTypeList(attrtypes, callbacks, lengthof(callbacks));
+	if (ncallbacks < 0)
 	{
-		next_type = strstr(curr_type, ",");
-		if (next_type)
-		{
-			*next_type = '\0';
-			next_type++;
-		}
+		ncallbacks = 0;
+		return -1;
+	}
 
-		if (AddTypeCallback(curr_type) < 0)
-			return -1;
+	return 0;
+}
 
-		curr_type = next_type;
+/* Number of columns of the COPY rows FormatDecode() outputs */
+int
+DecodedColumnCount(void)
+{
+	int			count = 0;
+	int			i;
+
+	for (i = 0; i < ncallbacks; i++)
+	{
+		if (callbacks[i].kind == DECODE_SKIP)
+			continue;
+		if (callbacks[i].kind == DECODE_TYPE &&
+			callbacks[i].callback == &decode_ignore)
+			break;
+		count++;
 	}
 
-	return 0;
+	return count;
+}
+
+/* Whether the attribute types end with ~, leaving the rest undecoded */
+bool
+AttributeTypesIgnoreRest(void)
+{
+	int			i;
+
+	for (i = 0; i < ncallbacks; i++)
+	{
+		if (callbacks[i].kind == DECODE_TYPE &&
+			callbacks[i].callback == &decode_ignore)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Exchange the decoders with a second set, so that the tuples of another
+ * relation can be decoded with their own attribute types.  The second set
+ * is empty until types are parsed after the first exchange.
+ */
+void
+SwapAttributeTypes(void)
+{
+	static AttributeDecoder swap[lengthof(callbacks)];
+	int			n = ncallbacks;
+
+	memcpy(swap, callbacks, sizeof(callbacks));
+	memcpy(callbacks, otherCallbacks, sizeof(callbacks));
+	memcpy(otherCallbacks, swap, sizeof(callbacks));
+	ncallbacks = otherNcallbacks;
+	otherNcallbacks = n;
 }
 
 /*
@@ -656,6 +1427,39 @@ j2date(int jd, int *year, int *month, int *day)
 	*month = (quad + 10) % MONTHS_PER_YEAR + 1;
 }
 
+/*
+ * j2date() with a single entry cache.  Date and timestamp columns are often
+ * sorted or clustered, so consecutive rows tend to fall on the same day.
+ */
+static void
+CachedJ2Date(int jd, int *year, int *month, int *day)
+{
+	static bool cacheValid = false;
+	static int	cachedJd,
+				cachedYear,
+				cachedMonth,
+				cachedDay;
+
+	if (!cacheValid || jd != cachedJd)
+	{
+		j2date(jd, &cachedYear, &cachedMonth, &cachedDay);
+		cachedJd = jd;
+		cacheValid = true;
+	}
+
+	*year = cachedYear;
+	*month = cachedMonth;
+	*day = cachedDay;
+}
+
+/* Check whether a date can be written by WriteDate() */
+static inline bool
+IsWritableDate(int year, int month, int day)
+{
+	return year >= 1 && year <= 9999 &&
+		month >= 1 && month <= 12 && day >= 1 && day <= 31;
+}
+
 /* Decode a smallint type */
 static int
 decode_smallint(const char *buffer, unsigned int buff_size, unsigned int *out_size)
@@ -672,7 +1476,7 @@ decode_smallint(const char *buffer, unsigned int buff_size, unsigned int *out_si
 	if (buff_size < sizeof(int16))
 		return -2;
 
-	CopyAppendFmt("%d", (int) (*(int16 *) buffer));
+	CopyAppendEnd(WriteInt32(CopyAppendBegin(6), *(int16 *) buffer));
 	*out_size = sizeof(int16) + delta;
 	return 0;
 }
@@ -694,7 +1498,7 @@ decode_int(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 	if (buff_size < sizeof(int32))
 		return -2;
 
-	CopyAppendFmt("%d", *(int32 *) buffer);
+	CopyAppendEnd(WriteInt32(CopyAppendBegin(11), *(int32 *) buffer));
 	*out_size = sizeof(int32) + delta;
 	return 0;
 }
@@ -715,7 +1519,7 @@ decode_uint(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 	if (buff_size < sizeof(uint32))
 		return -2;
 
-	CopyAppendFmt("%u", *(uint32 *) buffer);
+	CopyAppendEnd(WriteUInt32(CopyAppendBegin(10), *(uint32 *) buffer));
 	*out_size = sizeof(uint32) + delta;
 	return 0;
 }
@@ -736,7 +1540,7 @@ decode_bigint(const char *buffer, unsigned int buff_size, unsigned int *out_size
 	if (buff_size < sizeof(int64))
 		return -2;
 
-	CopyAppendFmt(INT64_FORMAT, *(int64 *) buffer);
+	CopyAppendEnd(WriteInt64(CopyAppendBegin(20), *(int64 *) buffer));
 	*out_size = sizeof(int64) + delta;
 	return 0;
 }
@@ -763,6 +1567,15 @@ decode_time(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 	timestamp_sec = timestamp / 1000000;
 	*out_size = sizeof(int64) + delta;
 
+	if (timestamp >= 0 && timestamp < 100 * USECS_PER_HOUR)
+	{
+		char		str[32];
+		char	   *cp = WriteTime(str, timestamp);
+
+		CopyAppendLen(str, cp - str);
+		return 0;
+	}
+
 	CopyAppendFmt("%02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d.%06" INT64_MODIFIER "d",
 				  timestamp_sec / 60 / 60, (timestamp_sec / 60) % 60, timestamp_sec % 60,
 				  timestamp % 1000000);
@@ -796,6 +1609,20 @@ decode_timetz(const char *buffer, unsigned int buff_size, unsigned int *out_size
 	tz_min = -(tz_sec / 60);
 	*out_size = sizeof(int64) + sizeof(int32) + delta;
 
+	if (timestamp >= 0 && timestamp < 100 * USECS_PER_HOUR &&
+		abs(tz_min / 60) < 100)
+	{
+		char		str[48];
+		char	   *cp = WriteTime(str, timestamp);
+
+		*cp++ = (tz_min > 0 ? '+' : '-');
+		cp = WriteDigits2(cp, abs(tz_min / 60));
+		*cp++ = ':';
+		cp = WriteDigits2(cp, abs(tz_min % 60));
+		CopyAppendLen(str, cp - str);
+		return 0;
+	}
+
 	CopyAppendFmt("%02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d.%06" INT64_MODIFIER "d%c%02d:%02d",
 				  timestamp_sec / 60 / 60, (timestamp_sec / 60) % 60, timestamp_sec % 60,
 				  timestamp % 1000000, (tz_min > 0 ? '+' : '-'), abs(tz_min / 60), abs(tz_min % 60));
@@ -839,7 +1666,21 @@ decode_date(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 	}
 
 	jd = d + POSTGRES_EPOCH_JDATE;
-	j2date(jd, &year, &month, &day);
+	CachedJ2Date(jd, &year, &month, &day);
+
+	if (IsWritableDate((year <= 0) ? -year + 1 : year, month, day))
+	{
+		char		str[32];
+		char	   *cp = WriteDate(str, (year <= 0) ? -year + 1 : year, month, day);
+
+		if (year <= 0)
+		{
+			memcpy(cp, " BC", 3);
+			cp += 3;
+		}
+		CopyAppendLen(str, cp - str);
+		return 0;
+	}
 
 	CopyAppendFmt("%04d-%02d-%02d%s", (year <= 0) ? -year + 1 : year, month, day, (year <= 0) ? " BC" : "");
 
@@ -895,9 +1736,30 @@ decode_timestamp_internal(const char *buffer, unsigned int buff_size, unsigned i
 	/* add offset to go from J2000 back to standard Julian date */
 	jd += POSTGRES_EPOCH_JDATE;
 
-	j2date(jd, &year, &month, &day);
+	CachedJ2Date(jd, &year, &month, &day);
 	timestamp_sec = timestamp / 1000000;
 
+	if (IsWritableDate((year <= 0) ? -year + 1 : year, month, day))
+	{
+		char		str[64];
+		char	   *cp = WriteDate(str, (year <= 0) ? -year + 1 : year, month, day);
+
+		*cp++ = ' ';
+		cp = WriteTime(cp, timestamp);
+		if (with_timezone)
+		{
+			memcpy(cp, "+00", 3);
+			cp += 3;
+		}
+		if (year <= 0)
+		{
+			memcpy(cp, " BC", 3);
+			cp += 3;
+		}
+		CopyAppendLen(str, cp - str);
+		return 0;
+	}
+
 	CopyAppendFmt("%04d-%02d-%02d %02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d:%02" INT64_MODIFIER "d.%06" INT64_MODIFIER "d%s%s",
 				  (year <= 0) ? -year + 1 : year, month, day,
 				  timestamp_sec / 60 / 60, (timestamp_sec / 60) % 60, timestamp_sec % 60,
@@ -920,12 +1782,52 @@ decode_timestamptz(const char *buffer, unsigned int buff_size, unsigned int *out
 	return decode_timestamp_internal(buffer, buff_size, out_size, true);
 }
 
-/* Decode a float4 type */
+/*
+ * Write a nonzero interval field like "-3 days" in the postgres
+ * IntervalStyle, see AddPostgresIntPart() in datetime.c.  A field gets an
+ * explicit plus sign if the field before it was negative.
+ */
+static char *
+WriteIntervalPart(char *cp, int64 value, const char *units,
+				  bool *is_zero, bool *is_before)
+{
+	int			len = strlen(units);
+
+	if (value == 0)
+		return cp;
+
+	if (!*is_zero)
+		*cp++ = ' ';
+	if (*is_before && value > 0)
+		*cp++ = '+';
+	cp = WriteInt64(cp, value);
+	*cp++ = ' ';
+	memcpy(cp, units, len);
+	cp += len;
+	if (value != 1)
+		*cp++ = 's';
+
+	*is_before = (value < 0);
+	*is_zero = false;
+	return cp;
+}
+
+/* Decode an interval type, output is in the postgres IntervalStyle */
 static int
-decode_float4(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+decode_interval(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 {
-	const char *new_buffer = (const char *) INTALIGN(buffer);
+	const char *new_buffer = (const char *) DOUBLEALIGN(buffer);
 	unsigned int delta = (unsigned int) ((uintptr_t) new_buffer - (uintptr_t) buffer);
+	int64		time;
+	int32		day,
+				month;
+	int64		hour;
+	int			min,
+				sec,
+				fsec;
+	bool		is_zero = true;
+	bool		is_before = false;
+	char	   *cp;
 
 	if (buff_size < delta)
 		return -1;
@@ -933,19 +1835,89 @@ decode_float4(const char *buffer, unsigned int buff_size, unsigned int *out_size
 	buff_size -= delta;
 	buffer = new_buffer;
 
-	if (buff_size < sizeof(float))
+	if (buff_size < sizeof(int64) + 2 * sizeof(int32))
 		return -2;
 
-	CopyAppendFmt("%.12f", *(float *) buffer);
-	*out_size = sizeof(float) + delta;
+	time = *(int64 *) buffer;
+	day = *(int32 *) (buffer + sizeof(int64));
+	month = *(int32 *) (buffer + sizeof(int64) + sizeof(int32));
+	*out_size = sizeof(int64) + 2 * sizeof(int32) + delta;
+
+	/* Infinite intervals exist since PostgreSQL 17 */
+	if (time == PG_INT64_MAX && day == PG_INT32_MAX && month == PG_INT32_MAX)
+	{
+		CopyAppend("infinity");
+		return 0;
+	}
+	if (time == PG_INT64_MIN && day == PG_INT32_MIN && month == PG_INT32_MIN)
+	{
+		CopyAppend("-infinity");
+		return 0;
+	}
+
+	cp = CopyAppendBegin(96);
+	cp = WriteIntervalPart(cp, month / MONTHS_PER_YEAR, "year", &is_zero, &is_before);
+	cp = WriteIntervalPart(cp, month % MONTHS_PER_YEAR, "mon", &is_zero, &is_before);
+	cp = WriteIntervalPart(cp, day, "day", &is_zero, &is_before);
+
+	hour = time / USECS_PER_HOUR;
+	time -= hour * USECS_PER_HOUR;
+	min = (int) (time / USECS_PER_MINUTE);
+	time -= min * USECS_PER_MINUTE;
+	sec = (int) (time / USECS_PER_SEC);
+	fsec = (int) (time - sec * USECS_PER_SEC);
+
+	if (is_zero || hour != 0 || min != 0 || sec != 0 || fsec != 0)
+	{
+		uint64		uhour = (hour < 0) ? -(uint64) hour : (uint64) hour;
+
+		if (!is_zero)
+			*cp++ = ' ';
+		if (hour < 0 || min < 0 || sec < 0 || fsec < 0)
+			*cp++ = '-';
+		else if (is_before)
+			*cp++ = '+';
+
+		if (uhour < 10)
+			*cp++ = '0';
+		cp = WriteUInt64(cp, uhour);
+		*cp++ = ':';
+		cp = WriteDigits2(cp, abs(min));
+		*cp++ = ':';
+		cp = WriteDigits2(cp, abs(sec));
+
+		/* Fractional seconds without trailing zeros */
+		if (fsec != 0)
+		{
+			int			value = abs(fsec);
+			int			ndigits = 6;
+			int			i;
+
+			while (value % 10 == 0)
+			{
+				value /= 10;
+				ndigits--;
+			}
+
+			*cp++ = '.';
+			for (i = ndigits - 1; i >= 0; i--)
+			{
+				cp[i] = '0' + value % 10;
+				value /= 10;
+			}
+			cp += ndigits;
+		}
+	}
+
+	CopyAppendEnd(cp);
 	return 0;
 }
 
-/* Decode a float8 type */
+/* Decode a float4 type */
 static int
-decode_float8(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+decode_float4(const char *buffer, unsigned int buff_size, unsigned int *out_size)
 {
-	const char *new_buffer = (const char *) DOUBLEALIGN(buffer);
+	const char *new_buffer = (const char *) INTALIGN(buffer);
 	unsigned int delta = (unsigned int) ((uintptr_t) new_buffer - (uintptr_t) buffer);
 
 	if (buff_size < delta)
@@ -954,13 +1926,106 @@ decode_float8(const char *buffer, unsigned int buff_size, unsigned int *out_size
 	buff_size -= delta;
 	buffer = new_buffer;
 
-	if (buff_size < sizeof(double))
+	if (buff_size < sizeof(float))
 		return -2;
 
-	CopyAppendFmt("%.12lf", *(double *) buffer);
-	*out_size = sizeof(double) + delta;
-	return 0;
-}
+#if PG_VERSION_NUM >= 120000
+	/* Shortest exact representation, same as float4out() */
+	{
+		char	   *cp = CopyAppendBegin(FLOAT_SHORTEST_DECIMAL_LEN);
+
+		CopyAppendEnd(cp + float_to_shortest_decimal_bufn(*(float *) buffer, cp));
+	}
+#else
+	CopyAppendFmt("%.12f", *(float *) buffer);
+#endif
+	*out_size = sizeof(float) + delta;
+	return 0;
+}
+
+/* Decode a float8 type */
+static int
+decode_float8(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	const char *new_buffer = (const char *) DOUBLEALIGN(buffer);
+	unsigned int delta = (unsigned int) ((uintptr_t) new_buffer - (uintptr_t) buffer);
+
+	if (buff_size < delta)
+		return -1;
+
+	buff_size -= delta;
+	buffer = new_buffer;
+
+	if (buff_size < sizeof(double))
+		return -2;
+
+#if PG_VERSION_NUM >= 120000
+	/* Shortest exact representation, same as float8out() */
+	{
+		char	   *cp = CopyAppendBegin(DOUBLE_SHORTEST_DECIMAL_LEN);
+
+		CopyAppendEnd(cp + double_to_shortest_decimal_bufn(*(double *) buffer, cp));
+	}
+#else
+	CopyAppendFmt("%.12lf", *(double *) buffer);
+#endif
+	*out_size = sizeof(double) + delta;
+	return 0;
+}
+
+/*
+ * Decode a money type.  The amount is printed the way cash_out() prints it
+ * with lc_monetary set to C: with a "$" sign, "," as thousands separator
+ * and two fractional digits.
+ */
+static int
+decode_money(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	const char *new_buffer = (const char *) DOUBLEALIGN(buffer);
+	unsigned int delta = (unsigned int) ((uintptr_t) new_buffer - (uintptr_t) buffer);
+	int64		value;
+	uint64		uvalue;
+	char		digits[32];
+	char	   *end = digits + sizeof(digits);
+	char	   *p = end;
+	int			digit_pos = 2;
+	char	   *cp;
+
+	if (buff_size < delta)
+		return -1;
+
+	buff_size -= delta;
+	buffer = new_buffer;
+
+	if (buff_size < sizeof(int64))
+		return -2;
+
+	value = *(int64 *) buffer;
+	uvalue = (value < 0) ? -(uint64) value : (uint64) value;
+
+	/* Digits are built right to left, digit_pos is 0 left of the point */
+	do
+	{
+		if (digit_pos == 0)
+			*--p = '.';
+		else if (digit_pos < 0 && digit_pos % 3 == 0)
+			*--p = ',';
+
+		*--p = '0' + uvalue % 10;
+		uvalue /= 10;
+		digit_pos--;
+	} while (uvalue != 0 || digit_pos >= 0);
+
+	cp = CopyAppendBegin(2 + (end - p));
+	if (value < 0)
+		*cp++ = '-';
+	*cp++ = '$';
+	memcpy(cp, p, end - p);
+	CopyAppendEnd(cp + (end - p));
+
+	*out_size = sizeof(int64) + delta;
+	return 0;
+}
 
 /* Decode an uuid type */
 static int
@@ -1039,6 +2104,1313 @@ decode_numeric(const char *buffer, unsigned int buff_size, unsigned int *out_siz
        return result;
 }
 
+/*
+ * Write len bytes from src as lowercase hex digits to dst, which must have
+ * room for 2 * len characters
+ */
+static void
+WriteHex(char *dst, const unsigned char *src, int len)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+
+#ifdef __SSE2__
+	/* 16 bytes at a time: split into nibbles, map to ASCII, interleave */
+	const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i letterOffset = _mm_set1_epi8('a' - '0' - 10);
+
+	while (len >= 16)
+	{
+		__m128i		in = _mm_loadu_si128((const __m128i *) src);
+		__m128i		hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibbleMask);
+		__m128i		lo = _mm_and_si128(in, nibbleMask);
+
+		hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+						  _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letterOffset));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+						  _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letterOffset));
+
+		_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi8(hi, lo));
+
+		src += 16;
+		dst += 32;
+		len -= 16;
+	}
+#endif
+
+	while (len-- > 0)
+	{
+		*dst++ = hexDigits[*src >> 4];
+		*dst++ = hexDigits[*src & 0x0f];
+		src++;
+	}
+}
+
+/*
+ * Append a bytea value to current COPY line in hex format.  The backslash
+ * of the \x prefix is doubled as required by COPY.
+ */
+static int
+CopyAppendBytea(const char *str, int orig_len)
+{
+	char	   *cp = CopyAppendBegin(2 * orig_len + 3);
+
+	memcpy(cp, "\\\\x", 3);
+	WriteHex(cp + 3, (const unsigned char *) str, orig_len);
+	CopyAppendEnd(cp + 3 + 2 * orig_len);
+
+	return 0;
+}
+
+/*
+ * Append a value to current COPY line in base64, without the line breaks
+ * encode() inserts
+ */
+static int
+CopyAppendBase64(const char *str, int orig_len)
+{
+	static const char base64[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const unsigned char *src = (const unsigned char *) str;
+	const unsigned char *end = src + orig_len;
+	char	   *cp = CopyAppendBegin((orig_len + 2) / 3 * 4);
+
+	for (; end - src >= 3; src += 3)
+	{
+		uint32		bits = (src[0] << 16) | (src[1] << 8) | src[2];
+
+		*cp++ = base64[bits >> 18];
+		*cp++ = base64[(bits >> 12) & 0x3F];
+		*cp++ = base64[(bits >> 6) & 0x3F];
+		*cp++ = base64[bits & 0x3F];
+	}
+
+	if (src < end)
+	{
+		uint32		bits = src[0] << 16;
+
+		if (end - src == 2)
+			bits |= src[1] << 8;
+		*cp++ = base64[bits >> 18];
+		*cp++ = base64[(bits >> 12) & 0x3F];
+		*cp++ = (end - src == 2) ? base64[(bits >> 6) & 0x3F] : '=';
+		*cp++ = '=';
+	}
+
+	CopyAppendEnd(cp);
+	return 0;
+}
+
+/* Decode a bytea type */
+static int
+decode_bytea(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	return extract_data(buffer, buff_size, out_size, &CopyAppendBytea);
+}
+
+/* Write the lowercase hex digits of value without leading zeros */
+static char *
+WriteHexWord(char *cp, unsigned int value)
+{
+	static const char hex[] = "0123456789abcdef";
+	int			shift = 12;
+
+	while (shift > 0 && (value >> shift) == 0)
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		*cp++ = hex[(value >> shift) & 0xF];
+
+	return cp;
+}
+
+/* Write an IPv4 address in dotted decimal form */
+static char *
+WriteIPv4(char *cp, const unsigned char *addr)
+{
+	int			i;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (i > 0)
+			*cp++ = '.';
+		cp = WriteUInt32(cp, addr[i]);
+	}
+
+	return cp;
+}
+
+/*
+ * Write an IPv6 address, replacing the longest run of two or more zero
+ * words by "::" and writing embedded IPv4 addresses in dotted form, like
+ * inet_net_ntop_ipv6() in PostgreSQL does
+ */
+static char *
+WriteIPv6(char *cp, const unsigned char *addr)
+{
+	unsigned int words[8];
+	int			best_base = -1,
+				best_len = 0,
+				cur_base = -1,
+				cur_len = 0;
+	int			i;
+
+	for (i = 0; i < 8; i++)
+	{
+		words[i] = (addr[2 * i] << 8) | addr[2 * i + 1];
+
+		if (words[i] == 0)
+		{
+			if (cur_base == -1)
+			{
+				cur_base = i;
+				cur_len = 0;
+			}
+			cur_len++;
+		}
+		else
+			cur_base = -1;
+
+		if (cur_base != -1 && cur_len > best_len)
+		{
+			best_base = cur_base;
+			best_len = cur_len;
+		}
+	}
+	if (best_len < 2)
+		best_base = -1;
+
+	for (i = 0; i < 8; i++)
+	{
+		/* Inside the longest run of zeros */
+		if (best_base != -1 && i >= best_base && i < best_base + best_len)
+		{
+			if (i == best_base)
+				*cp++ = ':';
+			continue;
+		}
+
+		if (i != 0)
+			*cp++ = ':';
+
+		/* Encapsulated IPv4 address */
+		if (i == 6 && best_base == 0 &&
+			(best_len == 6 || (best_len == 5 && words[5] == 0xffff)))
+			return WriteIPv4(cp, addr + 12);
+
+		cp = WriteHexWord(cp, words[i]);
+	}
+
+	/* Trailing run of zeros */
+	if (best_base != -1 && best_base + best_len == 8)
+		*cp++ = ':';
+
+	return cp;
+}
+
+/*
+ * Append an inet or cidr datum (without varlena header) to current COPY
+ * line.  The netmask length is omitted for inet host addresses, cidr
+ * values always carry it.
+ */
+static int
+AppendInet(const char *str, int orig_len, bool is_cidr)
+{
+	const unsigned char *ip = (const unsigned char *) str;
+	int			family;
+	int			bits;
+	int			maxbits;
+	char	   *cp;
+
+	if (orig_len < 2)
+		return -1;
+
+	family = ip[0];
+	bits = ip[1];
+
+	if (family == PGSQL_AF_INET)
+		maxbits = 32;
+	else if (family == PGSQL_AF_INET6)
+		maxbits = 128;
+	else
+		return -2;
+
+	if (orig_len != 2 + maxbits / 8 || bits > maxbits)
+		return -3;
+
+	cp = CopyAppendBegin(64);
+	if (family == PGSQL_AF_INET)
+		cp = WriteIPv4(cp, ip + 2);
+	else
+		cp = WriteIPv6(cp, ip + 2);
+
+	if (bits != maxbits || is_cidr)
+	{
+		*cp++ = '/';
+		cp = WriteUInt32(cp, bits);
+	}
+	CopyAppendEnd(cp);
+
+	return 0;
+}
+
+static int
+CopyAppendInet(const char *str, int orig_len)
+{
+	return AppendInet(str, orig_len, false);
+}
+
+static int
+CopyAppendCidr(const char *str, int orig_len)
+{
+	return AppendInet(str, orig_len, true);
+}
+
+/* Decode an inet type */
+static int
+decode_inet(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	return extract_data(buffer, buff_size, out_size, &CopyAppendInet);
+}
+
+/* Decode a cidr type */
+static int
+decode_cidr(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	return extract_data(buffer, buff_size, out_size, &CopyAppendCidr);
+}
+
+/*
+ * Append a bit or varbit datum (without varlena header) to current COPY
+ * line as a string of 0s and 1s.  The datum starts with the number of bits,
+ * followed by the bits themselves, most significant first.
+ */
+static int
+CopyAppendBit(const char *str, int orig_len)
+{
+	const unsigned char *bits = (const unsigned char *) str + sizeof(int32);
+	int32		bitlen;
+	char	   *cp;
+	int32		i;
+
+	if (orig_len < (int) sizeof(int32))
+		return -1;
+
+	memcpy(&bitlen, str, sizeof(int32));
+	if (bitlen < 0 || ((int64) bitlen + 7) / 8 > orig_len - (int) sizeof(int32))
+		return -2;
+
+	cp = CopyAppendBegin(bitlen);
+	for (i = 0; i < bitlen; i++)
+		cp[i] = (bits[i / 8] & (0x80 >> (i % 8))) ? '1' : '0';
+	CopyAppendEnd(cp + bitlen);
+
+	return 0;
+}
+
+/* Decode a bit or varbit type */
+static int
+decode_bit(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	return extract_data(buffer, buff_size, out_size, &CopyAppendBit);
+}
+
+/* Nesting limit for jsonb containers, protects the stack from corrupted data */
+#define JSONB_MAX_DEPTH 10000
+
+static int	AppendJsonbContainer(const char *base, uint32 size, int depth);
+
+/*
+ * Append a jsonb string as a quoted JSON string, escaped like escape_json()
+ * does and then once more for COPY, which doubles every backslash.
+ */
+static void
+AppendJsonbString(const char *str, uint32 len)
+{
+	const char *end = str + len;
+
+	appendStringInfoCharMacro(&copyString, '"');
+
+	while (str < end)
+	{
+		const char *run = str;
+		unsigned char c;
+
+		/* Copy runs of characters needing no escaping in one go */
+		while (str < end && (unsigned char) *str >= ' ' &&
+			   *str != '"' && *str != '\\')
+			str++;
+		if (str > run)
+			appendBinaryStringInfo(&copyString, run, str - run);
+		if (str == end)
+			break;
+
+		c = (unsigned char) *str++;
+		switch (c)
+		{
+			case '\b':
+				appendStringInfoString(&copyString, "\\\\b");
+				break;
+			case '\f':
+				appendStringInfoString(&copyString, "\\\\f");
+				break;
+			case '\n':
+				appendStringInfoString(&copyString, "\\\\n");
+				break;
+			case '\r':
+				appendStringInfoString(&copyString, "\\\\r");
+				break;
+			case '\t':
+				appendStringInfoString(&copyString, "\\\\t");
+				break;
+			case '"':
+				appendStringInfoString(&copyString, "\\\\\"");
+				break;
+			case '\\':
+				appendStringInfoString(&copyString, "\\\\\\\\");
+				break;
+			default:
+				{
+					char		hex[8];
+
+					memcpy(hex, "\\\\u00", 5);
+					WriteHex(hex + 5, &c, 1);
+					appendBinaryStringInfo(&copyString, hex, 7);
+				}
+				break;
+		}
+	}
+
+	appendStringInfoCharMacro(&copyString, '"');
+}
+
+/*
+ * Append a single jsonb value stored at offset of the children data, len
+ * bytes long.  Numerics and containers are int-aligned relative to the start
+ * of the data.
+ */
+static int
+AppendJsonbValue(JEntry entry, const char *data, uint32 datasize,
+				 uint32 offset, uint32 len, int depth)
+{
+	uint32		padding;
+
+	if (offset > datasize || len > datasize - offset)
+		return -2;
+
+	switch (entry & JENTRY_TYPEMASK)
+	{
+		case JENTRY_ISSTRING:
+			AppendJsonbString(data + offset, len);
+			return 0;
+
+		case JENTRY_ISNUMERIC:
+			{
+				const char *numeric;
+
+				padding = INTALIGN(offset) - offset;
+				if (len <= padding)
+					return -2;
+
+				/* Numerics are stored as plain, uncompressed varlenas */
+				numeric = data + offset + padding;
+				if (VARATT_IS_1B_E(numeric) ||
+					(!VARATT_IS_1B(numeric) &&
+					 (len - padding < VARHDRSZ || VARATT_IS_4B_C(numeric))) ||
+					VARSIZE_ANY(numeric) > len - padding)
+					return -2;
+
+				return AppendNumericText(VARDATA_ANY(numeric),
+										 VARSIZE_ANY_EXHDR(numeric));
+			}
+
+		case JENTRY_ISBOOL_FALSE:
+			appendBinaryStringInfo(&copyString, "false", 5);
+			return 0;
+
+		case JENTRY_ISBOOL_TRUE:
+			appendBinaryStringInfo(&copyString, "true", 4);
+			return 0;
+
+		case JENTRY_ISNULL:
+			appendBinaryStringInfo(&copyString, "null", 4);
+			return 0;
+
+		case JENTRY_ISCONTAINER:
+			padding = INTALIGN(offset) - offset;
+			if (len < padding)
+				return -2;
+			return AppendJsonbContainer(data + offset + padding, len - padding,
+										depth + 1);
+
+		default:
+			return -2;
+	}
+}
+
+/* Read JEntry number index, the array may be unaligned */
+static inline JEntry
+GetJEntry(const char *children, uint32 index)
+{
+	JEntry		entry;
+
+	memcpy(&entry, children + index * sizeof(JEntry), sizeof(JEntry));
+	return entry;
+}
+
+/*
+ * Length of a child starting at offset.  Every JB_OFFSET_STRIDE'th entry
+ * stores the end offset instead of the length.
+ */
+static inline int64
+GetJEntryLength(JEntry entry, uint32 offset)
+{
+	if (JBE_HAS_OFF(entry))
+		return (int64) JBE_OFFLENFLD(entry) - offset;
+
+	return JBE_OFFLENFLD(entry);
+}
+
+/*
+ * Append a jsonb container in the format of JsonbToCString(): elements
+ * separated by ", " and keys by ": ".  The text is written as the container
+ * is walked, so memory use depends on the nesting depth only.
+ */
+static int
+AppendJsonbContainer(const char *base, uint32 size, int depth)
+{
+	uint32		header;
+	uint32		count;
+	uint32		nentries;
+	uint32		i;
+	uint32		keyOffset = 0;
+	uint32		valueOffset = 0;
+	uint32		datasize;
+	const char *children;
+	const char *data;
+	int			result;
+
+	if (depth > JSONB_MAX_DEPTH)
+		return -3;
+
+	if (size < sizeof(uint32))
+		return -2;
+
+	memcpy(&header, base, sizeof(uint32));
+	count = header & JB_CMASK;
+	nentries = (header & JB_FOBJECT) ? count * 2 : count;
+
+	if ((size - sizeof(uint32)) / sizeof(JEntry) < nentries)
+		return -2;
+
+	children = base + sizeof(uint32);
+	data = children + nentries * sizeof(JEntry);
+	datasize = size - sizeof(uint32) - nentries * sizeof(JEntry);
+
+	/* A raw scalar is stored as a one-element array */
+	if (header & JB_FSCALAR)
+	{
+		JEntry		entry;
+		int64		len;
+
+		/* Only then is there an entry to read */
+		if (!(header & JB_FARRAY) || count != 1)
+			return -2;
+
+		entry = GetJEntry(children, 0);
+		len = GetJEntryLength(entry, 0);
+		if (len < 0)
+			return -2;
+
+		return AppendJsonbValue(entry, data, datasize, 0, len, depth);
+	}
+
+	if (header & JB_FARRAY)
+	{
+		appendStringInfoCharMacro(&copyString, '[');
+
+		for (i = 0; i < count; i++)
+		{
+			JEntry		entry = GetJEntry(children, i);
+			int64		len = GetJEntryLength(entry, valueOffset);
+
+			if (len < 0)
+				return -2;
+			if (i > 0)
+				appendBinaryStringInfo(&copyString, ", ", 2);
+
+			result = AppendJsonbValue(entry, data, datasize, valueOffset, len, depth);
+			if (result < 0)
+				return result;
+			valueOffset += len;
+		}
+
+		appendStringInfoCharMacro(&copyString, ']');
+		return 0;
+	}
+
+	if (!(header & JB_FOBJECT))
+		return -2;
+
+	/* All keys are stored first, followed by the values in the same order */
+	for (i = 0; i < count; i++)
+	{
+		int64		len = GetJEntryLength(GetJEntry(children, i), valueOffset);
+
+		if (len < 0)
+			return -2;
+		valueOffset += len;
+	}
+
+	appendStringInfoCharMacro(&copyString, '{');
+
+	for (i = 0; i < count; i++)
+	{
+		JEntry		key = GetJEntry(children, i);
+		JEntry		value = GetJEntry(children, count + i);
+		int64		keyLen = GetJEntryLength(key, keyOffset);
+		int64		valueLen = GetJEntryLength(value, valueOffset);
+
+		if (keyLen < 0 || valueLen < 0 ||
+			(key & JENTRY_TYPEMASK) != JENTRY_ISSTRING)
+			return -2;
+		if (i > 0)
+			appendBinaryStringInfo(&copyString, ", ", 2);
+
+		result = AppendJsonbValue(key, data, datasize, keyOffset, keyLen, depth);
+		if (result < 0)
+			return result;
+		appendBinaryStringInfo(&copyString, ": ", 2);
+		result = AppendJsonbValue(value, data, datasize, valueOffset, valueLen, depth);
+		if (result < 0)
+			return result;
+
+		keyOffset += keyLen;
+		valueOffset += valueLen;
+	}
+
+	appendStringInfoCharMacro(&copyString, '}');
+	return 0;
+}
+
+/* Append a jsonb datum (without varlena header) to current COPY line */
+static int
+CopyAppendJsonb(const char *str, int orig_len)
+{
+	CopyAppendSeparator();
+	return AppendJsonbContainer(str, orig_len, 0);
+}
+
+/* Decode a jsonb type */
+static int
+decode_jsonb(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	return extract_data(buffer, buff_size, out_size, &CopyAppendJsonb);
+}
+
+/*
+ * Array elements of these types are fixed-width, never need quoting and are
+ * laid out back to back, so arrays of them without nulls are written by a
+ * tight loop instead of calling the element decoder for every element.
+ */
+typedef char *(*array_write_t) (char *cp, const char *value);
+
+typedef struct
+{
+	decode_callback_t callback; /* decoder of the element type */
+	int			typlen;			/* element width, a multiple of its alignment */
+	int			maxlen;			/* longest text representation */
+	array_write_t write;
+}			ArrayFastPath;
+
+static char *
+WriteArrayInt16(char *cp, const char *value)
+{
+	return WriteInt32(cp, *(const int16 *) value);
+}
+
+static char *
+WriteArrayInt32(char *cp, const char *value)
+{
+	return WriteInt32(cp, *(const int32 *) value);
+}
+
+static char *
+WriteArrayUInt32(char *cp, const char *value)
+{
+	return WriteUInt32(cp, *(const uint32 *) value);
+}
+
+static char *
+WriteArrayInt64(char *cp, const char *value)
+{
+	return WriteInt64(cp, *(const int64 *) value);
+}
+
+#if PG_VERSION_NUM >= 120000
+static char *
+WriteArrayFloat4(char *cp, const char *value)
+{
+	return cp + float_to_shortest_decimal_bufn(*(const float *) value, cp);
+}
+
+static char *
+WriteArrayFloat8(char *cp, const char *value)
+{
+	return cp + double_to_shortest_decimal_bufn(*(const double *) value, cp);
+}
+#endif
+
+static const ArrayFastPath arrayFastPaths[] =
+{
+	{&decode_smallint, sizeof(int16), 6, &WriteArrayInt16},
+	{&decode_int, sizeof(int32), 11, &WriteArrayInt32},
+	{&decode_uint, sizeof(uint32), 10, &WriteArrayUInt32},
+	{&decode_bigint, sizeof(int64), 20, &WriteArrayInt64},
+#if PG_VERSION_NUM >= 120000
+	{&decode_float4, sizeof(float), FLOAT_SHORTEST_DECIMAL_LEN, &WriteArrayFloat4},
+	{&decode_float8, sizeof(double), DOUBLE_SHORTEST_DECIMAL_LEN, &WriteArrayFloat8},
+#endif
+	{NULL, 0, 0, NULL}
+};
+
+/* Number of elements the tight loop writes between checks for space */
+#define ARRAY_BATCH_SIZE 256
+
+/* Element decoder of the array being decoded by CopyAppendArray() */
+static const AttributeDecoder *arrayElement = NULL;
+
+/* Field decoders of the record being decoded by CopyAppendRecord() */
+static const AttributeDecoder *recordDecoder = NULL;
+
+/*
+ * Array elements and record fields are decoded into a line of their own
+ * before they are quoted into the enclosing value, one line per level of
+ * nesting.
+ */
+static StringInfoData nestedStrings[ATTRTYPES_STR_MAX_LEN / 2];
+static int	nestedDepth = 0;
+
+/*
+ * Decode a value nested in an array or a record into an empty line, which
+ * is returned in result
+ */
+static int
+DecodeNested(const AttributeDecoder *decoder, const char *data, int datasize,
+			 unsigned int *processed, StringInfo *result)
+{
+	StringInfoData line = copyString;
+	StringInfo	nested;
+	int			ret;
+
+	if (nestedDepth >= lengthof(nestedStrings))
+		return -7;
+
+	nested = &nestedStrings[nestedDepth];
+	if (nested->data == NULL)
+		initStringInfo(nested);
+
+	copyString = *nested;
+	resetStringInfo(&copyString);
+	nestedDepth++;
+	ret = DecodeAttribute(decoder, data, datasize, processed);
+	nestedDepth--;
+	*nested = copyString;
+	copyString = line;
+
+	*result = nested;
+	return ret;
+}
+
+/*
+ * Append a value, already escaped for COPY, to current COPY line in double
+ * quotes, with quotes replaced by quote_escape and backslashes doubled.  In
+ * the escaped text every backslash starts a two character sequence, of
+ * which only "\\" stands for a backslash of the value itself.
+ */
+static void
+AppendQuoted(const char *str, int len, const char *quote_escape)
+{
+	int			escape_len = strlen(quote_escape);
+	int			i;
+
+	appendStringInfoCharMacro(&copyString, '"');
+	for (i = 0; i < len; i++)
+	{
+		if (str[i] == '"')
+			appendBinaryStringInfo(&copyString, quote_escape, escape_len);
+		else if (str[i] == '\\' && i + 1 < len)
+		{
+			if (str[i + 1] == '\\')
+				appendBinaryStringInfo(&copyString, "\\\\\\\\", 4);
+			else
+				appendBinaryStringInfo(&copyString, str + i, 2);
+			i++;
+		}
+		else
+			appendStringInfoCharMacro(&copyString, str[i]);
+	}
+	appendStringInfoCharMacro(&copyString, '"');
+}
+
+/*
+ * Append an array element, already escaped for COPY, to current COPY line
+ * and quote it like array_out() does: elements that are empty, spell NULL
+ * or contain white space, braces, commas, quotes or backslashes are put in
+ * double quotes, with quotes and backslashes escaped by a backslash.
+ */
+static void
+AppendArrayElement(const char *str, int len)
+{
+	bool		quote = (len == 0 || pg_strcasecmp(str, "NULL") == 0);
+	int			i;
+
+	for (i = 0; i < len && !quote; i++)
+	{
+		switch (str[i])
+		{
+			case '"':
+			case '\\':
+			case '{':
+			case '}':
+			case ',':
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+			case '\v':
+			case '\f':
+				quote = true;
+				break;
+		}
+	}
+
+	if (quote)
+		AppendQuoted(str, len, "\\\\\"");
+	else
+		appendBinaryStringInfo(&copyString, str, len);
+}
+
+/*
+ * Append elements of a one-dimensional array without nulls using the tight
+ * loop of the given fast path
+ */
+static int
+AppendArrayFast(const ArrayFastPath *fast, const char *data, int datasize,
+				int nitems)
+{
+	int			i;
+
+	if ((int64) nitems * fast->typlen > datasize)
+		return -6;
+
+	appendStringInfoCharMacro(&copyString, '{');
+	for (i = 0; i < nitems; i += ARRAY_BATCH_SIZE)
+	{
+		int			n = Min(ARRAY_BATCH_SIZE, nitems - i);
+		char	   *cp;
+
+		enlargeStringInfo(&copyString, n * (fast->maxlen + 1) + 1);
+		cp = copyString.data + copyString.len;
+		while (n-- > 0)
+		{
+			cp = fast->write(cp, data);
+			*cp++ = ',';
+			data += fast->typlen;
+		}
+		copyString.len = cp - copyString.data;
+	}
+
+	/* replace the last comma */
+	copyString.data[copyString.len - 1] = '}';
+	copyString.data[copyString.len] = '\0';
+	return 0;
+}
+
+/*
+ * Append an array, given with its varlena header at a MAXALIGN'ed address,
+ * to current COPY line as a literal like {{1,2},{3,NULL}} or [0:1]={1,2}
+ */
+static int
+AppendArray(const char *array, int size, const AttributeDecoder *element)
+{
+	const ArrayHeader *header = (const ArrayHeader *) array;
+	int			ndim = header->ndim;
+	const int  *dims;
+	const int  *lbounds;
+	const bits8 *nullbitmap = NULL;
+	const ArrayFastPath *fast;
+	const char *data;
+	int			datasize;
+	int			dataoffset;
+	int64		nitems = 1;
+	int			indx[ARRAY_MAXDIM];
+	int			i;
+	int64		k;
+
+	if (ndim < 0 || ndim > ARRAY_MAXDIM)
+		return -2;
+
+	if (size < (int) (sizeof(ArrayHeader) + 2 * sizeof(int) * ndim))
+		return -3;
+
+	dims = ARRAY_DIMS(array);
+	lbounds = ARRAY_LBOUNDS(array);
+
+	for (i = 0; i < ndim; i++)
+	{
+		if (dims[i] < 0)
+			return -4;
+		nitems *= dims[i];
+		if (nitems > MaxAllocSize / sizeof(Datum))
+			return -4;
+	}
+
+	if (header->dataoffset != 0)
+	{
+		dataoffset = header->dataoffset;
+		if (dataoffset < (int) ARRAY_OVERHEAD_WITHNULLS(ndim, nitems) ||
+			dataoffset > size)
+			return -5;
+		nullbitmap = ARRAY_NULLBITMAP(array);
+	}
+	else
+	{
+		dataoffset = ARRAY_OVERHEAD_NONULLS(ndim);
+		if (dataoffset > size)
+			return -5;
+	}
+
+	data = array + dataoffset;
+	datasize = size - dataoffset;
+
+	CopyAppendSeparator();
+
+	if (ndim == 0 || nitems == 0)
+	{
+		appendBinaryStringInfo(&copyString, "{}", 2);
+		return 0;
+	}
+
+	/* Dimensions are only shown if some lower bound is not 1 */
+	for (i = 0; i < ndim; i++)
+	{
+		if (lbounds[i] != 1)
+			break;
+	}
+	if (i < ndim)
+	{
+		for (i = 0; i < ndim; i++)
+		{
+			char	   *cp;
+
+			enlargeStringInfo(&copyString, 2 * 20 + 4);
+			cp = copyString.data + copyString.len;
+			*cp++ = '[';
+			cp = WriteInt64(cp, lbounds[i]);
+			*cp++ = ':';
+			cp = WriteInt64(cp, (int64) lbounds[i] + dims[i] - 1);
+			*cp++ = ']';
+			CopyAppendEnd(cp);
+		}
+		appendStringInfoCharMacro(&copyString, '=');
+	}
+
+	for (fast = arrayFastPaths; fast->callback != NULL; fast++)
+	{
+		if (element->kind == DECODE_TYPE && fast->callback == element->callback)
+			break;
+	}
+	if (fast->callback == NULL)
+		fast = NULL;
+
+	if (fast != NULL && nullbitmap == NULL && ndim == 1)
+		return AppendArrayFast(fast, data, datasize, nitems);
+
+	for (i = 0; i < ndim; i++)
+	{
+		indx[i] = 0;
+		appendStringInfoCharMacro(&copyString, '{');
+	}
+
+	for (k = 0; k < nitems; k++)
+	{
+		if (k > 0)
+		{
+			int			j = ndim - 1;
+			int			closed;
+
+			/* Advance the subscripts, closing and reopening finished rows */
+			while (j >= 0 && ++indx[j] == dims[j])
+			{
+				indx[j] = 0;
+				j--;
+			}
+			closed = ndim - 1 - j;
+
+			for (i = 0; i < closed; i++)
+				appendStringInfoCharMacro(&copyString, '}');
+			appendStringInfoCharMacro(&copyString, ',');
+			for (i = 0; i < closed; i++)
+				appendStringInfoCharMacro(&copyString, '{');
+		}
+
+		if (nullbitmap != NULL && (nullbitmap[k / 8] & (1 << (k % 8))) == 0)
+			appendBinaryStringInfo(&copyString, "NULL", 4);
+		else if (fast != NULL)
+		{
+			if (datasize < fast->typlen)
+				return -6;
+			enlargeStringInfo(&copyString, fast->maxlen);
+			CopyAppendEnd(fast->write(copyString.data + copyString.len, data));
+			data += fast->typlen;
+			datasize -= fast->typlen;
+		}
+		else
+		{
+			StringInfo	value;
+			unsigned int processed = 0;
+			int			ret;
+
+			if (datasize <= 0)
+				return -6;
+
+			ret = DecodeNested(element, data, datasize, &processed, &value);
+			if (ret < 0)
+				return ret;
+			if (processed > (unsigned int) datasize)
+				return -6;
+
+			AppendArrayElement(value->data, value->len);
+			data += processed;
+			datasize -= processed;
+		}
+	}
+
+	for (i = 0; i < ndim; i++)
+		appendStringInfoCharMacro(&copyString, '}');
+
+	return 0;
+}
+
+/*
+ * Return the start of a varlena datum given without its header, copied to
+ * an aligned buffer if needed.  Values nested in arrays and records are
+ * aligned relative to the start of the datum, and their decoders align
+ * absolute addresses.  Datums with a short header and decompressed ones
+ * are not aligned in memory, so they are copied to a buffer returned in
+ * copy, which the caller frees.  NULL is returned if the copy would exceed
+ * the memory budget.
+ */
+static const char *
+AlignNestedValue(const char *str, int orig_len, char **copy)
+{
+	const char *datum = str - VARHDRSZ;
+
+	*copy = NULL;
+	if ((uintptr_t) datum % MAXIMUM_ALIGNOF == 0)
+		return datum;
+
+	ToastCacheRelease(orig_len + VARHDRSZ);
+	if (!MemoryBudgetAllows(orig_len + VARHDRSZ))
+	{
+		dumpStats.overBudget++;
+		return NULL;
+	}
+
+	if ((*copy = TrackedAlloc(orig_len + VARHDRSZ)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(*copy + VARHDRSZ, str, orig_len);
+	return *copy;
+}
+
+/* Append an array datum (without varlena header) to current COPY line */
+static int
+CopyAppendArray(const char *str, int orig_len)
+{
+	const AttributeDecoder *element = arrayElement;
+	const char *array;
+	char	   *aligned;
+	int			result;
+
+	if (orig_len < (int) (sizeof(ArrayHeader) - VARHDRSZ))
+		return -1;
+
+	if ((array = AlignNestedValue(str, orig_len, &aligned)) == NULL)
+	{
+		printf("WARNING: Array of %d bytes exceeds memory budget, skipped.\n",
+			   orig_len);
+		CopyAppend("(array exceeds memory budget)");
+		return 0;
+	}
+
+	result = AppendArray(array, orig_len + VARHDRSZ, element);
+	TrackedFree(aligned);
+	return result;
+}
+
+/* Decode an array of the type decoded by the element decoder */
+static int
+decode_array(const AttributeDecoder *element, const char *buffer,
+			 unsigned int buff_size, unsigned int *out_size)
+{
+	arrayElement = element;
+	return extract_data(buffer, buff_size, out_size, &CopyAppendArray);
+}
+
+/*
+ * Append a record field, already escaped for COPY, to current COPY line and
+ * quote it like record_out() does: fields that are empty or contain white
+ * space, parentheses, commas, quotes or backslashes are put in double
+ * quotes, with quotes and backslashes doubled.
+ */
+static void
+AppendRecordField(const char *str, int len)
+{
+	bool		quote = (len == 0);
+	int			i;
+
+	for (i = 0; i < len && !quote; i++)
+	{
+		switch (str[i])
+		{
+			case '"':
+			case '\\':
+			case '(':
+			case ')':
+			case ',':
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+			case '\v':
+			case '\f':
+				quote = true;
+				break;
+		}
+	}
+
+	if (quote)
+		AppendQuoted(str, len, "\"\"");
+	else
+		appendBinaryStringInfo(&copyString, str, len);
+}
+
+/*
+ * Append a record, given as a tuple with its varlena header at a MAXALIGN'ed
+ * address, to current COPY line as a literal like (1,"a b",).  Null fields
+ * and fields missing from the end of the tuple are left empty, skip:
+ * fields are left out altogether.
+ */
+static int
+AppendRecord(const char *tuple, int size, const AttributeDecoder *decoder)
+{
+	HeapTupleHeader header = (HeapTupleHeader) tuple;
+	const char *data;
+	int			datasize;
+	int			natts;
+	bool		first = true;
+	bool		ignore_rest = false;
+	int			i;
+
+	if (size < (int) SizeofHeapTupleHeader)
+		return -2;
+
+	natts = HeapTupleHeaderGetNatts(header);
+	if (header->t_hoff < SizeofHeapTupleHeader || header->t_hoff > size)
+		return -3;
+	if ((header->t_infomask & HEAP_HASNULL) &&
+		SizeofHeapTupleHeader + BITMAPLEN(natts) > header->t_hoff)
+		return -3;
+
+	data = tuple + header->t_hoff;
+	datasize = size - header->t_hoff;
+
+	CopyAppendSeparator();
+	appendStringInfoCharMacro(&copyString, '(');
+
+	for (i = 0; i < decoder->nfields; i++)
+	{
+		const AttributeDecoder *field = &decoder->fields[i];
+		StringInfo	value;
+		unsigned int processed = 0;
+		int			ret;
+
+		if (field->kind == DECODE_TYPE && field->callback == &decode_ignore)
+		{
+			ignore_rest = true;
+			break;
+		}
+
+		if (field->kind != DECODE_SKIP)
+		{
+			if (!first)
+				appendStringInfoCharMacro(&copyString, ',');
+			first = false;
+		}
+
+		if (i >= natts ||
+			((header->t_infomask & HEAP_HASNULL) && att_isnull(i, header->t_bits)))
+			continue;
+
+		if (datasize <= 0)
+			return -6;
+
+		ret = DecodeNested(field, data, datasize, &processed, &value);
+		if (ret < 0)
+			return ret;
+		if (processed > (unsigned int) datasize)
+			return -6;
+
+		if (field->kind != DECODE_SKIP)
+			AppendRecordField(value->data, value->len);
+		data += processed;
+		datasize -= processed;
+	}
+
+	if (!ignore_rest && (natts > decoder->nfields || datasize != 0))
+		return -8;
+
+	appendStringInfoCharMacro(&copyString, ')');
+	return 0;
+}
+
+/* Append a record datum (without varlena header) to current COPY line */
+static int
+CopyAppendRecord(const char *str, int orig_len)
+{
+	const AttributeDecoder *decoder = recordDecoder;
+	const char *tuple;
+	char	   *aligned;
+	int			result;
+
+	if ((tuple = AlignNestedValue(str, orig_len, &aligned)) == NULL)
+	{
+		printf("WARNING: Record of %d bytes exceeds memory budget, skipped.\n",
+			   orig_len);
+		CopyAppend("(record exceeds memory budget)");
+		return 0;
+	}
+
+	result = AppendRecord(tuple, orig_len + VARHDRSZ, decoder);
+	TrackedFree(aligned);
+	return result;
+}
+
+/*
+ * Decode a composite value, which is stored as a tuple of its own, using
+ * the field decoders of a record(...) type
+ */
+static int
+decode_record(const AttributeDecoder *decoder, const char *buffer,
+			  unsigned int buff_size, unsigned int *out_size)
+{
+	recordDecoder = decoder;
+	return extract_data(buffer, buff_size, out_size, &CopyAppendRecord);
+}
+
+/*
+ * Skip an attribute described by a generic descriptor, or dump its bytes in
+ * hex or base64 straight from the tuple.  Varlena values are dumped after
+ * decompression and TOAST lookup, without their header, unless the stored
+ * bytes were asked for.
+ */
+static int
+decode_generic(const AttributeDecoder *decoder, const char *buffer,
+			   unsigned int buff_size, unsigned int *out_size)
+{
+	int			(*append_raw) (const char *, int) =
+		decoder->base64 ? &CopyAppendBase64 : &CopyAppendBytea;
+
+	if (decoder->typlen == -1)
+	{
+		unsigned int padding = 0;
+		uint32		len;
+
+		if (decoder->kind == DECODE_RAW && !decoder->stored)
+			return extract_data(buffer, buff_size, out_size, append_raw);
+
+		/* Only the length word is needed to skip or dump a stored varlena */
+		while (buff_size > 0 && *buffer == 0x00)
+		{
+			buff_size--;
+			buffer++;
+			padding++;
+		}
+
+		if (buff_size == 0)
+			return -1;
+
+		if (VARATT_IS_1B_E(buffer))
+		{
+			if (buff_size < VARHDRSZ_EXTERNAL)
+				return -1;
+			len = VARSIZE_EXTERNAL(buffer);
+		}
+		else if (VARATT_IS_1B(buffer))
+			len = VARSIZE_1B(buffer);
+		else if (buff_size >= 4 && VARSIZE_4B(buffer) >= 4)
+			len = VARSIZE_4B(buffer);
+		else
+			return -2;
+
+		if (len > buff_size)
+			return -1;
+
+		/* Skipped and stored values may point to TOAST values as well */
+		if (toastCollect)
+		{
+			if (VARATT_IS_EXTERNAL_ONDISK(buffer))
+			{
+				varatt_external toast_ptr;
+
+				VARATT_EXTERNAL_GET_POINTER(toast_ptr, buffer);
+				toastCollect(&toast_ptr);
+			}
+		}
+		else if (decoder->kind == DECODE_RAW)
+			append_raw(buffer, len);
+		*out_size = padding + len;
+		return 0;
+	}
+	else if (decoder->typlen == -2)
+	{
+		size_t		len = strnlen(buffer, buff_size);
+
+		if (len == buff_size)
+			return -2;
+
+		/* The stored bytes include the terminating zero */
+		if (decoder->kind == DECODE_RAW)
+			append_raw(buffer, decoder->stored ? len + 1 : len);
+		*out_size = len + 1;
+		return 0;
+	}
+	else
+	{
+		const char *new_buffer = (const char *) TYPEALIGN(decoder->alignment, buffer);
+		unsigned int delta = (unsigned int) ((uintptr_t) new_buffer - (uintptr_t) buffer);
+
+		if (buff_size < delta)
+			return -1;
+
+		buff_size -= delta;
+		buffer = new_buffer;
+
+		if (buff_size < decoder->typlen)
+			return -2;
+
+		if (decoder->kind == DECODE_RAW)
+			append_raw(buffer, decoder->typlen);
+		*out_size = decoder->typlen + delta;
+		return 0;
+	}
+}
+
 /* Decode a char type */
 static int
 decode_char(const char *buffer, unsigned int buff_size, unsigned int *out_size)
@@ -1067,6 +3439,45 @@ decode_string(const char *buffer, unsigned int buff_size, unsigned int *out_size
        return result;
 }
 
+/*
+ * Step over a varlena while collecting TOAST pointers, passing those of
+ * values on disk to the collector
+ */
+static int
+CollectVarlena(const char *buffer, unsigned int buff_size, unsigned int *out_size)
+{
+	uint32		len;
+
+	if (VARATT_IS_1B_E(buffer))
+	{
+		len = VARSIZE_EXTERNAL(buffer);
+		if (len > buff_size)
+			return -1;
+
+		if (VARATT_IS_EXTERNAL_ONDISK(buffer))
+		{
+			varatt_external toast_ptr;
+
+			VARATT_EXTERNAL_GET_POINTER(toast_ptr, buffer);
+			toastCollect(&toast_ptr);
+		}
+	}
+	else if (VARATT_IS_1B(buffer))
+		len = VARSIZE_1B(buffer);
+	else if (VARATT_IS_4B_U(buffer) && buff_size >= 4)
+		len = VARSIZE_4B(buffer);
+	else if (VARATT_IS_4B_C(buffer) && buff_size >= 8)
+		len = VARSIZE_4B(buffer);
+	else
+		return -9;
+
+	if (len > buff_size)
+		return -1;
+
+	*out_size = len;
+	return 0;
+}
+
 /*
  * Align data, parse varlena header, detoast and decompress.
  * Last parameters responds for actual parsing according to type.
@@ -1088,6 +3499,13 @@ extract_data(const char *buffer, unsigned int buff_size, unsigned int *out_size,
 		padding++;
 	}
 
+	if (toastCollect)
+	{
+		result = CollectVarlena(buffer, buff_size, out_size);
+		*out_size += padding;
+		return result;
+	}
+
 	if (VARATT_IS_1B_E(buffer))
 	{
 		/*
@@ -1189,7 +3607,27 @@ extract_data(const char *buffer, unsigned int buff_size, unsigned int *out_size,
 		if (len > buff_size)
 			return -1;
 
-		if ((decompress_tmp_buff = malloc(decompressed_len)) == NULL)
+		if (decompressed_len > MaxAllocSize)
+		{
+			printf("WARNING: Corrupted toast data, raw size %u is too large.\n",
+				   decompressed_len);
+			CopyAppend("(inline compressed, corrupted)");
+			*out_size = padding + len;
+			return 0;
+		}
+
+		ToastCacheRelease(decompressed_len);
+		if (!MemoryBudgetAllows(decompressed_len))
+		{
+			printf("WARNING: Inline compressed value of %u bytes exceeds "
+				   "memory budget, skipped.\n", decompressed_len);
+			CopyAppend("(inline compressed, exceeds memory budget)");
+			dumpStats.overBudget++;
+			*out_size = padding + len;
+			return 0;
+		}
+
+		if ((decompress_tmp_buff = TrackedAlloc(decompressed_len)) == NULL)
 		{
 			perror("malloc");
 			exit(1);
@@ -1227,28 +3665,44 @@ extract_data(const char *buffer, unsigned int buff_size, unsigned int *out_size,
 			printf("WARNING: Corrupted toast data, unable to decompress.\n");
 			CopyAppend("(inline compressed, corrupted)");
 			*out_size = padding + len;
-			free(decompress_tmp_buff);
+			TrackedFree(decompress_tmp_buff);
 			return 0;
 		}
 
 		result = parse_value(decompress_tmp_buff, decompressed_len);
 		*out_size = padding + len;
-		free(decompress_tmp_buff);
+		TrackedFree(decompress_tmp_buff);
 		return result;
 	}
 
 	return -9;
 }
 
+/* Decode a single attribute with its decoder */
+static int
+DecodeAttribute(const AttributeDecoder *decoder, const char *buffer,
+				unsigned int buff_size, unsigned int *out_size)
+{
+	switch (decoder->kind)
+	{
+		case DECODE_ARRAY:
+			return decode_array(decoder->element, buffer, buff_size, out_size);
+		case DECODE_RECORD:
+			return decode_record(decoder, buffer, buff_size, out_size);
+		case DECODE_SKIP:
+		case DECODE_RAW:
+			return decode_generic(decoder, buffer, buff_size, out_size);
+		default:
+			return decoder->callback(buffer, buff_size, out_size);
+	}
+}
+
 /*
- * Try to decode a tuple using a types string provided previously.
- *
- * Arguments:
- *   tupleData   - pointer to the tuple data
- *   tupleSize   - tuple size in bytes
+ * Decode a tuple into copyString.  Returns false after printing an error if
+ * it cannot be decoded.
  */
-void
-FormatDecode(const char *tupleData, unsigned int tupleSize)
+static bool
+DecodeTuple(const char *tupleData, unsigned int tupleSize)
 {
 	HeapTupleHeader header = (HeapTupleHeader) tupleData;
 	const char *data = tupleData + header->t_hoff;
@@ -1264,7 +3718,8 @@ FormatDecode(const char *tupleData, unsigned int tupleSize)
 
 		if ((header->t_infomask & HEAP_HASNULL) && att_isnull(curr_attr, header->t_bits))
 		{
-			CopyAppend("\\N");
+			if (callbacks[curr_attr].kind != DECODE_SKIP)
+				CopyAppend("\\N");
 			continue;
 		}
 
@@ -1272,15 +3727,15 @@ FormatDecode(const char *tupleData, unsigned int tupleSize)
 		{
 			printf("Error: unable to decode a tuple, no more bytes left. Partial data: %s\n",
 				   copyString.data);
-			return;
+			return false;
 		}
 
-		ret = callbacks[curr_attr] (data, size, &processed_size);
+		ret = DecodeAttribute(&callbacks[curr_attr], data, size, &processed_size);
 		if (ret < 0)
 		{
 			printf("Error: unable to decode a tuple, callback #%d returned %d. Partial data: %s\n",
 				   curr_attr + 1, ret, copyString.data);
-			return;
+			return false;
 		}
 
 		size -= processed_size;
@@ -1291,18 +3746,296 @@ FormatDecode(const char *tupleData, unsigned int tupleSize)
 	{
 		printf("Error: unable to decode a tuple, %d bytes left, 0 expected. Partial data: %s\n",
 			   size, copyString.data);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Try to decode a tuple using a types string provided previously.
+ *
+ * Arguments:
+ *   tupleData   - pointer to the tuple data
+ *   tupleSize   - tuple size in bytes
+ */
+void
+FormatDecode(const char *tupleData, unsigned int tupleSize)
+{
+	if (!DecodeTuple(tupleData, tupleSize))
+		return;
+
+	dumpStats.tuples++;
+	if (numDedupKeys > 0)
+	{
+		DedupAddRow(copyString.data, copyString.len,
+					(HeapTupleHeader) tupleData);
+		CopyClear();
+	}
+	else
+		CopyFlush();
+}
+
+/*
+ * Decode a tuple like FormatDecode() without outputting it.  Returns the
+ * COPY row, valid until the next tuple is decoded, or NULL after printing
+ * an error.
+ */
+const char *
+DecodeRow(const char *tupleData, unsigned int tupleSize, int *len)
+{
+	if (!DecodeTuple(tupleData, tupleSize))
+		return NULL;
+
+	dumpStats.tuples++;
+	*len = copyString.len;
+	return copyString.data;
+}
+
+/* Index into callbacks of a 1-based column of the COPY rows, or -1 */
+static int
+ColumnCallback(int column)
+{
+	int			i;
+
+	for (i = 0; i < ncallbacks; i++)
+	{
+		if (callbacks[i].kind == DECODE_SKIP)
+			continue;
+		if (callbacks[i].kind == DECODE_TYPE &&
+			callbacks[i].callback == &decode_ignore)
+			break;
+		if (--column == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Decode the key attributes of an index tuple, which are the given 1-based
+ * columns of the -D list in order, into a tab separated key in the format
+ * of ExtractRowColumns().  data and size give the attribute data of the
+ * tuple, nulls its null bitmap or NULL.  Returns 1 and sets key and len,
+ * 0 if a key attribute is NULL, or -1 if the tuple cannot be decoded.
+ */
+int
+DecodeIndexKey(const char *data, unsigned int size, const bits8 *nulls,
+			   const int *columns, int ncolumns, const char **key, int *len)
+{
+	int			k;
+
+	CopyClear();
+
+	for (k = 0; k < ncolumns; k++)
+	{
+		int			ret;
+		unsigned int processed_size = 0;
+		int			i = ColumnCallback(columns[k]);
+
+		if (nulls != NULL && att_isnull(k, nulls))
+			return 0;
+
+		if (i < 0 || size <= 0)
+			return -1;
+
+		ret = DecodeAttribute(&callbacks[i], data, size, &processed_size);
+		if (ret < 0)
+			return -1;
+
+		size -= processed_size;
+		data += processed_size;
+	}
+
+	*key = copyString.data;
+	*len = copyString.len;
+	return 1;
+}
+
+/*
+ * Copy the given 1-based columns of a decoded COPY row to dest, separated
+ * by tabs, which cannot occur unescaped within a column.  dest must have
+ * room for len + ncolumns bytes.  Returns the length copied, or -1 if one
+ * of the columns is NULL.
+ */
+int
+ExtractRowColumns(const char *row, int len, const int *columns, int ncolumns,
+				  char *dest)
+{
+	const char *end = row + len;
+	int			destLen = 0;
+	int			k;
+
+	for (k = 0; k < ncolumns; k++)
+	{
+		const char *field = row;
+		const char *fieldEnd;
+		int			column;
+
+		for (column = 1; column < columns[k] && field < end; column++)
+		{
+			field = memchr(field, '\t', end - field);
+			field = field ? field + 1 : end;
+		}
+		fieldEnd = memchr(field, '\t', end - field);
+		if (fieldEnd == NULL)
+			fieldEnd = end;
+
+		if (fieldEnd - field == 2 && field[0] == '\\' && field[1] == 'N')
+			return -1;
+
+		if (k > 0)
+			dest[destLen++] = '\t';
+		memcpy(dest + destLen, field, fieldEnd - field);
+		destLen += fieldEnd - field;
+	}
+
+	return destLen;
+}
+
+/*
+ * Copy the given 1-based columns of a decoded COPY row into buffer,
+ * growing it as needed.  Returns the length of the key, or -1 if one of
+ * the columns is NULL.
+ */
+int
+BuildRowKey(KeyBuffer *buffer, const char *row, int len, const int *columns,
+			int ncolumns)
+{
+	if (buffer->size < (Size) len + ncolumns)
+	{
+		TrackedFree(buffer->data);
+		buffer->size = Max(len + ncolumns, 1024);
+		if ((buffer->data = TrackedAlloc(buffer->size)) == NULL)
+		{
+			perror("malloc");
+			exit(1);
+		}
+	}
+
+	return ExtractRowColumns(row, len, columns, ncolumns, buffer->data);
+}
+
+void
+FreeKeyBuffer(KeyBuffer *buffer)
+{
+	TrackedFree(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+}
+
+/* FNV-1a hash of a key */
+uint32
+KeyHash(const char *key, uint32 len)
+{
+	uint32		hash = 2166136261u;
+	uint32		i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char) key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Order keys bytewise, a key before the longer keys it is a prefix of */
+int
+KeyCompare(const char *key1, uint32 len1, const char *key2, uint32 len2)
+{
+	int			cmp = memcmp(key1, key2, Min(len1, len2));
+
+	if (cmp != 0)
+		return cmp;
+	return (len1 > len2) - (len1 < len2);
+}
+
+/* Print a key, its columns separated by commas */
+void
+PrintKey(const char *key, uint32 len)
+{
+	uint32		i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (key[i] == '\t')
+			fputs(", ", stdout);
+		else
+			putchar(key[i]);
+	}
+}
+
+/*
+ * Walk the attributes of a tuple like FormatDecode(), without printing
+ * anything, and pass the pointers to TOAST values on disk it holds to
+ * add_pointer.  Used to read the TOAST values of a page ahead and by
+ * --toast-check.
+ */
+void
+CollectToastPointers(const char *tupleData, unsigned int tupleSize,
+					 void (*add_pointer) (const varatt_external *pointer))
+{
+	HeapTupleHeader header = (HeapTupleHeader) tupleData;
+	const char *data;
+	unsigned int size;
+	int			curr_attr;
+
+	if (tupleSize < SizeofHeapTupleHeader || header->t_hoff > tupleSize)
 		return;
+
+	data = tupleData + header->t_hoff;
+	size = tupleSize - header->t_hoff;
+
+	CopyClear();
+	toastCollect = add_pointer;
+
+	for (curr_attr = 0; curr_attr < ncallbacks; curr_attr++)
+	{
+		unsigned int processed_size = 0;
+
+		if ((header->t_infomask & HEAP_HASNULL) && att_isnull(curr_attr, header->t_bits))
+			continue;
+
+		if (size <= 0 ||
+			DecodeAttribute(&callbacks[curr_attr], data, size, &processed_size) < 0)
+			break;
+
+		size -= processed_size;
+		data += processed_size;
 	}
 
-	CopyFlush();
+	toastCollect = NULL;
+	CopyClear();
 }
 
-static int DumpCompressedString(const char *data, int32 compressed_size, int (*parse_value)(const char *, int))
+/*
+ * Decompress a TOAST value compressed with pglz or lz4 into a new tracked
+ * buffer, returned in result.  Returns the number of bytes decompressed,
+ * or -2 if the method is not supported by this build.  Unless the value
+ * decompressed to its recorded raw size, which may not exceed rawsize,
+ * result is set to NULL.  Called by the TOAST prefetch workers, so it must
+ * not print anything.
+ */
+int
+DecompressToastValue(const char *data, int32 compressed_size, int32 rawsize,
+					 char **result)
 {
 	int						decompress_ret;
-	char				   *decompress_tmp_buff = malloc(TOAST_COMPRESS_RAWSIZE(data));
+	char				   *decompress_tmp_buff;
 	ToastCompressionId		cmid;
 
+	*result = NULL;
+	if (compressed_size < (int32) TOAST_COMPRESS_HEADER_SIZE ||
+		TOAST_COMPRESS_RAWSIZE(data) > (uint32) rawsize)
+		return -1;
+
+	decompress_tmp_buff = TrackedAlloc(TOAST_COMPRESS_RAWSIZE(data));
+	if (decompress_tmp_buff == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
 	cmid = TOAST_COMPRESS_RAWMETHOD(data);
 	switch(cmid)
 	{
@@ -1322,9 +4055,7 @@ static int DumpCompressedString(const char *data, int32 compressed_size, int (*p
 												 TOAST_COMPRESS_RAWSIZE(data));
 			break;
 #else
-			printf("Error: compression method lz4 not supported.\n");
-			printf("Try to rebuild pg_filedump for PostgreSQL server of version 14+ with --with-lz4 option.\n");
-			free(decompress_tmp_buff);
+			TrackedFree(decompress_tmp_buff);
 			return -2;
 #endif
 		default:
@@ -1334,6 +4065,32 @@ static int DumpCompressedString(const char *data, int32 compressed_size, int (*p
 
 	if ((decompress_ret != TOAST_COMPRESS_RAWSIZE(data)) ||
 			(decompress_ret < 0))
+		TrackedFree(decompress_tmp_buff);
+	else
+		*result = decompress_tmp_buff;
+
+	return decompress_ret;
+}
+
+static int DumpCompressedString(const char *data, int32 compressed_size,
+		const varatt_external *toast_ptr,
+		int (*parse_value)(const char *, int))
+{
+	int						decompress_ret;
+	char				   *decompressed;
+
+	decompress_ret = DecompressToastValue(data, compressed_size,
+										  toast_ptr->va_rawsize - VARHDRSZ,
+										  &decompressed);
+
+	if (decompress_ret == -2)
+	{
+		printf("Error: compression method lz4 not supported.\n");
+		printf("Try to rebuild pg_filedump for PostgreSQL server of version 14+ with --with-lz4 option.\n");
+		return -2;
+	}
+
+	if (decompressed == NULL)
 	{
 		printf("WARNING: Unable to decompress a string. Data is corrupted.\n");
 		printf("Returned %d while expected %d.\n", decompress_ret,
@@ -1341,14 +4098,58 @@ static int DumpCompressedString(const char *data, int32 compressed_size, int (*p
 	}
 	else
 	{
-		CopyAppendEncode(decompress_tmp_buff, decompress_ret);
+		ToastCacheInsert(toast_ptr->va_toastrelid, toast_ptr->va_valueid,
+						 decompressed, decompress_ret);
+		/* Fail like the cached and prefetched values do */
+		decompress_ret = parse_value(decompressed, decompress_ret);
 	}
 
-	free(decompress_tmp_buff);
+	TrackedFree(decompressed);
 
 	return decompress_ret;
 }
 
+/*
+ * Read the chunks of a TOAST value by sweeping its TOAST relation, which
+ * prints the chunks with -v.  Returns 0 on success, -1 if the relation
+ * cannot be opened or a positive value if the chunks are not complete.
+ */
+static int
+DumpToastChunks(const varatt_external *toast_ptr, int32 toast_ext_size,
+				char *toast_data)
+{
+	char		toast_relation_filename[MAXPGPATH];
+	FILE	   *toast_rel_fp;
+	unsigned int toast_relation_block_size;
+	int			result;
+
+	ToastRelationPath(toast_ptr->va_toastrelid, toast_relation_filename);
+	toast_rel_fp = fopen(toast_relation_filename, "rb");
+	if (!toast_rel_fp)
+	{
+		printf("Cannot open TOAST relation %s\n",
+			   toast_relation_filename);
+		return -1;
+	}
+
+	toast_relation_block_size = GetBlockSize(toast_rel_fp);
+	fseek(toast_rel_fp, 0, SEEK_SET);
+
+	result = DumpFileContents(0,
+							  0,
+							  toast_rel_fp,
+							  toast_relation_block_size,
+							  -1, /* no start block */
+							  -1, /* no end block */
+							  true, /* is toast relation */
+							  toast_ptr->va_valueid,
+							  toast_ext_size,
+							  toast_data);
+
+	fclose(toast_rel_fp);
+	return result;
+}
+
 static int
 ReadStringFromToast(const char *buffer,
 		unsigned int buff_size,
@@ -1366,13 +4167,8 @@ ReadStringFromToast(const char *buffer,
 		int32		num_chunks;
 		/* Actual size of external TOASTed value */
 		int32		toast_ext_size;
-		/* Path to directory with TOAST realtion file */
-		char	   *toast_relation_path;
-		/* Filename of TOAST relation file */
-		char		toast_relation_filename[MAXPGPATH];
-		FILE	   *toast_rel_fp;
-		unsigned int block_options = 0;
-		unsigned int control_options = 0;
+		const char *cached;
+		Size		cached_size;
 
 		VARATT_EXTERNAL_GET_POINTER(toast_ptr, buffer);
 
@@ -1392,52 +4188,95 @@ ReadStringFromToast(const char *buffer,
 				toast_ptr.va_toastrelid,
 				num_chunks);
 
-		/* Open TOAST relation file */
-		toast_relation_path = strdup(fileName);
-		get_parent_directory(toast_relation_path);
-		sprintf(toast_relation_filename, "%s/%d",
-				*toast_relation_path ? toast_relation_path : ".",
-				toast_ptr.va_toastrelid);
-		toast_rel_fp = fopen(toast_relation_filename, "rb");
-		if (!toast_rel_fp) {
-			printf("Cannot open TOAST relation %s\n",
-					toast_relation_filename);
-			result = -1;
+		dumpStats.toastValues++;
+
+		/*
+		 * A corrupted pointer must not make us allocate a huge buffer.  The
+		 * external size never exceeds the raw size, which is limited like
+		 * any varlena.
+		 */
+		if (toast_ptr.va_rawsize < VARHDRSZ ||
+			(Size) toast_ptr.va_rawsize > MaxAllocSize ||
+			toast_ext_size < 0 ||
+			toast_ext_size > toast_ptr.va_rawsize - VARHDRSZ)
+		{
+			printf("WARNING: Corrupted TOAST pointer, value skipped.\n");
+			CopyAppend("(TOAST pointer corrupted)");
+			return 0;
 		}
-		else
+
+		/*
+		 * Tuple versions left by updates share their TOAST values.  Making
+		 * room for the COPY text of a cached value may evict it, in which
+		 * case it is read again below.
+		 */
+		if (ToastCacheContains(toast_ptr.va_toastrelid, toast_ptr.va_valueid) &&
+			!ToastValueFits(&toast_ptr, true))
+			return 0;
+		cached = ToastCacheLookup(toast_ptr.va_toastrelid, toast_ptr.va_valueid,
+								  &cached_size);
+		if (cached != NULL)
+			return parse_value(cached, (int) cached_size);
+
+		/* Values of the page read ahead by the TOAST prefetch workers */
+		if (ToastPrefetchTake(toast_ptr.va_toastrelid, toast_ptr.va_valueid,
+							  &toast_data, &cached_size))
 		{
-			unsigned int toast_relation_block_size = GetBlockSize(toast_rel_fp);
-			fseek(toast_rel_fp, 0, SEEK_SET);
-			toast_data = malloc(toast_ptr.va_rawsize);
-
-			result = DumpFileContents(block_options,
-					control_options,
-					toast_rel_fp,
-					toast_relation_block_size,
-					-1, /* no start block */
-					-1, /* no end block */
-					true, /* is toast relation */
-					toast_ptr.va_valueid,
-					toast_ext_size,
-					toast_data);
-
-			if (result == 0)
+			if (!ToastValueFits(&toast_ptr, true))
 			{
-				if (VARATT_EXTERNAL_IS_COMPRESSED(toast_ptr))
-					result = DumpCompressedString(toast_data, toast_ext_size, parse_value);
-				else
-					result = parse_value(toast_data, toast_ext_size);
+				TrackedFree(toast_data);
+				return 0;
 			}
+			ToastCacheInsert(toast_ptr.va_toastrelid, toast_ptr.va_valueid,
+							 toast_data, cached_size);
+			result = parse_value(toast_data, (int) cached_size);
+			TrackedFree(toast_data);
+			return result;
+		}
+
+		if (!ToastValueFits(&toast_ptr, false))
+			return 0;
+
+		toast_data = TrackedAlloc(toast_ptr.va_rawsize);
+		if (toast_data == NULL)
+		{
+			perror("malloc");
+			exit(1);
+		}
+
+		/*
+		 * With -v the chunks are printed as the TOAST relation is swept,
+		 * otherwise they are read through its chunk index
+		 */
+		if (verbose)
+			result = DumpToastChunks(&toast_ptr, toast_ext_size, toast_data);
+		else
+		{
+			result = ToastFetchValue(toast_ptr.va_toastrelid,
+									 toast_ptr.va_valueid, toast_ext_size,
+									 toast_data);
+			/* Without a chunk index the relation is swept for the value */
+			if (result == -2)
+				result = DumpToastChunks(&toast_ptr, toast_ext_size,
+										 toast_data);
+		}
+
+		if (result == 0)
+		{
+			if (VARATT_EXTERNAL_IS_COMPRESSED(toast_ptr))
+				result = DumpCompressedString(toast_data, toast_ext_size,
+											  &toast_ptr, parse_value);
 			else
 			{
-				printf("Error in TOAST file.\n");
+				ToastCacheInsert(toast_ptr.va_toastrelid, toast_ptr.va_valueid,
+								 toast_data, toast_ext_size);
+				result = parse_value(toast_data, toast_ext_size);
 			}
-
-			free(toast_data);
-			fclose(toast_rel_fp);
 		}
+		else if (result > 0)
+			printf("Error in TOAST file.\n");
 
-		free(toast_relation_path);
+		TrackedFree(toast_data);
 	}
 	/* If tag is indirect or expanded, it was stored in memory. */
 	else
@@ -1484,6 +4323,11 @@ DecodeBytesBinary(const char *buffer,
 {
 	if (!VARATT_IS_EXTENDED(buffer))
 	{
+		/* A damaged chunk must not make us read past the tuple */
+		if (buff_size < VARHDRSZ || VARSIZE(buffer) < VARHDRSZ ||
+			VARSIZE(buffer) > buff_size)
+			return -1;
+
 		*out_length = VARSIZE(buffer) - VARHDRSZ;
 
 		*processed_size = VARSIZE(buffer);
@@ -15,6 +15,52 @@ ParseAttributeTypesString(const char *str);
 void
 FormatDecode(const char *tupleData, unsigned int tupleSize);
 
+int
+DecodedColumnCount(void);
+
+bool
+AttributeTypesIgnoreRest(void);
+
+void
+SwapAttributeTypes(void);
+
+const char *
+DecodeRow(const char *tupleData, unsigned int tupleSize, int *len);
+
+int
+DecodeIndexKey(const char *data, unsigned int size, const bits8 *nulls,
+			   const int *columns, int ncolumns, const char **key, int *len);
+
+int
+ExtractRowColumns(const char *row, int len, const int *columns, int ncolumns,
+				  char *dest);
+
+/* Key built from the columns of a COPY row by BuildRowKey() */
+typedef struct KeyBuffer
+{
+	char	   *data;
+	Size		size;
+} KeyBuffer;
+
+int
+BuildRowKey(KeyBuffer *buffer, const char *row, int len, const int *columns,
+			int ncolumns);
+
+void
+FreeKeyBuffer(KeyBuffer *buffer);
+
+uint32
+KeyHash(const char *key, uint32 len);
+
+int
+KeyCompare(const char *key1, uint32 len1, const char *key2, uint32 len2);
+
+void
+PrintKey(const char *key, uint32 len);
+
+void
+CopyOutputRow(const char *row, int len);
+
 void
 ToastChunkDecode(const char* tuple_data,
 		unsigned int tuple_size,
@@ -23,6 +69,17 @@ ToastChunkDecode(const char* tuple_data,
 		char *chunk_data,
 		unsigned int *chunk_data_size);
 
+int
+DecompressToastValue(const char *data, int32 compressed_size, int32 rawsize,
+					 char **result);
+
+Size
+ToastValueMemory(const struct varatt_external *pointer);
+
+void
+CollectToastPointers(const char *tupleData, unsigned int tupleSize,
+					 void (*add_pointer) (const struct varatt_external *pointer));
+
 struct NumericShort
 {
        uint16          n_header;               /* Sign + display scale + weight */
@@ -141,4 +198,65 @@ struct NumericData
        : ((n)->choice.n_long.n_weight))
 
 
+/*
+ * On-disk format of jsonb, from utils/jsonb.h.  A jsonb datum is a varlena
+ * holding the root container: a uint32 header with the element count and
+ * flags, an array of JEntry words, then the data of the children.
+ */
+typedef uint32 JEntry;
+
+#define JENTRY_OFFLENMASK      0x0FFFFFFF
+#define JENTRY_TYPEMASK                0x70000000
+#define JENTRY_HAS_OFF         0x80000000
+
+#define JENTRY_ISSTRING                0x00000000
+#define JENTRY_ISNUMERIC       0x10000000
+#define JENTRY_ISBOOL_FALSE    0x20000000
+#define JENTRY_ISBOOL_TRUE     0x30000000
+#define JENTRY_ISNULL          0x40000000
+#define JENTRY_ISCONTAINER     0x50000000
+
+#define JBE_OFFLENFLD(je_)     ((je_) & JENTRY_OFFLENMASK)
+#define JBE_HAS_OFF(je_)       (((je_) & JENTRY_HAS_OFF) != 0)
+
+#define JB_CMASK                       0x0FFFFFFF
+#define JB_FSCALAR                     0x10000000
+#define JB_FOBJECT                     0x20000000
+#define JB_FARRAY                      0x40000000
+
+/* Address families of inet and cidr values, from utils/inet.h */
+#define PGSQL_AF_INET          (AF_INET + 0)
+#define PGSQL_AF_INET6         (AF_INET + 1)
+
+/*
+ * On-disk format of arrays, from utils/array.h.  The varlena header is
+ * followed by the number of dimensions, the offset of the element data (0
+ * if there is no null bitmap) and the element type OID, then the dimensions,
+ * the lower bounds, the optional null bitmap and the elements, which start
+ * at a MAXALIGN'ed offset.
+ */
+typedef struct
+{
+	int32		vl_len_;		/* varlena header */
+	int			ndim;			/* number of dimensions */
+	int32		dataoffset;		/* offset to data, or 0 if no bitmap */
+	Oid			elemtype;		/* element type OID */
+} ArrayHeader;
+
+#define ARRAY_MAXDIM		6
+
+#define ARRAY_DIMS(a) \
+	((const int *) (((const char *) (a)) + sizeof(ArrayHeader)))
+#define ARRAY_LBOUNDS(a) \
+	((const int *) (((const char *) (a)) + sizeof(ArrayHeader) + \
+					sizeof(int) * ((const ArrayHeader *) (a))->ndim))
+#define ARRAY_NULLBITMAP(a) \
+	((const bits8 *) (((const char *) (a)) + sizeof(ArrayHeader) + \
+					  2 * sizeof(int) * ((const ArrayHeader *) (a))->ndim))
+#define ARRAY_OVERHEAD_NONULLS(ndims) \
+	MAXALIGN(sizeof(ArrayHeader) + 2 * sizeof(int) * (ndims))
+#define ARRAY_OVERHEAD_WITHNULLS(ndims, nitems) \
+	MAXALIGN(sizeof(ArrayHeader) + 2 * sizeof(int) * (ndims) + \
+			 ((nitems) + 7) / 8)
+
 #endif
@@ -0,0 +1,380 @@
+/*
+ * Latest version per key for pg_filedump
+ *
+ * Without visibility information, decoding a heap with -D yields every
+ * version of each row that is still on disk.  With --dedup-key, the rows
+ * are not printed as they are decoded but kept in a hash table on the
+ * given columns, holding per key only the newest version by xmin or, with
+ * --dedup-by lsn, by the LSN of its page.  Versions whose inserting
+ * transaction is marked aborted by the hint bits are dropped.  When the
+ * table outgrows --dedup-memory it is sorted by key and written to a
+ * temporary file as a run; at the end the runs are merged, so the rows
+ * come out sorted by key.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+#include "decode.h"
+
+/* Default of --dedup-memory */
+#define DEFAULT_DEDUP_MEMORY	(256 * 1024 * 1024)
+
+/* What makes one version of a row newer than another */
+typedef struct DedupVersion
+{
+	XLogRecPtr	lsn;			/* of the page holding the version */
+	uint64		seq;			/* position in the scan */
+	TransactionId xmin;
+	bool		superseded;		/* deleted or updated by a valid xmax */
+} DedupVersion;
+
+/* Newest version of a key, followed by the key columns and the row */
+typedef struct DedupEntry
+{
+	uint32		rowLen;
+	DedupVersion version;
+	KeyEntry	entry;
+} DedupEntry;
+
+/* Header of an entry in a run file, followed by the key and the row */
+typedef struct DedupRunRecord
+{
+	uint32		keyLen;
+	uint32		rowLen;
+	DedupVersion version;
+} DedupRunRecord;
+
+/* Merge state of a run file */
+typedef struct DedupRun
+{
+	FILE	   *file;
+	DedupRunRecord record;		/* current record, if not at the end */
+	char	   *data;			/* its key and row */
+	Size		dataSize;		/* allocated for data */
+	bool		atEnd;
+} DedupRun;
+
+/* --dedup-key: 1-based columns of the COPY output forming the key */
+int			dedupKeys[MAX_KEY_COLUMNS];
+int			numDedupKeys = 0;
+
+/* --dedup-by: xmin or lsn */
+int			dedupBy = DEDUP_BY_XMIN;
+
+/* --dedup-memory: size of the hash table before it is spilled */
+Size		dedupMemory = DEFAULT_DEDUP_MEMORY;
+
+/* LSN of the page being decoded, set by FormatItemBlock() */
+XLogRecPtr	dedupPageLsn = InvalidXLogRecPtr;
+
+static KeyTable dedupTable = {0};
+static uint64 dedupSeq = 0;
+
+/* Spilled runs */
+static DedupRun *dedupRuns = NULL;
+static int	dedupNumRuns = 0;
+
+/* Key being built for a row */
+static KeyBuffer dedupKey = {0};
+
+/*
+ * Is version a newer than version b?  Ordered by page LSN with --dedup-by
+ * lsn, then by xmin, taking wraparound into account and special xids as
+ * the oldest, then versions not superseded first and then by the order
+ * they were read in.
+ */
+static bool
+DedupNewer(const DedupVersion *a, const DedupVersion *b)
+{
+	if (dedupBy == DEDUP_BY_LSN && a->lsn != b->lsn)
+		return a->lsn > b->lsn;
+
+	if (a->xmin != b->xmin)
+	{
+		if (!TransactionIdIsNormal(a->xmin) || !TransactionIdIsNormal(b->xmin))
+			return TransactionIdIsNormal(a->xmin);
+		return (int32) (a->xmin - b->xmin) > 0;
+	}
+
+	if (a->superseded != b->superseded)
+		return !a->superseded;
+
+	return a->seq > b->seq;
+}
+
+/* Write the hash table to a new run file and empty it */
+static void
+DedupSpill(void)
+{
+	uint32		count;
+	KeyEntry  **entries = KeyTableTake(&dedupTable, &count);
+	DedupRun   *run;
+	uint32		i;
+
+	dedupRuns = KeyTableRealloc(dedupRuns,
+								(dedupNumRuns + 1) * sizeof(DedupRun));
+	run = &dedupRuns[dedupNumRuns++];
+	memset(run, 0, sizeof(DedupRun));
+	run->file = SpillFileCreate();
+
+	for (i = 0; i < count; i++)
+	{
+		DedupEntry *entry = KeyEntryContainer(DedupEntry, entry, entries[i]);
+		DedupRunRecord record;
+
+		memset(&record, 0, sizeof(record));
+		record.keyLen = entry->entry.keyLen;
+		record.rowLen = entry->rowLen;
+		record.version = entry->version;
+		SpillFileWrite(run->file, &record, sizeof(record));
+		SpillFileWrite(run->file, KeyEntryKey(&entry->entry),
+					   (Size) record.keyLen + record.rowLen);
+		TrackedFree(entry);
+	}
+	TrackedFree(entries);
+
+	SpillFileRewind(run->file);
+
+	dumpStats.dedupRuns++;
+}
+
+/*
+ * Keep a decoded row in COPY text format if it is the newest version of
+ * its key so far.  Rows with a NULL key column are output right away.
+ */
+void
+DedupAddRow(const char *row, int len, HeapTupleHeader header)
+{
+	DedupVersion version;
+	KeyEntry  **link;
+	DedupEntry *entry;
+	uint32		hash;
+	int			keyLen;
+	Size		size;
+
+	/* The inserting transaction aborted */
+	if (HeapTupleHeaderXminInvalid(header))
+	{
+		dumpStats.dedupAborted++;
+		return;
+	}
+
+	keyLen = BuildRowKey(&dedupKey, row, len, dedupKeys, numDedupKeys);
+	if (keyLen < 0)
+	{
+		CopyOutputRow(row, len);
+		return;
+	}
+
+	version.lsn = dedupPageLsn;
+	version.seq = dedupSeq++;
+	version.xmin = HeapTupleHeaderGetRawXmin(header);
+	version.superseded = HeapTupleHeaderGetRawXmax(header) != InvalidTransactionId &&
+		!(header->t_infomask & HEAP_XMAX_INVALID) &&
+		!HEAP_XMAX_IS_LOCKED_ONLY(header->t_infomask);
+
+	hash = KeyHash(dedupKey.data, keyLen);
+	link = KeyTableFind(&dedupTable, dedupKey.data, keyLen, hash);
+
+	if (*link != NULL)
+	{
+		entry = KeyEntryContainer(DedupEntry, entry, *link);
+		dumpStats.dedupSuperseded++;
+		if (!DedupNewer(&version, &entry->version))
+			return;
+
+		/* Replace the row of the entry, reallocating if it grows */
+		if ((uint32) len > entry->rowLen)
+		{
+			entry = KeyTableRealloc(entry, sizeof(DedupEntry) + keyLen + len);
+			*link = &entry->entry;
+			dedupTable.memoryUsed += len - entry->rowLen;
+		}
+		else
+			dedupTable.memoryUsed -= entry->rowLen - len;
+
+		memcpy(KeyEntryKey(&entry->entry) + keyLen, row, len);
+		entry->rowLen = len;
+		entry->version = version;
+	}
+	else
+	{
+		size = sizeof(DedupEntry) + keyLen + len;
+		entry = KeyTableAlloc(size);
+		entry->rowLen = len;
+		entry->version = version;
+		KeyTableInsert(&dedupTable, link, &entry->entry, dedupKey.data,
+					   keyLen, hash, size);
+		memcpy(KeyEntryKey(&entry->entry) + keyLen, row, len);
+	}
+
+	if (KeyTableFull(&dedupTable, dedupMemory))
+		DedupSpill();
+}
+
+/* Read the next record of a run, returning false at its end */
+static bool
+DedupRunNext(DedupRun *run)
+{
+	Size		size;
+
+	if (!SpillFileNext(run->file, &run->record, sizeof(DedupRunRecord)))
+	{
+		run->atEnd = true;
+		return false;
+	}
+
+	size = (Size) run->record.keyLen + run->record.rowLen;
+	if (size > run->dataSize)
+	{
+		TrackedFree(run->data);
+		run->dataSize = Max(size, 1024);
+		run->data = KeyTableAlloc(run->dataSize);
+	}
+	SpillFileRead(run->file, run->data, size);
+	return true;
+}
+
+static int
+DedupRunCompare(const DedupRun *r1, const DedupRun *r2)
+{
+	return KeyCompare(r1->data, r1->record.keyLen,
+					  r2->data, r2->record.keyLen);
+}
+
+/* Restore the heap property of the merge heap below position i */
+static void
+DedupSiftDown(DedupRun **heap, int n, int i)
+{
+	for (;;)
+	{
+		int			smallest = i;
+		int			left = 2 * i + 1;
+		int			right = left + 1;
+		DedupRun   *tmp;
+
+		if (left < n && DedupRunCompare(heap[left], heap[smallest]) < 0)
+			smallest = left;
+		if (right < n && DedupRunCompare(heap[right], heap[smallest]) < 0)
+			smallest = right;
+		if (smallest == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+/* Merge the runs, outputting the newest version of each key */
+static void
+DedupMergeRuns(void)
+{
+	DedupRun  **heap = KeyTableAlloc(dedupNumRuns * sizeof(DedupRun *));
+	DedupRunRecord best;
+	char	   *bestData = NULL;
+	Size		bestSize = 0;
+	int			n = 0;
+	int			i;
+
+	for (i = 0; i < dedupNumRuns; i++)
+	{
+		if (DedupRunNext(&dedupRuns[i]))
+			heap[n++] = &dedupRuns[i];
+	}
+	for (i = n / 2 - 1; i >= 0; i--)
+		DedupSiftDown(heap, n, i);
+
+	while (n > 0)
+	{
+		DedupRun   *run = heap[0];
+		Size		size = (Size) run->record.keyLen + run->record.rowLen;
+
+		/* Take the smallest key, then the other versions of it */
+		if (size > bestSize)
+		{
+			TrackedFree(bestData);
+			bestSize = Max(size, 1024);
+			bestData = KeyTableAlloc(bestSize);
+		}
+		best = run->record;
+		memcpy(bestData, run->data, size);
+
+		for (;;)
+		{
+			if (!DedupRunNext(run))
+				heap[0] = heap[--n];
+			DedupSiftDown(heap, n, 0);
+
+			if (n == 0 ||
+				KeyCompare(heap[0]->data, heap[0]->record.keyLen,
+						   bestData, best.keyLen) != 0)
+				break;
+
+			run = heap[0];
+			dumpStats.dedupSuperseded++;
+			if (DedupNewer(&run->record.version, &best.version))
+			{
+				size = (Size) run->record.keyLen + run->record.rowLen;
+				if (size > bestSize)
+				{
+					TrackedFree(bestData);
+					bestSize = size;
+					bestData = KeyTableAlloc(bestSize);
+				}
+				best = run->record;
+				memcpy(bestData, run->data, size);
+			}
+		}
+
+		CopyOutputRow(bestData + best.keyLen, best.rowLen);
+		dumpStats.dedupRows++;
+	}
+
+	TrackedFree(bestData);
+	TrackedFree(heap);
+	for (i = 0; i < dedupNumRuns; i++)
+	{
+		fclose(dedupRuns[i].file);
+		TrackedFree(dedupRuns[i].data);
+	}
+	TrackedFree(dedupRuns);
+	dedupRuns = NULL;
+	dedupNumRuns = 0;
+}
+
+/*
+ * Output the newest version of each key, sorted by key, once all rows
+ * were decoded.
+ */
+void
+DedupFinish(void)
+{
+	if (dedupNumRuns > 0)
+	{
+		/* Spill the rest so that all rows are merged from runs */
+		if (dedupTable.numEntries > 0)
+			DedupSpill();
+		DedupMergeRuns();
+	}
+	else
+	{
+		uint32		count;
+		KeyEntry  **entries = KeyTableTake(&dedupTable, &count);
+		uint32		i;
+
+		for (i = 0; i < count; i++)
+		{
+			DedupEntry *entry = KeyEntryContainer(DedupEntry, entry, entries[i]);
+
+			CopyOutputRow(KeyEntryKey(&entry->entry) + entry->entry.keyLen,
+						  entry->rowLen);
+			TrackedFree(entry);
+		}
+		TrackedFree(entries);
+		dumpStats.dedupRows += count;
+	}
+
+	FreeKeyBuffer(&dedupKey);
+}
@@ -0,0 +1,390 @@
+/*
+ * Foreign key check of two relations for pg_filedump
+ *
+ * With --fk-check, the given columns of the heap tuples decoded with -D
+ * are looked up among the keys of the referenced relation given with
+ * --fk-ref, a heap decoded with --fk-ref-types or a btree index on the
+ * referenced key, and the values without a match are reported instead of
+ * printing the tuples.  The keys of the smaller file are held in a hash
+ * set and the other file is streamed past it: either the referenced keys
+ * are loaded before the dump and probed by every referencing tuple, or the
+ * referencing keys are collected during the dump and those the referenced
+ * relation holds are marked once it is read afterwards.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+#include "decode.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/* Initial number of hash slots, a power of two */
+#define FK_INITIAL_SLOTS	1024
+
+/* Initial size of the memory holding the entries of a set */
+#define FK_INITIAL_ARENA	(64 * 1024)
+
+/* A key of a set, stored MAXALIGN'ed in its arena */
+typedef struct FkEntry
+{
+	uint32		hash;
+	uint32		keyLen;
+	uint64		count;			/* referencing tuples holding the key */
+	BlockNumber blkno;			/* first of them */
+	OffsetNumber offnum;
+	bool		matched;		/* found in the referenced relation */
+	char		key[FLEXIBLE_ARRAY_MEMBER];
+} FkEntry;
+
+#define FK_ENTRY_SIZE(keyLen)	MAXALIGN(offsetof(FkEntry, key) + (keyLen))
+
+/*
+ * Hash set of keys.  The entries are appended to a single arena, and the
+ * open addressing slots hold their arena offsets plus one, 0 being free.
+ */
+typedef struct FkSet
+{
+	char	   *arena;
+	Size		arenaUsed;
+	Size		arenaSize;
+	uint64	   *slots;
+	uint64		numSlots;
+	uint64		numEntries;
+} FkSet;
+
+/* --fk-check: 1-based columns of the COPY output referencing the key */
+int			fkKeys[MAX_KEY_COLUMNS];
+int			numFkKeys = 0;
+
+/* --fk-ref: heap or btree index file of the referenced relation */
+char	   *fkRefPath = NULL;
+
+/* --fk-ref-types: attribute types of the referenced relation */
+char	   *fkRefTypes = NULL;
+
+/* --fk-ref-key: columns of the referenced key, by default 1 to numFkKeys */
+int			fkRefKeys[MAX_KEY_COLUMNS];
+int			numFkRefKeys = 0;
+
+/* The referenced keys were loaded before the dump, being the smaller side */
+static bool refLoaded = false;
+
+/* Keys of the referenced relation, if loaded first */
+static FkSet referenced = {0};
+
+/* Keys of the referencing tuples; only those without a match if loaded */
+static FkSet referencing = {0};
+
+/* Key being built for a tuple */
+static KeyBuffer fkKey = {0};
+
+/* Counts of the report */
+static uint64 referencingTuples = 0;
+static uint64 fkNullKeys = 0;
+static uint64 referencedEntries = 0;
+static uint64 orphanTuples = 0;
+static uint64 orphanKeys = 0;
+static bool refError = false;
+
+/*
+ * Allocate memory counted by --stats and --max-memory.  The keys of the
+ * smaller side are all needed at once, so exceeding the budget is fatal.
+ */
+static void *
+FkRealloc(void *ptr, Size size, Size growth)
+{
+	ToastCacheRelease(growth);
+	if (!MemoryBudgetAllows(growth))
+	{
+		printf("Error: Keys of --fk-check exceed memory budget of %zu bytes.\n",
+			   maxMemory);
+		exit(1);
+	}
+
+	if ((ptr = TrackedRealloc(ptr, size)) == NULL)
+	{
+		perror("realloc");
+		exit(1);
+	}
+	return ptr;
+}
+
+static FkEntry *
+FkSetEntry(const FkSet *set, uint64 slot)
+{
+	return (FkEntry *) (set->arena + set->slots[slot] - 1);
+}
+
+/* Double the number of slots of a set */
+static void
+FkSetGrow(FkSet *set)
+{
+	uint64		newNumSlots = set->numSlots ? set->numSlots * 2 : FK_INITIAL_SLOTS;
+	uint64	   *newSlots = FkRealloc(NULL, newNumSlots * sizeof(uint64),
+									 newNumSlots * sizeof(uint64));
+	uint64		i;
+
+	memset(newSlots, 0, newNumSlots * sizeof(uint64));
+
+	for (i = 0; i < set->numSlots; i++)
+	{
+		uint64		slot;
+
+		if (set->slots[i] == 0)
+			continue;
+
+		slot = FkSetEntry(set, i)->hash & (newNumSlots - 1);
+		while (newSlots[slot] != 0)
+			slot = (slot + 1) & (newNumSlots - 1);
+		newSlots[slot] = set->slots[i];
+	}
+
+	TrackedFree(set->slots);
+	set->slots = newSlots;
+	set->numSlots = newNumSlots;
+}
+
+/*
+ * Find a key in a set.  If it is not there, it is added when add is set,
+ * with a zero count, or NULL is returned.
+ */
+static FkEntry *
+FkSetLookup(FkSet *set, const char *key, uint32 keyLen, uint32 hash, bool add)
+{
+	FkEntry    *entry;
+	uint64		slot;
+	Size		size;
+
+	/* Keep the slots at most half full */
+	if (add && set->numEntries * 2 >= set->numSlots)
+		FkSetGrow(set);
+
+	if (set->numSlots == 0)
+		return NULL;
+
+	for (slot = hash & (set->numSlots - 1); set->slots[slot] != 0;
+		 slot = (slot + 1) & (set->numSlots - 1))
+	{
+		entry = FkSetEntry(set, slot);
+		if (entry->hash == hash && entry->keyLen == keyLen &&
+			memcmp(entry->key, key, keyLen) == 0)
+			return entry;
+	}
+
+	if (!add)
+		return NULL;
+
+	size = FK_ENTRY_SIZE(keyLen);
+	if (set->arenaUsed + size > set->arenaSize)
+	{
+		Size		arenaSize = Max(set->arenaSize * 2, FK_INITIAL_ARENA);
+
+		while (arenaSize < set->arenaUsed + size)
+			arenaSize *= 2;
+		set->arena = FkRealloc(set->arena, arenaSize,
+							   arenaSize - set->arenaSize);
+		set->arenaSize = arenaSize;
+	}
+
+	entry = (FkEntry *) (set->arena + set->arenaUsed);
+	memset(entry, 0, offsetof(FkEntry, key));
+	entry->hash = hash;
+	entry->keyLen = keyLen;
+	memcpy(entry->key, key, keyLen);
+
+	set->slots[slot] = set->arenaUsed + 1;
+	set->arenaUsed += size;
+	set->numEntries++;
+
+	return entry;
+}
+
+static void
+FkSetFree(FkSet *set)
+{
+	TrackedFree(set->arena);
+	TrackedFree(set->slots);
+	memset(set, 0, sizeof(FkSet));
+}
+
+/* Take a key of the referenced relation read by ScanRelationKeys() */
+static void
+FkAddReferencedKey(const char *key, int len, uint64 entries,
+				   BlockNumber blkno, OffsetNumber offnum)
+{
+	FkEntry    *entry;
+
+	referencedEntries += entries;
+	if (key == NULL)
+		return;
+
+	if (refLoaded)
+		FkSetLookup(&referenced, key, len, KeyHash(key, len), true);
+	else if ((entry = FkSetLookup(&referencing, key, len, KeyHash(key, len),
+								  false)) != NULL)
+		entry->matched = true;
+}
+
+/* Read the keys of the referenced relation, decoded with its own types */
+static int
+FkReadReferenced(void)
+{
+	int			rc;
+
+	SwapAttributeTypes();
+	rc = ScanRelationKeys(fkRefPath, fkRefKeys, numFkRefKeys,
+						  FkAddReferencedKey);
+	SwapAttributeTypes();
+
+	if (rc != 0)
+		refError = true;
+	return rc;
+}
+
+/*
+ * Load the keys of the referenced relation before the dump if its file is
+ * not larger than the one dumped.  Returns -1 after printing an error if
+ * the referenced file cannot be found.
+ */
+int
+FkCheckStart(void)
+{
+	struct stat refStat;
+	struct stat fileStat;
+
+	if (stat(fkRefPath, &refStat) != 0)
+	{
+		printf("Error: Could not open file <%s>: %s.\n", fkRefPath,
+			   strerror(errno));
+		return -1;
+	}
+
+	if (stat(fileName, &fileStat) == 0 && refStat.st_size > fileStat.st_size)
+		return 0;
+
+	refLoaded = true;
+	FkReadReferenced();
+	return 0;
+}
+
+/*
+ * Decode a heap tuple and look its key up, unless the inserting transaction
+ * is marked aborted by the hint bits.  Tuples with a NULL key column
+ * reference nothing and are only counted.
+ */
+void
+FkCheckCollect(const char *tupleData, unsigned int tupleSize,
+			   BlockNumber blkno, OffsetNumber offnum)
+{
+	FkEntry    *entry;
+	const char *row;
+	int			len;
+	int			keyLen;
+	uint32		hash;
+
+	if (HeapTupleHeaderXminInvalid((HeapTupleHeader) tupleData))
+		return;
+
+	if ((row = DecodeRow(tupleData, tupleSize, &len)) == NULL)
+		return;
+	referencingTuples++;
+
+	keyLen = BuildRowKey(&fkKey, row, len, fkKeys, numFkKeys);
+	if (keyLen < 0)
+	{
+		fkNullKeys++;
+		return;
+	}
+
+	hash = KeyHash(fkKey.data, keyLen);
+	if (refLoaded &&
+		FkSetLookup(&referenced, fkKey.data, keyLen, hash, false) != NULL)
+		return;
+
+	entry = FkSetLookup(&referencing, fkKey.data, keyLen, hash, true);
+	if (entry->count++ == 0)
+	{
+		entry->blkno = blkno;
+		entry->offnum = offnum;
+	}
+}
+
+static int
+FkEntryCompare(const void *a, const void *b)
+{
+	const FkEntry *e1 = *(const FkEntry *const *) a;
+	const FkEntry *e2 = *(const FkEntry *const *) b;
+
+	return KeyCompare(e1->key, e1->keyLen, e2->key, e2->keyLen);
+}
+
+/*
+ * Report the referencing keys missing from the referenced relation, sorted,
+ * reading it now if it was not loaded before the dump.  Returns 1 if any
+ * were found or the referenced relation could not be read.
+ */
+int
+FkCheckReport(void)
+{
+	FkEntry   **orphans;
+	Size		offset;
+	uint64		n = 0;
+	uint64		i;
+
+	printf("\n*** Foreign Key Check ***\n");
+
+	if (!refLoaded)
+		FkReadReferenced();
+
+	orphans = TrackedAlloc(Max(referencing.numEntries, 1) * sizeof(FkEntry *));
+	if (orphans == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	for (offset = 0; offset < referencing.arenaUsed;)
+	{
+		FkEntry    *entry = (FkEntry *) (referencing.arena + offset);
+
+		if (!entry->matched)
+			orphans[n++] = entry;
+		offset += FK_ENTRY_SIZE(entry->keyLen);
+	}
+
+	qsort(orphans, n, sizeof(FkEntry *), FkEntryCompare);
+
+	for (i = 0; i < n; i++)
+	{
+		FkEntry    *entry = orphans[i];
+
+		printf("Key (");
+		PrintKey(entry->key, entry->keyLen);
+		if (entry->count == 1)
+			printf(") of the tuple at (%u,%u)", entry->blkno, entry->offnum);
+		else
+			printf(") of " UINT64_FORMAT " tuples, the first at (%u,%u),",
+				   entry->count, entry->blkno, entry->offnum);
+		printf(" not in the referenced relation\n");
+
+		orphanKeys++;
+		orphanTuples += entry->count;
+	}
+
+	printf("Referencing tuples:    " UINT64_FORMAT "\n"
+		   "Tuples with NULL keys: " UINT64_FORMAT "\n"
+		   "Referenced entries:    " UINT64_FORMAT "\n"
+		   "Orphaned keys:         " UINT64_FORMAT "\n"
+		   "Orphaned tuples:       " UINT64_FORMAT "\n",
+		   referencingTuples, fkNullKeys, referencedEntries, orphanKeys,
+		   orphanTuples);
+
+	TrackedFree(orphans);
+	FkSetFree(&referenced);
+	FkSetFree(&referencing);
+	FreeKeyBuffer(&fkKey);
+
+	return (orphanTuples > 0 || refError) ? 1 : 0;
+}
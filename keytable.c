@@ -0,0 +1,216 @@
+/*
+ * Key tables and spill files for pg_filedump
+ *
+ * --dedup-key and --unique-check aggregate rows by the values of some of
+ * their columns in a chained hash table, and once it outgrows its memory
+ * write its entries, sorted by key, to temporary files.  The entries are
+ * structs of the caller ending in a KeyEntry, which the key follows.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+#include "decode.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+/* Initial number of hash buckets, a power of two */
+#define KEY_TABLE_INITIAL_BUCKETS	1024
+
+/* Allocate memory counted by --stats and --max-memory */
+void *
+KeyTableAlloc(Size size)
+{
+	void	   *ptr = TrackedAlloc(size);
+
+	if (ptr == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	return ptr;
+}
+
+void *
+KeyTableRealloc(void *ptr, Size size)
+{
+	if ((ptr = TrackedRealloc(ptr, size)) == NULL)
+	{
+		perror("realloc");
+		exit(1);
+	}
+	return ptr;
+}
+
+/* Double the number of buckets of a table */
+static void
+KeyTableGrow(KeyTable *table)
+{
+	uint32		newNumBuckets = table->numBuckets ? table->numBuckets * 2 :
+		KEY_TABLE_INITIAL_BUCKETS;
+	KeyEntry  **newBuckets = KeyTableAlloc(newNumBuckets * sizeof(KeyEntry *));
+	uint32		i;
+
+	memset(newBuckets, 0, newNumBuckets * sizeof(KeyEntry *));
+	for (i = 0; i < table->numBuckets; i++)
+	{
+		KeyEntry   *entry = table->buckets[i];
+
+		while (entry != NULL)
+		{
+			KeyEntry   *next = entry->next;
+			KeyEntry  **bucket = &newBuckets[entry->hash & (newNumBuckets - 1)];
+
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	TrackedFree(table->buckets);
+	table->memoryUsed += (Size) (newNumBuckets - table->numBuckets) *
+		sizeof(KeyEntry *);
+	table->buckets = newBuckets;
+	table->numBuckets = newNumBuckets;
+}
+
+/*
+ * Find the entry of a key.  Returns the link pointing to it, or the NULL
+ * link at the end of its bucket to pass to KeyTableInsert().
+ */
+KeyEntry  **
+KeyTableFind(KeyTable *table, const char *key, uint32 keyLen, uint32 hash)
+{
+	KeyEntry  **link;
+
+	if (table->numEntries >= table->numBuckets)
+		KeyTableGrow(table);
+
+	for (link = &table->buckets[hash & (table->numBuckets - 1)];
+		 *link != NULL; link = &(*link)->next)
+	{
+		if ((*link)->hash == hash && (*link)->keyLen == keyLen &&
+			memcmp(KeyEntryKey(*link), key, keyLen) == 0)
+			break;
+	}
+	return link;
+}
+
+/*
+ * Add an entry of size bytes, allocated with KeyTableAlloc(), at the link
+ * returned by KeyTableFind() for its key, and copy the key after it.
+ */
+void
+KeyTableInsert(KeyTable *table, KeyEntry **link, KeyEntry *entry,
+			   const char *key, uint32 keyLen, uint32 hash, Size size)
+{
+	entry->next = NULL;
+	entry->hash = hash;
+	entry->keyLen = keyLen;
+	memcpy(KeyEntryKey(entry), key, keyLen);
+
+	*link = entry;
+	table->numEntries++;
+	table->memoryUsed += size;
+}
+
+/*
+ * Does a table hold more than limit bytes?  The memory in use also holds
+ * the row being decoded and its TOAST values, so a table only takes a
+ * share of --max-memory.
+ */
+bool
+KeyTableFull(const KeyTable *table, Size limit)
+{
+	return table->memoryUsed > MemoryBudgetShare(limit);
+}
+
+static int
+KeyEntryCompare(const void *a, const void *b)
+{
+	const KeyEntry *e1 = *(const KeyEntry *const *) a;
+	const KeyEntry *e2 = *(const KeyEntry *const *) b;
+
+	return KeyCompare(KeyEntryKey(e1), e1->keyLen,
+					  KeyEntryKey(e2), e2->keyLen);
+}
+
+/*
+ * Take the entries out of a table, sorted by key, and free its buckets.
+ * The caller frees the entries and the array.
+ */
+KeyEntry  **
+KeyTableTake(KeyTable *table, uint32 *count)
+{
+	KeyEntry  **entries = KeyTableAlloc(Max(table->numEntries, 1) *
+										sizeof(KeyEntry *));
+	uint32		n = 0;
+	uint32		i;
+
+	for (i = 0; i < table->numBuckets; i++)
+	{
+		KeyEntry   *entry;
+
+		for (entry = table->buckets[i]; entry != NULL; entry = entry->next)
+			entries[n++] = entry;
+	}
+
+	qsort(entries, n, sizeof(KeyEntry *), KeyEntryCompare);
+
+	TrackedFree(table->buckets);
+	memset(table, 0, sizeof(KeyTable));
+
+	*count = n;
+	return entries;
+}
+
+static void
+SpillFileWriteError(void)
+{
+	printf("Error: Unable to write a temporary file: %s\n", strerror(errno));
+	exit(1);
+}
+
+FILE *
+SpillFileCreate(void)
+{
+	FILE	   *file = tmpfile();
+
+	if (file == NULL)
+		SpillFileWriteError();
+	return file;
+}
+
+void
+SpillFileWrite(FILE *file, const void *data, Size size)
+{
+	if (size > 0 && fwrite(data, size, 1, file) != 1)
+		SpillFileWriteError();
+}
+
+/* Flush a spill file and go back to its start to read it */
+void
+SpillFileRewind(FILE *file)
+{
+	if (fflush(file) != 0)
+		SpillFileWriteError();
+	rewind(file);
+}
+
+/* Read the header of the next record of a spill file, false at its end */
+bool
+SpillFileNext(FILE *file, void *header, Size size)
+{
+	return fread(header, size, 1, file) == 1;
+}
+
+/* Read the rest of a record */
+void
+SpillFileRead(FILE *file, void *data, Size size)
+{
+	if (size > 0 && fread(data, size, 1, file) != 1)
+	{
+		printf("Error: Unable to read a temporary file.\n");
+		exit(1);
+	}
+}
@@ -0,0 +1,166 @@
+/*
+ * Memory accounting for pg_filedump
+ *
+ * All buffers whose size depends on the data being dumped (COPY lines,
+ * TOAST values, decompression buffers) are allocated here, so that the
+ * amount of memory in use can be reported by --stats and held under the
+ * budget given with --max-memory.  Each allocation is prefixed by a small
+ * header recording its size.  TOAST values are read and decompressed by
+ * worker threads too, so the counters are protected by a mutex.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Size of the header in front of every tracked allocation */
+#define TRACKED_HEADER_SIZE		MAXALIGN(sizeof(Size))
+
+/* Memory budget in bytes, 0 means unlimited */
+Size		maxMemory = 0;
+
+/* Bytes currently allocated, highest value seen and total ever allocated */
+static Size memoryInUse = 0;
+static Size memoryPeak = 0;
+static Size memoryTotal = 0;
+
+static pthread_mutex_t memoryLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Account for an allocation of size bytes replacing one of oldSize bytes */
+static void
+AccountAlloc(Size size, Size oldSize)
+{
+	pthread_mutex_lock(&memoryLock);
+	memoryInUse += size - oldSize;
+	memoryTotal += size;
+	if (memoryInUse > memoryPeak)
+		memoryPeak = memoryInUse;
+	pthread_mutex_unlock(&memoryLock);
+}
+
+/*
+ * Allocate size bytes.  Returns NULL if the allocation failed, the budget
+ * is not checked here; callers of large-value paths should consult
+ * MemoryBudgetAllows() first.
+ */
+void *
+TrackedAlloc(Size size)
+{
+	char	   *ptr = malloc(TRACKED_HEADER_SIZE + size);
+
+	if (ptr == NULL)
+		return NULL;
+
+	*(Size *) ptr = size;
+	AccountAlloc(size, 0);
+
+	return ptr + TRACKED_HEADER_SIZE;
+}
+
+/*
+ * Resize an allocation made by TrackedAlloc().  On failure NULL is returned
+ * and the old allocation is left untouched.
+ */
+void *
+TrackedRealloc(void *ptr, Size size)
+{
+	char	   *base;
+	Size		oldSize;
+
+	if (ptr == NULL)
+		return TrackedAlloc(size);
+
+	base = (char *) ptr - TRACKED_HEADER_SIZE;
+	oldSize = *(Size *) base;
+
+	base = realloc(base, TRACKED_HEADER_SIZE + size);
+	if (base == NULL)
+		return NULL;
+
+	*(Size *) base = size;
+	AccountAlloc(size, oldSize);
+
+	return base + TRACKED_HEADER_SIZE;
+}
+
+void
+TrackedFree(void *ptr)
+{
+	char	   *base;
+
+	if (ptr == NULL)
+		return;
+
+	base = (char *) ptr - TRACKED_HEADER_SIZE;
+	pthread_mutex_lock(&memoryLock);
+	memoryInUse -= *(Size *) base;
+	pthread_mutex_unlock(&memoryLock);
+	free(base);
+}
+
+/* Check whether size more bytes may be allocated without exceeding the budget */
+bool
+MemoryBudgetAllows(Size size)
+{
+	bool		allows;
+
+	if (maxMemory == 0)
+		return true;
+
+	pthread_mutex_lock(&memoryLock);
+	allows = size <= maxMemory && memoryInUse <= maxMemory - size;
+	pthread_mutex_unlock(&memoryLock);
+
+	return allows;
+}
+
+/*
+ * Limit for memory held across rows, such as the tables of --dedup-key and
+ * --unique-check: the given limit, but at most half of the budget, so that
+ * the other half is left for decoding the rows.
+ */
+Size
+MemoryBudgetShare(Size limit)
+{
+	if (maxMemory != 0 && limit > maxMemory / 2)
+		return maxMemory / 2;
+	return limit;
+}
+
+Size
+MemoryInUse(void)
+{
+	Size		inUse;
+
+	pthread_mutex_lock(&memoryLock);
+	inUse = memoryInUse;
+	pthread_mutex_unlock(&memoryLock);
+
+	return inUse;
+}
+
+Size
+MemoryPeak(void)
+{
+	Size		peak;
+
+	pthread_mutex_lock(&memoryLock);
+	peak = memoryPeak;
+	pthread_mutex_unlock(&memoryLock);
+
+	return peak;
+}
+
+Size
+MemoryTotal(void)
+{
+	Size		total;
+
+	pthread_mutex_lock(&memoryLock);
+	total = memoryTotal;
+	pthread_mutex_unlock(&memoryLock);
+
+	return total;
+}
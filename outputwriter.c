@@ -0,0 +1,543 @@
+/*
+ * Compressed and split output for pg_filedump
+ *
+ * Formatted dumps are many times the size of the relation, so with
+ * --compress the output is compressed with zstd, lz4 or gzip, and with
+ * --split-size it is written to numbered files of a bounded size.  Both
+ * are done by a writer thread: stdout is redirected into a pipe that the
+ * formatting code fills as before, while the writer thread reads it in
+ * chunks, compresses them and writes them out.  Each split file holds a
+ * complete compressed stream of its own.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* Bytes read from the pipe and compressed at a time */
+#define OUTPUT_CHUNK_SIZE		(256 * 1024)
+
+/* Size of the stdio buffer of the redirected stdout */
+#define OUTPUT_STDIO_BUFFER		(256 * 1024)
+
+/* --compress: compression of the output */
+int			outputCompression = OUTPUT_COMPRESS_NONE;
+
+/* --split-size: largest size of an output file, 0 does not split */
+uint64		outputSplitSize = 0;
+
+/* --output: file written instead of stdout */
+char	   *outputPath = NULL;
+
+/*
+ * A compression method.  A stream is started with begin, fed by compress
+ * and finished by end, each passing what it produces to OutputSinkWrite().
+ * compress flushes what it is given, so that the size written so far is
+ * known, and bound is the most that compressing and ending a stream with
+ * that many more input bytes can add.
+ */
+typedef struct OutputCodec
+{
+	bool		(*begin) (void);
+	bool		(*compress) (const char *data, size_t len);
+	bool		(*end) (void);
+	uint64		(*bound) (uint64 len);
+} OutputCodec;
+
+static const OutputCodec *codec = NULL;
+
+/* Pipe carrying stdout to the writer thread */
+static int	pipeRead = -1;
+
+/* Where the writer thread writes, stdout or the current file */
+static int	sinkFd = -1;
+static unsigned int sinkNumber = 0;
+static uint64 sinkBytes = 0;
+
+/* Compressed stream of the current file */
+static bool streamOpen = false;
+
+/* Buffer for compressed data */
+static char *compressBuffer = NULL;
+static size_t compressBufferSize = 0;
+
+static pthread_t writerThread;
+static bool writerStarted = false;
+static int	writerErrno = 0;
+
+/* Write all of a buffer to the current output */
+static bool
+OutputSinkWrite(const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t		written = write(sinkFd, data, len);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			writerErrno = errno;
+			return false;
+		}
+		data += written;
+		len -= written;
+		sinkBytes += written;
+	}
+
+	return true;
+}
+
+/* Close the current split file, if any, and open the next one */
+static bool
+OutputSinkNext(void)
+{
+	char		path[MAXPGPATH];
+
+	if (sinkFd >= 0 && close(sinkFd) != 0)
+	{
+		writerErrno = errno;
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s.%03u", outputPath, sinkNumber++);
+	sinkFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	sinkBytes = 0;
+	if (sinkFd < 0)
+	{
+		writerErrno = errno;
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef USE_ZSTD
+static ZSTD_CCtx *zstdContext = NULL;
+
+static bool
+ZstdBegin(void)
+{
+	if (zstdContext == NULL)
+		zstdContext = ZSTD_createCCtx();
+	return zstdContext != NULL;
+}
+
+static bool
+ZstdStream(const char *data, size_t len, ZSTD_EndDirective mode)
+{
+	ZSTD_inBuffer in = {data, len, 0};
+	size_t		remaining;
+
+	do
+	{
+		ZSTD_outBuffer out = {compressBuffer, compressBufferSize, 0};
+
+		remaining = ZSTD_compressStream2(zstdContext, &out, &in, mode);
+		if (ZSTD_isError(remaining))
+		{
+			writerErrno = EIO;
+			return false;
+		}
+		if (!OutputSinkWrite(compressBuffer, out.pos))
+			return false;
+	} while (in.pos < in.size || remaining > 0);
+
+	return true;
+}
+
+static bool
+ZstdCompress(const char *data, size_t len)
+{
+	return ZstdStream(data, len, ZSTD_e_flush);
+}
+
+static bool
+ZstdEnd(void)
+{
+	return ZstdStream(NULL, 0, ZSTD_e_end);
+}
+
+static uint64
+ZstdBound(uint64 len)
+{
+	return ZSTD_compressBound(len);
+}
+
+static const OutputCodec zstdCodec = {ZstdBegin, ZstdCompress, ZstdEnd, ZstdBound};
+#endif
+
+#ifdef USE_LZ4
+static LZ4F_cctx *lz4Context = NULL;
+
+static bool
+Lz4Result(size_t result)
+{
+	if (LZ4F_isError(result))
+	{
+		writerErrno = EIO;
+		return false;
+	}
+	return OutputSinkWrite(compressBuffer, result);
+}
+
+static bool
+Lz4Begin(void)
+{
+	if (lz4Context == NULL &&
+		LZ4F_isError(LZ4F_createCompressionContext(&lz4Context, LZ4F_VERSION)))
+		return false;
+	return Lz4Result(LZ4F_compressBegin(lz4Context, compressBuffer,
+										compressBufferSize, NULL));
+}
+
+static bool
+Lz4Compress(const char *data, size_t len)
+{
+	return Lz4Result(LZ4F_compressUpdate(lz4Context, compressBuffer,
+										 compressBufferSize, data, len, NULL)) &&
+		Lz4Result(LZ4F_flush(lz4Context, compressBuffer, compressBufferSize,
+							 NULL));
+}
+
+static bool
+Lz4End(void)
+{
+	return Lz4Result(LZ4F_compressEnd(lz4Context, compressBuffer,
+									  compressBufferSize, NULL));
+}
+
+static uint64
+Lz4Bound(uint64 len)
+{
+	return LZ4F_compressFrameBound(len, NULL);
+}
+
+static const OutputCodec lz4Codec = {Lz4Begin, Lz4Compress, Lz4End, Lz4Bound};
+#endif
+
+#ifdef HAVE_LIBZ
+static z_stream gzipStream;
+static bool gzipStreamInit = false;
+
+static bool
+GzipDeflate(const char *data, size_t len, int flush)
+{
+	int			rc;
+
+	gzipStream.next_in = (Bytef *) data;
+	gzipStream.avail_in = len;
+
+	do
+	{
+		gzipStream.next_out = (Bytef *) compressBuffer;
+		gzipStream.avail_out = compressBufferSize;
+
+		rc = deflate(&gzipStream, flush);
+		if (rc == Z_STREAM_ERROR)
+		{
+			writerErrno = EIO;
+			return false;
+		}
+		if (!OutputSinkWrite(compressBuffer,
+							 compressBufferSize - gzipStream.avail_out))
+			return false;
+	} while (gzipStream.avail_out == 0 ||
+			 (flush == Z_FINISH && rc != Z_STREAM_END));
+
+	return true;
+}
+
+static bool
+GzipBegin(void)
+{
+	if (gzipStreamInit)
+		return deflateReset(&gzipStream) == Z_OK;
+
+	/* 16 added to the window bits asks for a gzip header and trailer */
+	if (deflateInit2(&gzipStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+					 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	gzipStreamInit = true;
+	return true;
+}
+
+static bool
+GzipCompress(const char *data, size_t len)
+{
+	return GzipDeflate(data, len, Z_SYNC_FLUSH);
+}
+
+static bool
+GzipEnd(void)
+{
+	return GzipDeflate(NULL, 0, Z_FINISH);
+}
+
+static uint64
+GzipBound(uint64 len)
+{
+	/* Allow for the marker of the sync flush */
+	return deflateBound(&gzipStream, len) + 16;
+}
+
+static const OutputCodec gzipCodec = {GzipBegin, GzipCompress, GzipEnd, GzipBound};
+#endif
+
+/* Write a chunk of output, starting the next split file when it would
+ * not fit into the current one */
+static bool
+OutputWriteChunk(const char *data, size_t len)
+{
+	if (codec == NULL)
+	{
+		while (len > 0)
+		{
+			size_t		part = len;
+
+			if (outputSplitSize > 0)
+			{
+				if (sinkBytes == outputSplitSize && !OutputSinkNext())
+					return false;
+				part = Min(len, outputSplitSize - sinkBytes);
+			}
+
+			if (!OutputSinkWrite(data, part))
+				return false;
+			data += part;
+			len -= part;
+		}
+		return true;
+	}
+
+	/* This chunk could make the file outgrow the split size: finish the
+	 * stream and start another one in the next file */
+	if (outputSplitSize > 0 && streamOpen &&
+		sinkBytes + codec->bound(len) > outputSplitSize)
+	{
+		if (!codec->end() || !OutputSinkNext())
+			return false;
+		streamOpen = false;
+	}
+
+	if (!streamOpen)
+	{
+		if (!codec->begin())
+		{
+			writerErrno = ENOMEM;
+			return false;
+		}
+		streamOpen = true;
+	}
+
+	return codec->compress(data, len);
+}
+
+/* Read the redirected stdout until it is closed and write it out */
+static void *
+OutputWriterMain(void *arg)
+{
+	char	   *chunk = malloc(OUTPUT_CHUNK_SIZE);
+	bool		ok = (chunk != NULL);
+
+	if (!ok)
+		writerErrno = ENOMEM;
+
+	while (ok)
+	{
+		ssize_t		len = read(pipeRead, chunk, OUTPUT_CHUNK_SIZE);
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			writerErrno = errno;
+			ok = false;
+		}
+		else if (len == 0)
+			break;
+		else
+			ok = OutputWriteChunk(chunk, len);
+	}
+
+	if (ok && codec != NULL && streamOpen)
+		ok = codec->end();
+
+	/* Keep draining the pipe after an error so the dump can finish */
+	if (!ok && chunk != NULL)
+		while (read(pipeRead, chunk, OUTPUT_CHUNK_SIZE) > 0)
+			;
+
+	free(chunk);
+	return NULL;
+}
+
+/* Flush the output and wait for the writer thread, at exit */
+static void
+OutputWriterFinish(void)
+{
+	if (!writerStarted)
+		return;
+	writerStarted = false;
+
+	fflush(stdout);
+	close(STDOUT_FILENO);
+	pthread_join(writerThread, NULL);
+
+	if (sinkFd >= 0 && sinkFd != STDOUT_FILENO && close(sinkFd) != 0 &&
+		writerErrno == 0)
+		writerErrno = errno;
+
+	if (writerErrno != 0)
+	{
+		fprintf(stderr, "Error: Unable to write output: %s.\n",
+				strerror(writerErrno));
+		_exit(1);
+	}
+}
+
+/*
+ * Check that the method given to --compress is one pg_filedump was built
+ * with.  Returns -1 for unknown or unsupported methods.
+ */
+int
+OutputCompressionMethod(const char *name)
+{
+	if (strcmp(name, "zstd") == 0)
+	{
+#ifdef USE_ZSTD
+		return OUTPUT_COMPRESS_ZSTD;
+#endif
+	}
+	else if (strcmp(name, "lz4") == 0)
+	{
+#ifdef USE_LZ4
+		return OUTPUT_COMPRESS_LZ4;
+#endif
+	}
+	else if (strcmp(name, "gzip") == 0)
+	{
+#ifdef HAVE_LIBZ
+		return OUTPUT_COMPRESS_GZIP;
+#endif
+	}
+
+	return -1;
+}
+
+/*
+ * Redirect stdout to the writer thread if --compress, --split-size or
+ * --output was given.  Returns 0 on success, or -1 after printing an error.
+ */
+int
+OutputWriterStart(void)
+{
+	int			fds[2];
+	int			outFd;
+
+	if (outputCompression == OUTPUT_COMPRESS_NONE && outputPath == NULL)
+		return 0;
+
+	switch (outputCompression)
+	{
+#ifdef USE_ZSTD
+		case OUTPUT_COMPRESS_ZSTD:
+			codec = &zstdCodec;
+			compressBufferSize = ZSTD_CStreamOutSize();
+			break;
+#endif
+#ifdef USE_LZ4
+		case OUTPUT_COMPRESS_LZ4:
+			codec = &lz4Codec;
+			compressBufferSize = LZ4F_compressBound(OUTPUT_CHUNK_SIZE, NULL) +
+				LZ4F_HEADER_SIZE_MAX;
+			break;
+#endif
+#ifdef HAVE_LIBZ
+		case OUTPUT_COMPRESS_GZIP:
+			codec = &gzipCodec;
+			compressBufferSize = OUTPUT_CHUNK_SIZE;
+			break;
+#endif
+		default:
+			break;
+	}
+
+	if (codec != NULL && (compressBuffer = malloc(compressBufferSize)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	/* The first file is opened before anything is written to it */
+	if (outputSplitSize > 0)
+	{
+		if (!OutputSinkNext())
+		{
+			printf("Error: Unable to create output file <%s.000>: %s.\n",
+				   outputPath, strerror(writerErrno));
+			return -1;
+		}
+	}
+	else if (outputPath != NULL)
+	{
+		if ((sinkFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC,
+						   0666)) < 0)
+		{
+			printf("Error: Unable to create output file <%s>: %s.\n",
+				   outputPath, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* Keep the real stdout for the writer thread unless writing files */
+	fflush(stdout);
+	if ((outFd = dup(STDOUT_FILENO)) < 0 || pipe(fds) != 0)
+	{
+		printf("Error: Unable to redirect output: %s.\n", strerror(errno));
+		return -1;
+	}
+	if (sinkFd < 0)
+		sinkFd = outFd;
+	else
+		close(outFd);
+
+	if (dup2(fds[1], STDOUT_FILENO) < 0)
+	{
+		printf("Error: Unable to redirect output: %s.\n", strerror(errno));
+		return -1;
+	}
+	close(fds[1]);
+	pipeRead = fds[0];
+
+#ifdef F_SETPIPE_SZ
+	/* A larger pipe lets the formatting run further ahead of the writer */
+	(void) fcntl(pipeRead, F_SETPIPE_SZ, 1024 * 1024);
+#endif
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_STDIO_BUFFER);
+
+	if (pthread_create(&writerThread, NULL, OutputWriterMain, NULL) != 0)
+	{
+		fprintf(stderr, "Error: Unable to start the output writer thread.\n");
+		exit(1);
+	}
+	writerStarted = true;
+	atexit(OutputWriterFinish);
+
+	return 0;
+}
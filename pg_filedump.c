@@ -57,7 +57,7 @@ unsigned int controlOptions = 0;
 
 unsigned int specialType = SPEC_SECT_NONE;
 
-static bool verbose = false;
+bool		verbose = false;
 
 /* File to dump or format */
 FILE *fp = NULL;
@@ -89,6 +89,68 @@ static bool isRelMapFile = false;
 /* Program exit code */
 static int	exitCode = 0;
 
+/* --stats: print a summary after dumping */
+static bool showStats = false;
+
+/* --toast-cache was given */
+static bool toastCacheSizeSet = false;
+
+/* --toast-workers was given */
+static bool toastWorkersSet = false;
+
+/* --output-format was given */
+static bool outputFormatSet = false;
+
+/* --dedup-by and --dedup-memory were given */
+static bool dedupBySet = false;
+static bool dedupMemorySet = false;
+
+/* --unique-memory was given */
+static bool uniqueMemorySet = false;
+
+/* --lp-state: bit (1 << state) set for each line pointer state to dump,
+ * 0 dumps all items */
+static unsigned int lpStateFilter = 0;
+
+/* Flags accepted by --infomask and printed by --output-format json */
+const InfomaskFlag infomaskFlags[] = {
+	{"HASNULL", HEAP_HASNULL, false},
+	{"HASVARWIDTH", HEAP_HASVARWIDTH, false},
+	{"HASEXTERNAL", HEAP_HASEXTERNAL, false},
+	{"XMAX_KEYSHR_LOCK", HEAP_XMAX_KEYSHR_LOCK, false},
+	{"COMBOCID", HEAP_COMBOCID, false},
+	{"XMAX_EXCL_LOCK", HEAP_XMAX_EXCL_LOCK, false},
+	{"XMAX_LOCK_ONLY", HEAP_XMAX_LOCK_ONLY, false},
+	{"XMIN_COMMITTED", HEAP_XMIN_COMMITTED, false},
+	{"XMIN_INVALID", HEAP_XMIN_INVALID, false},
+	{"FROZEN", HEAP_XMIN_FROZEN, false},
+	{"XMAX_COMMITTED", HEAP_XMAX_COMMITTED, false},
+	{"XMAX_INVALID", HEAP_XMAX_INVALID, false},
+	{"XMAX_IS_MULTI", HEAP_XMAX_IS_MULTI, false},
+	{"UPDATED", HEAP_UPDATED, false},
+	{"MOVED_OFF", HEAP_MOVED_OFF, false},
+	{"MOVED_IN", HEAP_MOVED_IN, false},
+	{"KEYS_UPDATED", HEAP_KEYS_UPDATED, true},
+	{"HOT_UPDATED", HEAP_HOT_UPDATED, true},
+	{"HEAP_ONLY", HEAP_ONLY_TUPLE, true},
+	{NULL, 0, false}
+};
+
+/* --infomask: flags heap tuples must have, or must not have if negated */
+typedef struct InfomaskPredicate
+{
+	const InfomaskFlag *flag;
+	bool		negate;
+} InfomaskPredicate;
+
+#define MAX_INFOMASK_PREDICATES 32
+
+static InfomaskPredicate infomaskPredicates[MAX_INFOMASK_PREDICATES];
+static int	numInfomaskPredicates = 0;
+
+/* Counters for --stats */
+DumpStats	dumpStats;
+
 /* Relmapper structs */
 typedef struct RelMapping
 {
@@ -115,6 +177,13 @@ unsigned int GetBlockSize(FILE *fp);
 static void DisplayOptions(unsigned int validOptions);
 static unsigned int ConsumeOptions(int numOptions, char **options);
 static int	GetOptionValue(char *optionString);
+static Size GetMemoryOptionValue(char *optionString);
+static int	ParseLpStateFilter(char *optionString);
+static int	ParseInfomaskFilter(char *optionString);
+static int	ParseColumnList(char *optionString, int *columns,
+		int *numColumns);
+static bool ItemPassesFilter(char *buffer, ItemId itemId,
+		unsigned int formatAs);
 static void FormatBlock(unsigned int blockOptions,
 		unsigned int controlOptions,
 		char *buffer,
@@ -126,6 +195,8 @@ static void FormatBlock(unsigned int blockOptions,
 		char *toastValue,
 		unsigned int *toastRead);
 static unsigned int GetSpecialSectionType(char *buffer, Page page);
+static unsigned int GetItemFormat(Page page);
+static bool IsPageHeaderValid(Page page, int maxOffset);
 static bool IsBtreeMetaPage(Page page);
 static void CreateDumpFileHeader(int numOptions, char **options);
 static int	FormatHeader(char *buffer,
@@ -139,6 +210,8 @@ static void FormatItemBlock(char *buffer,
 		unsigned int toastExternalSize,
 		char *toastValue,
 		unsigned int *toastRead);
+static void PrefetchToastValues(char *buffer, Page page, int maxOffset);
+static void EmitBlock(char *buffer, Page page, BlockNumber blkno);
 static void FormatItem(char *buffer,
 		unsigned int numBytes,
 		unsigned int startIndex,
@@ -149,6 +222,7 @@ static void FormatBinary(char *buffer,
 		unsigned int numBytes, unsigned int startIndex);
 static void DumpBinaryBlock(char *buffer);
 static int PrintRelMappings(void);
+static void PrintStats(void);
 
 
 /* Send properly formed usage information to the user. */
@@ -163,7 +237,7 @@ DisplayOptions(unsigned int validOptions)
 			 FD_VERSION, FD_PG_VERSION);
 
 	printf
-		("\nUsage: pg_filedump [-abcdfhikxy] [-R startblock [endblock]] [-D attrlist] [-S blocksize] [-s segsize] [-n segnumber] file\n\n"
+		("\nUsage: pg_filedump [-abcdfhikxy] [-R startblock [endblock]] [-D attrlist] [-S blocksize] [-s segsize] [-n segnumber] [--stats] [--max-memory size] [--toast-cache size] [--toast-workers n] [--toast-check] [--lp-state states] [--infomask flags] [--output-format format] [--compress method] [--split-size size] [--output file] [--copy-target conninfo --copy-table table] [--dedup-key columns] [--dedup-by order] [--dedup-memory size] [--unique-check columns] [--unique-index file] [--unique-memory size] [--fk-check columns --fk-ref file --fk-ref-types attrlist] [--fk-ref-key columns] file\n\n"
 		 "Display formatted contents of a PostgreSQL heap/index/control file\n"
 		 "Defaults are: relative addressing, range of the entire file, block\n"
 		 "               size as listed on block 0 in the file\n\n"
@@ -176,9 +250,19 @@ DisplayOptions(unsigned int validOptions)
 		 "      all other formatting options)\n"
 		 "  -D  Decode tuples using given comma separated list of types\n"
 		 "      Supported types:\n"
-		 "        bigint bigserial bool char charN date float float4 float8 int\n"
-		 "        json macaddr name numeric oid real serial smallint smallserial text\n"
-		 "        time timestamp timestamptz timetz uuid varchar varcharN xid xml\n"
+		 "        bigint bigserial bit bool bytea char charN cidr date enum float\n"
+		 "        float4 float8 inet int interval json jsonb macaddr money name numeric\n"
+		 "        oid real serial smallint smallserial text time timestamp timestamptz\n"
+		 "        timetz uuid varbit varchar varcharN xid xml\n"
+		 "      Arrays of these types are given as type[], e.g. int[]\n"
+		 "      Composite types are given as record(type,...), e.g.\n"
+		 "      record(int,text), and domains as their base type\n"
+		 "      skip:LEN:ALIGN skips and raw:LEN:ALIGN prints in hex an attribute\n"
+		 "      of any other type, given its typlen (-1 for varlena) and typalign\n"
+		 "      (c, s, i or d), e.g. skip:16:d for point\n"
+		 "      type:raw prints the bytes of an attribute in hex instead of decoding\n"
+		 "      it, :base64 prints them in base64 and :stored as stored in the\n"
+		 "      tuple, before decompression, e.g. text:raw:base64:stored\n"
 		 "      ~ ignores all attributes left in a tuple\n"
 		 "  -f  Display formatted block content dump along with interpretation\n"
 		 "  -h  Display this information\n"
@@ -196,7 +280,66 @@ DisplayOptions(unsigned int validOptions)
 		 "  -n  Force segment number to [segnumber]\n"
 		 "  -S  Force block size to [blocksize]\n"
 		 "  -x  Force interpreted formatting of block items as index items\n"
-		 "  -y  Force interpreted formatting of block items as heap items\n\n"
+		 "  -y  Force interpreted formatting of block items as heap items\n"
+		 "  --stats       Print block, item, tuple and memory statistics\n"
+		 "                at the end of the dump\n"
+		 "  --max-memory  Limit memory used for decoded values to [size]\n"
+		 "                (bytes, or with a kB, MB or GB suffix); larger\n"
+		 "                values are skipped with a warning\n"
+		 "  --toast-cache Keep up to [size] of TOAST values read with -t\n"
+		 "                for tuple versions sharing them (default 64MB,\n"
+		 "                0 disables the cache)\n"
+		 "  --toast-workers Read and decompress the TOAST values of\n"
+		 "                a page with -t in [n] threads (default the\n"
+		 "                number of CPUs up to 8, 0 reads them in turn)\n"
+		 "  --toast-check Check the TOAST values the tuples decoded with\n"
+		 "                -D point to for missing, short and duplicate\n"
+		 "                chunks, and report values no tuple points to\n"
+		 "  --lp-state    Only dump the items whose line pointers are in\n"
+		 "                one of the comma separated [states]: UNUSED,\n"
+		 "                NORMAL, REDIRECT or DEAD\n"
+		 "  --infomask    Only dump the heap tuples having all of the\n"
+		 "                comma separated [flags] of the -i output, or\n"
+		 "                not having those prefixed with !, e.g.\n"
+		 "                XMAX_IS_MULTI,!XMAX_INVALID.  FROZEN stands for\n"
+		 "                XMIN_COMMITTED and XMIN_INVALID\n"
+		 "  --output-format Print the page headers and items as [format]:\n"
+		 "                text (default), json for one JSON object per\n"
+		 "                line, or binary for length-prefixed records\n"
+		 "  --compress    Compress the output with [method]: zstd, lz4 or\n"
+		 "                gzip, if pg_filedump was built with it\n"
+		 "  --split-size  Write the output to files [file].000, [file].001,\n"
+		 "                ... of at most [size] (bytes, or with a kB, MB\n"
+		 "                or GB suffix; at least 1MB) each\n"
+		 "  --output      Write the output to [file] instead of stdout\n"
+		 "  --copy-target Copy the rows decoded with -D into a table of the\n"
+		 "                server at [conninfo] instead of printing them\n"
+		 "  --copy-table  Table, optionally with a column list, the rows\n"
+		 "                are copied into, e.g. \"t(a, c)\"\n"
+		 "  --dedup-key   Only output the newest version of the rows decoded\n"
+		 "                with -D per value of the comma separated\n"
+		 "                [columns], numbered from 1, sorted by them\n"
+		 "  --dedup-by    Order of versions for --dedup-key: xmin\n"
+		 "                (default) or lsn of their page\n"
+		 "  --dedup-memory Spill the rows kept by --dedup-key to disk\n"
+		 "                beyond [size] (default 256MB)\n"
+		 "  --unique-check Report the values of the comma separated\n"
+		 "                [columns] held by more than one tuple decoded\n"
+		 "                with -D instead of printing the tuples\n"
+		 "  --unique-index Also report the keys of tuples missing from\n"
+		 "                the btree index [file] on the columns\n"
+		 "  --unique-memory Spill the keys of --unique-check to disk\n"
+		 "                beyond [size] (default 256MB)\n"
+		 "  --fk-check    Report the values of the comma separated\n"
+		 "                [columns] of the tuples decoded with -D missing\n"
+		 "                from the referenced relation instead of\n"
+		 "                printing the tuples\n"
+		 "  --fk-ref      Heap or btree index [file] of the referenced\n"
+		 "                relation\n"
+		 "  --fk-ref-types Attribute types of the referenced relation,\n"
+		 "                as for -D\n"
+		 "  --fk-ref-key  Columns of the referenced key (default 1 to the\n"
+		 "                number of --fk-check columns)\n\n"
 		 "The following options are valid for control files:\n"
 		 "  -c  Interpret the file listed as a control file\n"
 		 "  -f  Display formatted content dump along with interpretation\n"
@@ -409,6 +552,637 @@ ConsumeOptions(int numOptions, char **options)
 				break;
 			}
 		}
+		/* Print statistics after dumping */
+		else if (strcmp(optionString, "--stats") == 0 && x < numOptions - 1)
+		{
+			if (showStats)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			showStats = true;
+		}
+		/* Check TOAST values instead of printing the tuples */
+		else if (strcmp(optionString, "--toast-check") == 0 && x < numOptions - 1)
+		{
+			if (toastCheck)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			toastCheck = true;
+		}
+		/* Only dump items with the given line pointer states */
+		else if (strcmp(optionString, "--lp-state") == 0)
+		{
+			if (lpStateFilter != 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of states */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing line pointer states.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseLpStateFilter(optionString) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid line pointer states <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Only dump heap tuples with the given infomask flags */
+		else if (strcmp(optionString, "--infomask") == 0)
+		{
+			if (numInfomaskPredicates > 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of flags */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing infomask flags.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseInfomaskFilter(optionString) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid infomask flags <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Print structured records instead of text */
+		else if (strcmp(optionString, "--output-format") == 0)
+		{
+			if (outputFormatSet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			outputFormatSet = true;
+
+			/* The token immediately following is the format */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing output format.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (strcmp(optionString, "text") == 0)
+				outputFormat = OUTPUT_TEXT;
+			else if (strcmp(optionString, "json") == 0)
+				outputFormat = OUTPUT_JSON;
+			else if (strcmp(optionString, "binary") == 0)
+				outputFormat = OUTPUT_BINARY;
+			else
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid output format <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Compress the output */
+		else if (strcmp(optionString, "--compress") == 0)
+		{
+			if (outputCompression != OUTPUT_COMPRESS_NONE)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the method */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing compression method.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((outputCompression = OutputCompressionMethod(optionString)) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Unsupported compression method <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Split the output into files of a given size */
+		else if (strcmp(optionString, "--split-size") == 0)
+		{
+			if (outputSplitSize != 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the file size */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing split size identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((outputSplitSize = GetMemoryOptionValue(optionString)) <
+				MIN_SPLIT_SIZE)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid split size requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Write the output to a file */
+		else if (strcmp(optionString, "--output") == 0)
+		{
+			if (outputPath != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the file name */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing output file name.\n");
+				exitCode = 1;
+				break;
+			}
+
+			outputPath = options[++x];
+		}
+		/* Copy the decoded rows into a database */
+		else if (strcmp(optionString, "--copy-target") == 0)
+		{
+			if (copyConninfo != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the connection string */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing connection string.\n");
+				exitCode = 1;
+				break;
+			}
+
+			copyConninfo = options[++x];
+		}
+		/* Table the decoded rows are copied into */
+		else if (strcmp(optionString, "--copy-table") == 0)
+		{
+			if (copyTable != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the table name */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing table name.\n");
+				exitCode = 1;
+				break;
+			}
+
+			copyTable = options[++x];
+		}
+		/* Only output the newest version per key */
+		else if (strcmp(optionString, "--dedup-key") == 0)
+		{
+			if (numDedupKeys > 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of columns */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing key columns.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseColumnList(optionString, dedupKeys, &numDedupKeys) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid key columns <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Order of versions for --dedup-key */
+		else if (strcmp(optionString, "--dedup-by") == 0)
+		{
+			if (dedupBySet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			dedupBySet = true;
+
+			/* The token immediately following is the order */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing version order.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (strcmp(optionString, "xmin") == 0)
+				dedupBy = DEDUP_BY_XMIN;
+			else if (strcmp(optionString, "lsn") == 0)
+				dedupBy = DEDUP_BY_LSN;
+			else
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid version order <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Memory kept by --dedup-key before spilling */
+		else if (strcmp(optionString, "--dedup-memory") == 0)
+		{
+			if (dedupMemorySet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			dedupMemorySet = true;
+
+			/* The token immediately following is the memory size */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing memory size identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((dedupMemory = GetMemoryOptionValue(optionString)) == 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid memory size requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Report duplicate keys instead of the tuples */
+		else if (strcmp(optionString, "--unique-check") == 0)
+		{
+			if (numUniqueKeys > 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of columns */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing key columns.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseColumnList(optionString, uniqueKeys, &numUniqueKeys) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid key columns <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Btree index to compare the keys with */
+		else if (strcmp(optionString, "--unique-index") == 0)
+		{
+			if (uniqueIndexPath != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the index file */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing index file name.\n");
+				exitCode = 1;
+				break;
+			}
+
+			uniqueIndexPath = options[++x];
+		}
+		/* Memory kept by --unique-check before spilling */
+		else if (strcmp(optionString, "--unique-memory") == 0)
+		{
+			if (uniqueMemorySet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			uniqueMemorySet = true;
+
+			/* The token immediately following is the memory size */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing memory size identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((uniqueMemory = GetMemoryOptionValue(optionString)) == 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid memory size requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Report the keys missing from a referenced relation */
+		else if (strcmp(optionString, "--fk-check") == 0)
+		{
+			if (numFkKeys > 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of columns */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing key columns.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseColumnList(optionString, fkKeys, &numFkKeys) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid key columns <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Heap or btree index file of the referenced relation */
+		else if (strcmp(optionString, "--fk-ref") == 0)
+		{
+			if (fkRefPath != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the referenced file */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing referenced file name.\n");
+				exitCode = 1;
+				break;
+			}
+
+			fkRefPath = options[++x];
+		}
+		/* Attribute types of the referenced relation */
+		else if (strcmp(optionString, "--fk-ref-types") == 0)
+		{
+			int			ret;
+
+			if (fkRefTypes != NULL)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of types */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing attribute types string.\n");
+				exitCode = 1;
+				break;
+			}
+
+			/* Parsed into the second set of decoders */
+			fkRefTypes = options[++x];
+			SwapAttributeTypes();
+			ret = ParseAttributeTypesString(fkRefTypes);
+			SwapAttributeTypes();
+			if (ret < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid attribute types string <%s>.\n",
+					   fkRefTypes);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Columns of the referenced key */
+		else if (strcmp(optionString, "--fk-ref-key") == 0)
+		{
+			if (numFkRefKeys > 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the list of columns */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing key columns.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if (ParseColumnList(optionString, fkRefKeys, &numFkRefKeys) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid key columns <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Limit the memory used for decoded values */
+		else if (strcmp(optionString, "--max-memory") == 0)
+		{
+			if (maxMemory != 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+
+			/* The token immediately following is the memory size */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing memory size identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((maxMemory = GetMemoryOptionValue(optionString)) == 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid memory size requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Size of the TOAST value cache */
+		else if (strcmp(optionString, "--toast-cache") == 0)
+		{
+			if (toastCacheSizeSet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			toastCacheSizeSet = true;
+
+			/* The token immediately following is the cache size */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing TOAST cache size identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			toastCacheSize = GetMemoryOptionValue(optionString);
+			if (toastCacheSize == 0 && strcmp(optionString, "0") != 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid TOAST cache size requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
+		/* Number of threads reading TOAST values ahead */
+		else if (strcmp(optionString, "--toast-workers") == 0)
+		{
+			if (toastWorkersSet)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Duplicate option listed <%s>.\n", optionString);
+				exitCode = 1;
+				break;
+			}
+			toastWorkersSet = true;
+
+			/* The token immediately following is the number of threads */
+			if (x >= (numOptions - 2))
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Missing TOAST workers identifier.\n");
+				exitCode = 1;
+				break;
+			}
+
+			optionString = options[++x];
+			if ((toastWorkers = GetOptionValue(optionString)) < 0)
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Invalid number of TOAST workers requested <%s>.\n",
+					   optionString);
+				exitCode = 1;
+				break;
+			}
+		}
 		/* Check for the special case where the user forces a segment number
 		 * instead of having the tool determine it by file name. */
 		else if ((optionStringLength == 2)
@@ -582,22 +1356,176 @@ ConsumeOptions(int numOptions, char **options)
 						}
 						break;
 
-					default:
-						rc = OPT_RC_INVALID;
-						printf("Error: Unknown option <%c>.\n", optionString[y]);
-						exitCode = 1;
-						break;
-				}
+					default:
+						rc = OPT_RC_INVALID;
+						printf("Error: Unknown option <%c>.\n", optionString[y]);
+						exitCode = 1;
+						break;
+				}
+
+				if (rc)
+					break;
+			}
+		}
+	}
+
+	if (rc == OPT_RC_DUPLICATE)
+	{
+		printf("Error: Duplicate option listed <%c>.\n", duplicateSwitch);
+		exitCode = 1;
+	}
+
+	/*
+	 * The TOAST pointers are found by decoding the tuples, and values not
+	 * walked because of ~ would be reported as orphaned
+	 */
+	if (rc == OPT_RC_VALID && toastCheck &&
+		(!(blockOptions & BLOCK_DECODE) || AttributeTypesIgnoreRest()))
+	{
+		rc = OPT_RC_INVALID;
+		printf("Error: Option <--toast-check> requires <D> without <~>.\n");
+		exitCode = 1;
+	}
+
+	/* Split files are named after the output file */
+	if (rc == OPT_RC_VALID && outputSplitSize != 0 && outputPath == NULL)
+	{
+		rc = OPT_RC_INVALID;
+		printf("Error: Option <--split-size> requires <--output>.\n");
+		exitCode = 1;
+	}
+
+	/* Rows are copied as they are decoded */
+	if (rc == OPT_RC_VALID && (copyConninfo != NULL || copyTable != NULL) &&
+		(copyConninfo == NULL || copyTable == NULL ||
+		 !(blockOptions & BLOCK_DECODE) || toastCheck))
+	{
+		rc = OPT_RC_INVALID;
+		printf("Error: Options <--copy-target> and <--copy-table> require "
+			   "each other and <D>, and exclude <--toast-check>.\n");
+		exitCode = 1;
+	}
+
+	/* Versions are compared by the key columns of the decoded rows */
+	if (rc == OPT_RC_VALID && (numDedupKeys > 0 || dedupBySet || dedupMemorySet))
+	{
+		int			k;
+
+		if (numDedupKeys == 0 || !(blockOptions & BLOCK_DECODE) || toastCheck)
+		{
+			rc = OPT_RC_INVALID;
+			printf("Error: Options <--dedup-by> and <--dedup-memory> require "
+				   "<--dedup-key>, which requires <D> and excludes "
+				   "<--toast-check>.\n");
+			exitCode = 1;
+		}
+
+		for (k = 0; rc == OPT_RC_VALID && k < numDedupKeys; k++)
+		{
+			if (dedupKeys[k] > DecodedColumnCount())
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Key column <%d> beyond the %d columns decoded.\n",
+					   dedupKeys[k], DecodedColumnCount());
+				exitCode = 1;
+			}
+		}
+	}
+
+	/* Keys are collected from the decoded tuples instead of printing them */
+	if (rc == OPT_RC_VALID &&
+		(numUniqueKeys > 0 || uniqueIndexPath != NULL || uniqueMemorySet))
+	{
+		int			k;
+
+		if (numUniqueKeys == 0 || !(blockOptions & BLOCK_DECODE) ||
+			toastCheck || numDedupKeys > 0 || copyConninfo != NULL)
+		{
+			rc = OPT_RC_INVALID;
+			printf("Error: Options <--unique-index> and <--unique-memory> "
+				   "require <--unique-check>, which requires <D> and excludes "
+				   "<--toast-check>, <--dedup-key> and <--copy-target>.\n");
+			exitCode = 1;
+		}
+
+		for (k = 0; rc == OPT_RC_VALID && k < numUniqueKeys; k++)
+		{
+			if (uniqueKeys[k] > DecodedColumnCount())
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Key column <%d> beyond the %d columns decoded.\n",
+					   uniqueKeys[k], DecodedColumnCount());
+				exitCode = 1;
+			}
+		}
+	}
+
+	/* Keys are looked up in the referenced relation instead of printing */
+	if (rc == OPT_RC_VALID && (numFkKeys > 0 || fkRefPath != NULL ||
+							   fkRefTypes != NULL || numFkRefKeys > 0))
+	{
+		int			k;
+
+		if (numFkKeys == 0 || fkRefPath == NULL || fkRefTypes == NULL ||
+			!(blockOptions & BLOCK_DECODE) || toastCheck ||
+			numDedupKeys > 0 || numUniqueKeys > 0 || copyConninfo != NULL)
+		{
+			rc = OPT_RC_INVALID;
+			printf("Error: Options <--fk-check>, <--fk-ref> and "
+				   "<--fk-ref-types> require each other and <D>, and exclude "
+				   "<--toast-check>, <--dedup-key>, <--unique-check> and "
+				   "<--copy-target>.\n");
+			exitCode = 1;
+		}
+		else if (numFkRefKeys == 0)
+		{
+			for (k = 0; k < numFkKeys; k++)
+				fkRefKeys[k] = k + 1;
+			numFkRefKeys = numFkKeys;
+		}
+		else if (numFkRefKeys != numFkKeys)
+		{
+			rc = OPT_RC_INVALID;
+			printf("Error: Option <--fk-ref-key> lists %d columns, "
+				   "<--fk-check> %d.\n", numFkRefKeys, numFkKeys);
+			exitCode = 1;
+		}
+
+		for (k = 0; rc == OPT_RC_VALID && k < numFkKeys; k++)
+		{
+			if (fkKeys[k] > DecodedColumnCount())
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Key column <%d> beyond the %d columns decoded.\n",
+					   fkKeys[k], DecodedColumnCount());
+				exitCode = 1;
+			}
+		}
 
-				if (rc)
-					break;
+		SwapAttributeTypes();
+		for (k = 0; rc == OPT_RC_VALID && k < numFkRefKeys; k++)
+		{
+			if (fkRefKeys[k] > DecodedColumnCount())
+			{
+				rc = OPT_RC_INVALID;
+				printf("Error: Referenced key column <%d> beyond the %d "
+					   "columns of <--fk-ref-types>.\n",
+					   fkRefKeys[k], DecodedColumnCount());
+				exitCode = 1;
 			}
 		}
+		SwapAttributeTypes();
 	}
 
-	if (rc == OPT_RC_DUPLICATE)
+	/* Structured output only describes page headers and items */
+	if (rc == OPT_RC_VALID && outputFormat != OUTPUT_TEXT &&
+		((blockOptions & (BLOCK_BINARY | BLOCK_NO_INTR | BLOCK_FORMAT |
+						  BLOCK_DECODE)) ||
+		 controlOptions || isRelMapFile || showStats))
 	{
-		printf("Error: Duplicate option listed <%c>.\n", duplicateSwitch);
+		rc = OPT_RC_INVALID;
+		printf("Error: Option <--output-format> cannot be combined with "
+			   "<b>, <c>, <d>, <f>, <m>, <D> or <--stats>.\n");
 		exitCode = 1;
 	}
 
@@ -666,6 +1594,144 @@ GetOptionValue(char *optionString)
 	return (value);
 }
 
+/* Convert a memory size with an optional kB, MB or GB suffix to bytes.
+ * Returns 0 if the string is not a valid size */
+static Size
+GetMemoryOptionValue(char *optionString)
+{
+	char	   *suffix;
+	unsigned long long value;
+	Size		multiplier;
+
+	if (!isdigit((unsigned char) optionString[0]))
+		return 0;
+
+	errno = 0;
+	value = strtoull(optionString, &suffix, 10);
+	if (errno == ERANGE)
+		return 0;
+
+	if (*suffix == '\0' || strcmp(suffix, "B") == 0)
+		multiplier = 1;
+	else if (strcmp(suffix, "kB") == 0)
+		multiplier = 1024;
+	else if (strcmp(suffix, "MB") == 0)
+		multiplier = 1024 * 1024;
+	else if (strcmp(suffix, "GB") == 0)
+		multiplier = 1024 * 1024 * 1024;
+	else
+		return 0;
+
+	/* Reject sizes that would wrap around instead of a huge budget */
+	if (value > SIZE_MAX / multiplier)
+		return 0;
+
+	return (Size) value * multiplier;
+}
+
+/* Parse the comma separated line pointer states of --lp-state.  Returns
+ * -1 if a state is unknown */
+static int
+ParseLpStateFilter(char *optionString)
+{
+	char		states[256];
+	char	   *state;
+	int			rc = 0;
+
+	if (strlcpy(states, optionString, sizeof(states)) >= sizeof(states))
+		return -1;
+
+	for (state = strtok(states, ","); state != NULL; state = strtok(NULL, ","))
+	{
+		if (pg_strcasecmp(state, "UNUSED") == 0)
+			lpStateFilter |= 1 << LP_UNUSED;
+		else if (pg_strcasecmp(state, "NORMAL") == 0)
+			lpStateFilter |= 1 << LP_NORMAL;
+		else if (pg_strcasecmp(state, "REDIRECT") == 0)
+			lpStateFilter |= 1 << LP_REDIRECT;
+		else if (pg_strcasecmp(state, "DEAD") == 0)
+			lpStateFilter |= 1 << LP_DEAD;
+		else
+		{
+			rc = -1;
+			break;
+		}
+	}
+
+	if (lpStateFilter == 0)
+		rc = -1;
+
+	return rc;
+}
+
+/* Parse the comma separated column numbers of --dedup-key, --unique-check,
+ * --fk-check and --fk-ref-key into columns, which has room for
+ * MAX_KEY_COLUMNS.  Returns -1 if one is not a positive number or there are too many */
+static int
+ParseColumnList(char *optionString, int *columns, int *numColumns)
+{
+	char		list[256];
+	char	   *column;
+
+	if (strlcpy(list, optionString, sizeof(list)) >= sizeof(list))
+		return -1;
+
+	for (column = strtok(list, ","); column != NULL; column = strtok(NULL, ","))
+	{
+		char	   *end;
+		long		value = strtol(column, &end, 10);
+
+		if (*end != '\0' || value <= 0 || value > MaxHeapAttributeNumber ||
+			*numColumns == MAX_KEY_COLUMNS)
+			return -1;
+
+		columns[(*numColumns)++] = (int) value;
+	}
+
+	return *numColumns > 0 ? 0 : -1;
+}
+
+/* Parse the comma separated flags of --infomask, each optionally prefixed
+ * with ! for flags that must not be set.  Returns -1 if a flag is unknown */
+static int
+ParseInfomaskFilter(char *optionString)
+{
+	char		flags[256];
+	char	   *flag;
+	int			rc = 0;
+
+	if (strlcpy(flags, optionString, sizeof(flags)) >= sizeof(flags))
+		return -1;
+
+	for (flag = strtok(flags, ","); flag != NULL; flag = strtok(NULL, ","))
+	{
+		bool		negate = (flag[0] == '!');
+		const InfomaskFlag *f;
+
+		if (negate)
+			flag++;
+
+		for (f = infomaskFlags; f->name != NULL; f++)
+			if (pg_strcasecmp(flag, f->name) == 0)
+				break;
+
+		if (f->name == NULL || numInfomaskPredicates == MAX_INFOMASK_PREDICATES)
+		{
+			rc = -1;
+			break;
+		}
+
+		infomaskPredicates[numInfomaskPredicates].flag = f;
+		infomaskPredicates[numInfomaskPredicates].negate = negate;
+		numInfomaskPredicates++;
+	}
+
+	if (numInfomaskPredicates == 0)
+		rc = -1;
+
+	return rc;
+}
+
 /* Read the page header off of block 0 to determine the block size
  * used in this file.  Can be overridden using the -S option. The
  * returned value is the block size of block 0 on disk */
@@ -699,6 +1765,154 @@ GetBlockSize(FILE *fp)
 	return (localSize);
 }
 
+/*
+ * Hand the keys of another relation file to add_key: the given 1-based
+ * columns of the heap tuples, decoded with the current attribute types,
+ * or the leading attributes of the leaf tuples of a btree index, decoded
+ * with the types of the given columns.  Heap tuples inserted by aborted
+ * transactions are skipped, and so are the deleted ones with -o.  NULL
+ * keys are passed as a NULL key.  Returns -1 after printing an error if
+ * the file cannot be opened or a tuple cannot be decoded.
+ */
+int
+ScanRelationKeys(const char *path, const int *columns, int ncolumns,
+				 RelationKeyCallback add_key)
+{
+	FILE	   *fp;
+	unsigned int size;
+	char	   *buffer;
+	KeyBuffer	key = {0};
+	BlockNumber blkno;
+	int			rc = 0;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+	{
+		printf("Error: Could not open file <%s>: %s.\n", path,
+			   strerror(errno));
+		return -1;
+	}
+
+	size = (blockOptions & BLOCK_FORCED) ? blockSize : GetBlockSize(fp);
+	buffer = TrackedAlloc(size);
+	if (buffer == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	for (blkno = 0; fread(buffer, 1, size, fp) == size; blkno++)
+	{
+		Page		page = (Page) buffer;
+		PageHeader	header = (PageHeader) page;
+		bool		isIndex;
+		OffsetNumber maxOffset;
+		OffsetNumber offnum;
+
+		/* Only sane heap pages and btree leaf pages hold keys */
+		if (PageIsNew(page) ||
+			header->pd_special > size ||
+			header->pd_lower < SizeOfPageHeaderData ||
+			header->pd_lower > header->pd_upper ||
+			header->pd_upper > header->pd_special)
+			continue;
+
+		isIndex = PageGetSpecialSize(page) == MAXALIGN(sizeof(BTPageOpaqueData));
+		offnum = FirstOffsetNumber;
+		if (isIndex)
+		{
+			BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+			if (P_ISMETA(opaque) || !P_ISLEAF(opaque) || P_IGNORE(opaque))
+				continue;
+			offnum = P_FIRSTDATAKEY(opaque);
+		}
+		else if (PageGetSpecialSize(page) != 0)
+			continue;
+
+		maxOffset = PageGetMaxOffsetNumber(page);
+		for (; offnum <= maxOffset; offnum++)
+		{
+			ItemId		itemId = PageGetItemId(page, offnum);
+			unsigned int itemSize = ItemIdGetLength(itemId);
+			char	   *item = PageGetItem(page, itemId);
+			uint64		entries = 1;
+			const char *row;
+			int			len = 0;
+
+			if (!ItemIdIsNormal(itemId) ||
+				ItemIdGetOffset(itemId) + itemSize > size)
+				continue;
+
+			if (isIndex)
+			{
+				IndexTuple	itup = (IndexTuple) item;
+				unsigned int dataOffset;
+				unsigned int dataEnd;
+				const bits8 *nulls = NULL;
+				int			ret;
+
+				if (itemSize < sizeof(IndexTupleData))
+					continue;
+
+				dataOffset = IndexInfoFindDataOffset(itup->t_info);
+				dataEnd = Min(IndexTupleSize(itup), itemSize);
+#if PG_VERSION_NUM >= 130000
+				/* Deduplicated entries hold the heap TIDs after the key */
+				if (BTreeTupleIsPosting(itup))
+				{
+					dataEnd = Min(dataEnd, BTreeTupleGetPostingOffset(itup));
+					entries = BTreeTupleGetNPosting(itup);
+				}
+#endif
+				if (IndexTupleHasNulls(itup))
+					nulls = (const bits8 *) (item + sizeof(IndexTupleData));
+
+				if (dataOffset >= dataEnd)
+					continue;
+
+				ret = DecodeIndexKey(item + dataOffset, dataEnd - dataOffset,
+									 nulls, columns, ncolumns, &row, &len);
+				if (ret < 0)
+				{
+					printf("Error: unable to decode the key of block %u, "
+						   "item %u of <%s>.\n", blkno, offnum, path);
+					rc = -1;
+					continue;
+				}
+				add_key(ret > 0 ? row : NULL, len, entries, blkno, offnum);
+			}
+			else
+			{
+				HeapTupleHeader tuple = (HeapTupleHeader) item;
+
+				if (itemSize < SizeofHeapTupleHeader ||
+					tuple->t_hoff > itemSize ||
+					HeapTupleHeaderXminInvalid(tuple) ||
+					((blockOptions & BLOCK_IGNORE_OLD) &&
+					 HeapTupleHeaderGetRawXmax(tuple) != 0))
+					continue;
+
+				if ((row = DecodeRow(item, itemSize, &len)) == NULL)
+				{
+					printf("Error: unable to decode block %u, item %u of "
+						   "<%s>.\n", blkno, offnum, path);
+					rc = -1;
+					continue;
+				}
+
+				len = BuildRowKey(&key, row, len, columns, ncolumns);
+				add_key(len >= 0 ? key.data : NULL, len, entries, blkno, offnum);
+			}
+		}
+	}
+
+	FreeKeyBuffer(&key);
+	TrackedFree(buffer);
+	fclose(fp);
+
+	return rc;
+}
+
 /* Determine the contents of the special section on the block and
  * return this enum value */
 static unsigned int
@@ -789,6 +2003,58 @@ GetSpecialSectionType(char *buffer, Page page)
 	return (rc);
 }
 
+/* Determine how the items on the block are interpreted.  First, honour
+ * requests to format items a special way, then use the special section
+ * to determine the format style */
+static unsigned int
+GetItemFormat(Page page)
+{
+	if (itemOptions & ITEM_INDEX)
+		return ITEM_INDEX;
+	if (itemOptions & ITEM_HEAP)
+		return ITEM_HEAP;
+
+	switch (specialType)
+	{
+		case SPEC_SECT_INDEX_BTREE:
+		case SPEC_SECT_INDEX_HASH:
+		case SPEC_SECT_INDEX_GIST:
+		case SPEC_SECT_INDEX_GIN:
+			return ITEM_INDEX;
+		case SPEC_SECT_INDEX_SPGIST:
+			{
+				SpGistPageOpaque spgpo =
+				(SpGistPageOpaque) ((char *) page +
+									((PageHeader) page)->pd_special);
+
+				if (spgpo->flags & SPGIST_LEAF)
+					return ITEM_SPG_LEAF;
+				else
+					return ITEM_SPG_INNER;
+			}
+		default:
+			return ITEM_HEAP;
+	}
+}
+
+/* Sanity check the contents of a complete page header */
+static bool
+IsPageHeaderValid(Page page, int maxOffset)
+{
+	PageHeader	pageHeader = (PageHeader) page;
+
+	return !((maxOffset < 0) ||
+			 (maxOffset > blockSize) ||
+			 (PageGetPageLayoutVersion(page) != PG_PAGE_LAYOUT_VERSION) || /* only one we support */
+			 (pageHeader->pd_upper > blockSize) ||
+			 (pageHeader->pd_upper > pageHeader->pd_special) ||
+			 (pageHeader->pd_lower <
+			  (sizeof(PageHeaderData) - sizeof(ItemIdData)))
+			 || (pageHeader->pd_lower > blockSize)
+			 || (pageHeader->pd_upper < pageHeader->pd_lower)
+			 || (pageHeader->pd_special > blockSize));
+}
+
 /*	Check whether page is a btree meta page */
 static bool
 IsBtreeMetaPage(Page page)
@@ -979,16 +2245,7 @@ FormatHeader(char *buffer, Page page, BlockNumber blkno, bool isToast)
 
 		/* Eye the contents of the header and alert the user to possible 
 		 * problems. */
-		if ((maxOffset < 0) ||
-			(maxOffset > blockSize) ||
-			(blockVersion != PG_PAGE_LAYOUT_VERSION) || /* only one we support */
-			(pageHeader->pd_upper > blockSize) ||
-			(pageHeader->pd_upper > pageHeader->pd_special) ||
-			(pageHeader->pd_lower <
-			 (sizeof(PageHeaderData) - sizeof(ItemIdData)))
-			|| (pageHeader->pd_lower > blockSize)
-			|| (pageHeader->pd_upper < pageHeader->pd_lower)
-			|| (pageHeader->pd_special > blockSize))
+		if (!IsPageHeaderValid(page, maxOffset))
 		{
 			printf(" Error: Invalid header information.\n\n");
 			exitCode = 1;
@@ -1276,37 +2533,16 @@ FormatItemBlock(char *buffer,
 		uint32			chunkId;
 		unsigned int	chunkSize = 0;
 
-		/* First, honour requests to format items a special way, then
-		 * use the special section to determine the format style */
-		if (itemOptions & ITEM_INDEX)
-			formatAs = ITEM_INDEX;
-		else if (itemOptions & ITEM_HEAP)
-			formatAs = ITEM_HEAP;
-		else
-			switch (specialType)
-			{
-				case SPEC_SECT_INDEX_BTREE:
-				case SPEC_SECT_INDEX_HASH:
-				case SPEC_SECT_INDEX_GIST:
-				case SPEC_SECT_INDEX_GIN:
-					formatAs = ITEM_INDEX;
-					break;
-				case SPEC_SECT_INDEX_SPGIST:
-					{
-						SpGistPageOpaque spgpo =
-						(SpGistPageOpaque) ((char *) page +
-											((PageHeader) page)->pd_special);
-
-						if (spgpo->flags & SPGIST_LEAF)
-							formatAs = ITEM_SPG_LEAF;
-						else
-							formatAs = ITEM_SPG_INNER;
-					}
-					break;
-				default:
-					formatAs = ITEM_HEAP;
-					break;
-			}
+		formatAs = GetItemFormat(page);
+
+		/* Versions kept by --dedup-key may be ordered by their page */
+		if (numDedupKeys > 0)
+			dedupPageLsn = PageGetLSN(page);
+
+		/* Start reading the TOAST values of the page before decoding it */
+		if (!isToast && (blockOptions & BLOCK_DECODE) &&
+			(blockOptions & BLOCK_DECODE_TOAST) && !verbose && !toastCheck)
+			PrefetchToastValues(buffer, page, maxOffset);
 
 		for (x = 1; x < (maxOffset + 1); x++)
 		{
@@ -1315,6 +2551,21 @@ FormatItemBlock(char *buffer,
 			itemSize = (unsigned int) ItemIdGetLength(itemId);
 			itemOffset = (unsigned int) ItemIdGetOffset(itemId);
 
+			if (!isToast)
+			{
+				dumpStats.items++;
+
+				/* Leave out the items --lp-state and --infomask do not
+				 * select before anything is printed for them */
+				if (!ItemPassesFilter(buffer, itemId, formatAs))
+				{
+					dumpStats.itemsFiltered++;
+					if (x == maxOffset)
+						printf("\n");
+					continue;
+				}
+			}
+
 			switch (itemFlags)
 			{
 				case LP_UNUSED:
@@ -1398,15 +2649,212 @@ FormatItemBlock(char *buffer,
 				}
 				else if ((blockOptions & BLOCK_DECODE) && (itemFlags == LP_NORMAL))
 				{
-					/* Decode tuple data */
-					FormatDecode(&buffer[itemOffset], itemSize);
+					if (toastCheck)
+						ToastCheckCollect(&buffer[itemOffset], itemSize,
+										  pageOffset / blockSize, x);
+					else if (numUniqueKeys > 0)
+						UniqueCheckCollect(&buffer[itemOffset], itemSize,
+										   pageOffset / blockSize, x);
+					else if (numFkKeys > 0)
+						FkCheckCollect(&buffer[itemOffset], itemSize,
+									   pageOffset / blockSize, x);
+					else
+						/* Decode tuple data */
+						FormatDecode(&buffer[itemOffset], itemSize);
 				}
 
 				if (!isToast && x == maxOffset)
 					printf("\n");
 			}
 		}
+
+		if (!isToast)
+			ToastPrefetchFinish();
+	}
+}
+
+/*
+ * Collect the TOAST pointers of the tuples FormatItemBlock() is about to
+ * decode and hand them to the TOAST prefetch workers
+ */
+static void
+PrefetchToastValues(char *buffer, Page page, int maxOffset)
+{
+	int			x;
+
+	if (toastWorkers == 0)
+		return;
+
+	for (x = 1; x <= maxOffset; x++)
+	{
+		ItemId		itemId = PageGetItemId(page, x);
+		unsigned int itemSize = ItemIdGetLength(itemId);
+		unsigned int itemOffset = ItemIdGetOffset(itemId);
+		HeapTupleHeader tuple_header;
+
+		if (ItemIdGetFlags(itemId) != LP_NORMAL ||
+			itemOffset + itemSize > blockSize ||
+			itemOffset + itemSize > bytesToFormat)
+			continue;
+
+		tuple_header = (HeapTupleHeader) (&buffer[itemOffset]);
+		if ((blockOptions & BLOCK_IGNORE_OLD) &&
+			HeapTupleHeaderGetRawXmax(tuple_header) != 0)
+			continue;
+
+		if (!ItemPassesFilter(buffer, itemId, ITEM_HEAP))
+			continue;
+
+		CollectToastPointers(&buffer[itemOffset], itemSize, ToastPrefetchAdd);
+	}
+
+	ToastPrefetchStart();
+}
+
+/* Emit the header and items of a block as structured records for
+ * --output-format, in place of FormatHeader() and FormatItemBlock() */
+static void
+EmitBlock(char *buffer, Page page, BlockNumber blkno)
+{
+	PageHeader	pageHeader = (PageHeader) page;
+	PageRecord	pageRec;
+	int			maxOffset;
+	unsigned int formatAs;
+	unsigned int x;
+
+	memset(&pageRec, 0, sizeof(pageRec));
+	pageRec.blkno = blkno;
+	pageRec.partial = (bytesToFormat < blockSize);
+	pageRec.specialType = specialType;
+
+	/* The item array is only read if the block holds all of it */
+	if (bytesToFormat < offsetof(PageHeaderData, pd_linp[0]))
+	{
+		EmitPageRecord(&pageRec);
+		exitCode = 1;
+		return;
+	}
+
+	maxOffset = PageGetMaxOffsetNumber(page);
+	pageRec.headerComplete = (maxOffset <= 0 ||
+							  bytesToFormat >= offsetof(PageHeaderData, pd_linp[0]) +
+							  maxOffset * sizeof(ItemIdData));
+	pageRec.headerValid = IsPageHeaderValid(page, maxOffset);
+	pageRec.lsn = PageGetLSN(page);
+	pageRec.checksum = pageHeader->pd_checksum;
+	pageRec.flags = pageHeader->pd_flags;
+	pageRec.lower = pageHeader->pd_lower;
+	pageRec.upper = pageHeader->pd_upper;
+	pageRec.special = pageHeader->pd_special;
+	pageRec.pageSize = (uint16) PageGetPageSize(page);
+	pageRec.version = (uint8) PageGetPageLayoutVersion(page);
+	pageRec.pruneXid = pageHeader->pd_prune_xid;
+	pageRec.items = (uint16) Max(maxOffset, 0);
+
+	if (blockOptions & BLOCK_CHECKSUMS)
+	{
+		uint32		delta = (segmentSize / blockSize) * segmentNumber;
+
+		pageRec.checksumVerified = true;
+		pageRec.calculatedChecksum = pg_checksum_page(page, delta + blkno);
+		if (pageRec.calculatedChecksum != pageRec.checksum)
+			exitCode = 1;
+	}
+
+	if (!pageRec.headerComplete || !pageRec.headerValid)
+		exitCode = 1;
+
+	EmitPageRecord(&pageRec);
+
+	/* Meta pages and GIN posting lists have no items, see
+	 * FormatItemBlock() */
+	if (!pageRec.headerComplete || maxOffset <= 0 || maxOffset > blockSize ||
+		IsBtreeMetaPage(page) || IsSpGistMetaPage(page) ||
+		IsGinMetaPage(page) || specialType == SPEC_SECT_INDEX_GIN)
+		return;
+
+	formatAs = GetItemFormat(page);
+
+	for (x = 1; x <= maxOffset; x++)
+	{
+		ItemId		itemId = PageGetItemId(page, x);
+		ItemRecord	itemRec;
+
+		dumpStats.items++;
+		if (!ItemPassesFilter(buffer, itemId, formatAs))
+		{
+			dumpStats.itemsFiltered++;
+			continue;
+		}
+
+		memset(&itemRec, 0, sizeof(itemRec));
+		itemRec.blkno = blkno;
+		itemRec.offnum = x;
+		itemRec.lpOffset = ItemIdGetOffset(itemId);
+		itemRec.lpLength = ItemIdGetLength(itemId);
+		itemRec.lpFlags = ItemIdGetFlags(itemId);
+		itemRec.beyondBlock = (itemRec.lpOffset + itemRec.lpLength > blockSize ||
+							   itemRec.lpOffset + itemRec.lpLength > bytesToFormat);
+		if (itemRec.beyondBlock)
+			exitCode = 1;
+
+		if (formatAs == ITEM_HEAP && itemRec.lpFlags == LP_NORMAL &&
+			!itemRec.beyondBlock && itemRec.lpLength >= SizeofHeapTupleHeader)
+		{
+			HeapTupleHeader htup = (HeapTupleHeader) (&buffer[itemRec.lpOffset]);
+
+			itemRec.isHeap = true;
+			itemRec.xmin = HeapTupleHeaderGetXmin(htup);
+			itemRec.xmax = HeapTupleHeaderGetRawXmax(htup);
+			itemRec.field3 = HeapTupleHeaderGetRawCommandId(htup);
+			itemRec.ctidBlock = ((uint32) ((htup->t_ctid.ip_blkid.bi_hi << 16) |
+										   (uint16) htup->t_ctid.ip_blkid.bi_lo));
+			itemRec.ctidOffset = htup->t_ctid.ip_posid;
+			itemRec.infomask = htup->t_infomask;
+			itemRec.infomask2 = htup->t_infomask2;
+			itemRec.hoff = htup->t_hoff;
+		}
+
+		EmitItemRecord(&itemRec);
+	}
+}
+
+/* Check an item against --lp-state and --infomask.  Only heap tuples that
+ * fit on the block can match --infomask */
+static bool
+ItemPassesFilter(char *buffer, ItemId itemId, unsigned int formatAs)
+{
+	unsigned int itemSize = ItemIdGetLength(itemId);
+	unsigned int itemOffset = ItemIdGetOffset(itemId);
+	HeapTupleHeader htup;
+	int			i;
+
+	if (lpStateFilter != 0 &&
+		(lpStateFilter & (1 << ItemIdGetFlags(itemId))) == 0)
+		return false;
+
+	if (numInfomaskPredicates == 0)
+		return true;
+
+	if (formatAs != ITEM_HEAP || ItemIdGetFlags(itemId) != LP_NORMAL ||
+		itemSize < SizeofHeapTupleHeader ||
+		itemOffset + itemSize > blockSize ||
+		itemOffset + itemSize > bytesToFormat)
+		return false;
+
+	htup = (HeapTupleHeader) (&buffer[itemOffset]);
+
+	for (i = 0; i < numInfomaskPredicates; i++)
+	{
+		const InfomaskFlag *f = infomaskPredicates[i].flag;
+		uint16		bits = f->infomask2 ? htup->t_infomask2 : htup->t_infomask;
+
+		/* Flags of several bits, like FROZEN, need all of them */
+		if (((bits & f->mask) == f->mask) == infomaskPredicates[i].negate)
+			return false;
 	}
+
+	return true;
 }
 
 /* Interpret the contents of the item based on whether it has a special
@@ -1932,6 +3380,12 @@ FormatBlock(unsigned int blockOptions,
 	pageOffset = blockSize * currentBlock;
 	specialType = GetSpecialSectionType(buffer, page);
 
+	if (outputFormat != OUTPUT_TEXT && !isToast)
+	{
+		EmitBlock(buffer, page, currentBlock);
+		return;
+	}
+
 	if (!isToast || verbose)
 		printf("\n%sBlock %4u **%s***************************************\n",
 			   indent,
@@ -2208,7 +3662,7 @@ DumpFileContents(unsigned int blockOptions,
 	int				result = 0;
 	/* On a positive block size, allocate a local buffer to store
 	 * the subsequent blocks */
-	char		   *block = (char *)malloc(blockSize);
+	char		   *block = (char *)TrackedAlloc(blockSize);
 	if (!block)
 	{
 		printf("\nError: Unable to create buffer of size <%d>.\n",
@@ -2245,7 +3699,8 @@ DumpFileContents(unsigned int blockOptions,
 			 * subsequent read gets the error. */
 			if (initialRead)
 				printf("Error: Premature end of file encountered.\n");
-			else if (!(blockOptions & BLOCK_BINARY))
+			else if (!(blockOptions & BLOCK_BINARY) &&
+					 outputFormat == OUTPUT_TEXT)
 				printf("\n*** End of File Encountered. Last Block "
 					   "Read: %d ***\n", currentBlock - 1);
 
@@ -2253,6 +3708,11 @@ DumpFileContents(unsigned int blockOptions,
 		}
 		else
 		{
+			if (isToast)
+				dumpStats.toastBlocks++;
+			else
+				dumpStats.blocks++;
+
 			if (blockOptions & BLOCK_BINARY)
 				DumpBinaryBlock(block);
 			else
@@ -2283,7 +3743,7 @@ DumpFileContents(unsigned int blockOptions,
 			(currentBlock >= blockEnd) && (contentsToDump))
 		{
 			/* Don't print out message if we're doing a binary dump */
-			if (!(blockOptions & BLOCK_BINARY))
+			if (!(blockOptions & BLOCK_BINARY) && outputFormat == OUTPUT_TEXT)
 				printf("\n*** End of Requested Range Encountered. "
 					   "Last Block Read: %d ***\n", currentBlock);
 			contentsToDump = 0;
@@ -2298,7 +3758,7 @@ DumpFileContents(unsigned int blockOptions,
 			break;
 	}
 
-	free(block);
+	TrackedFree(block);
 
 	return result;
 }
@@ -2366,6 +3826,48 @@ PrintRelMappings(void)
 	return 1;
 }
 
+/* Print the counters collected while dumping, requested by --stats */
+static void
+PrintStats(void)
+{
+	printf("\n*** Statistics ***\n"
+		   "Blocks read:               " UINT64_FORMAT "\n"
+		   "Items:                     " UINT64_FORMAT "\n"
+		   "Items filtered out:        " UINT64_FORMAT "\n"
+		   "Tuples decoded:            " UINT64_FORMAT "\n"
+		   "TOAST blocks read:         " UINT64_FORMAT "\n"
+		   "TOAST values read:         " UINT64_FORMAT "\n"
+		   "TOAST cache hits:          " UINT64_FORMAT "\n"
+		   "TOAST cache misses:        " UINT64_FORMAT "\n"
+		   "Values over memory budget: " UINT64_FORMAT "\n"
+		   "Memory allocated:          %zu bytes\n"
+		   "Peak memory:               %zu bytes\n",
+		   dumpStats.blocks,
+		   dumpStats.items,
+		   dumpStats.itemsFiltered,
+		   dumpStats.tuples,
+		   dumpStats.toastBlocks,
+		   dumpStats.toastValues,
+		   dumpStats.toastCacheHits,
+		   dumpStats.toastCacheMisses,
+		   dumpStats.overBudget,
+		   MemoryTotal(),
+		   MemoryPeak());
+
+	if (maxMemory != 0)
+		printf("Memory budget:             %zu bytes\n", maxMemory);
+
+	if (numDedupKeys > 0)
+		printf("Rows after deduplication:  " UINT64_FORMAT "\n"
+			   "Versions superseded:       " UINT64_FORMAT "\n"
+			   "Versions of aborted xacts: " UINT64_FORMAT "\n"
+			   "Deduplication runs:        " UINT64_FORMAT "\n",
+			   dumpStats.dedupRows,
+			   dumpStats.dedupSuperseded,
+			   dumpStats.dedupAborted,
+			   dumpStats.dedupRuns);
+}
+
 /* Consume the options and iterate through the given file, formatting as
  * requested. */
 int
@@ -2380,6 +3882,12 @@ main(int argv, char **argc)
 	 * where encountered */
 	if (validOptions != OPT_RC_VALID)
 		DisplayOptions(validOptions);
+	else if (OutputWriterStart() != 0)
+		exitCode = 1;
+	else if (copyConninfo != NULL && CopySinkStart() != 0)
+		exitCode = 1;
+	else if (numFkKeys > 0 && FkCheckStart() != 0)
+		exitCode = 1;
 	else if (isRelMapFile)
 	{
 		CreateDumpFileHeader(argv, argc);
@@ -2388,7 +3896,9 @@ main(int argv, char **argc)
 	else
 	{
 		/* Don't dump the header if we're dumping binary pages */
-		if (!(blockOptions & BLOCK_BINARY))
+		if (outputFormat != OUTPUT_TEXT)
+			EmitOutputStart();
+		else if (!(blockOptions & BLOCK_BINARY))
 			CreateDumpFileHeader(argv, argc);
 
 		/* If the user has not forced a block size, use the size of the
@@ -2412,6 +3922,33 @@ main(int argv, char **argc)
 				0,    /* no toast external size */
 				NULL  /* no out toast value */
 				);
+
+		if (numDedupKeys > 0)
+			DedupFinish();
+
+		if (CopySinkFinish() != 0)
+			exitCode = 1;
+
+		/*
+		 * Values pointed to by tuples outside the scan would be reported as
+		 * orphaned: tuples of other blocks, segments or items left out by
+		 * the filters.  A full segment may be followed by another one.
+		 */
+		if (toastCheck &&
+			ToastCheckReport((blockOptions & (BLOCK_RANGE | BLOCK_IGNORE_OLD)) ||
+							 lpStateFilter != 0 || numInfomaskPredicates > 0 ||
+							 segmentNumber != 0 ||
+							 dumpStats.blocks >= segmentSize / blockSize) != 0)
+			exitCode = 1;
+
+		if (numUniqueKeys > 0 && UniqueCheckReport() != 0)
+			exitCode = 1;
+
+		if (numFkKeys > 0 && FkCheckReport() != 0)
+			exitCode = 1;
+
+		if (showStats)
+			PrintStats();
 	}
 
 	if (fp)
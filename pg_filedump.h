@@ -22,6 +22,9 @@
  * Original Author: Patrick Macdonald <patrickm@redhat.com>
  */
 
+#ifndef _PG_FILEDUMP_H_
+#define _PG_FILEDUMP_H_
+
 #define FD_VERSION	"17.1"		/* version ID of pg_filedump */
 #define FD_PG_VERSION	"PostgreSQL 8.x .. 17.x"		/* PG version it works with */
 
@@ -147,6 +150,44 @@ typedef enum optionReturnCodes
 
 extern char *fileName;
 
+/* -v: print the TOAST chunks read with -t */
+extern bool verbose;
+
+/* Largest value a varlena can hold, also used to sanity check TOAST sizes */
+#ifndef MaxAllocSize
+#define MaxAllocSize	((Size) 0x3fffffff) /* 1 gigabyte - 1 */
+#endif
+
+/* --max-memory: memory budget in bytes, 0 means unlimited */
+extern Size maxMemory;
+
+/* --toast-cache: size of the TOAST value cache in bytes, 0 disables it */
+#define DEFAULT_TOAST_CACHE_SIZE	(64 * 1024 * 1024)
+extern Size toastCacheSize;
+
+/* --toast-workers: threads reading TOAST values ahead, 0 disables them */
+extern int	toastWorkers;
+
+/* Counters reported by --stats */
+typedef struct DumpStats
+{
+	uint64		blocks;			/* blocks read from the dumped file */
+	uint64		items;			/* line pointers examined */
+	uint64		itemsFiltered;	/* items left out by --lp-state and --infomask */
+	uint64		tuples;			/* tuples decoded with -D */
+	uint64		toastBlocks;	/* blocks read from TOAST relations */
+	uint64		toastValues;	/* external values read with -t */
+	uint64		overBudget;		/* values skipped due to --max-memory */
+	uint64		toastCacheHits; /* external values found in the cache */
+	uint64		toastCacheMisses;	/* external values read from disk */
+	uint64		dedupRows;		/* rows output by --dedup-key */
+	uint64		dedupSuperseded;	/* versions replaced by a newer one */
+	uint64		dedupAborted;	/* versions of aborted transactions */
+	uint64		dedupRuns;		/* runs spilled to disk */
+} DumpStats;
+
+extern DumpStats dumpStats;
+
 /*
  * Function Prototypes
  */
@@ -155,3 +196,244 @@ int DumpFileContents(unsigned int blockOptions, unsigned int controlOptions,
 					 FILE *fp, unsigned int blockSize, int blockStart,
 					int blockEnd, bool isToast, Oid toastOid,
 					unsigned int toastExternalSize, char *toastValue);
+
+/* memory.c */
+void	   *TrackedAlloc(Size size);
+void	   *TrackedRealloc(void *ptr, Size size);
+void		TrackedFree(void *ptr);
+bool		MemoryBudgetAllows(Size size);
+Size		MemoryBudgetShare(Size limit);
+Size		MemoryInUse(void);
+Size		MemoryPeak(void);
+Size		MemoryTotal(void);
+
+/* toastcache.c */
+const char *ToastCacheLookup(Oid toastrelid, Oid valueid, Size *size);
+void		ToastCacheInsert(Oid toastrelid, Oid valueid, const char *data,
+							 Size size);
+void		ToastCacheRelease(Size size);
+bool		ToastCacheContains(Oid toastrelid, Oid valueid);
+void		ToastCacheNoteShared(Oid toastrelid, Oid valueid);
+
+/* toastfetch.c */
+
+/* Location of a chunk's data in a TOAST relation */
+typedef struct ToastChunk
+{
+	Oid			valueid;
+	int32		seq;
+	BlockNumber blkno;
+	uint16		offset;			/* of the chunk data within the block */
+	uint16		size;			/* of the chunk data */
+} ToastChunk;
+
+void		ToastRelationPath(Oid relid, char *path);
+const ToastChunk *ToastRelationChunks(Oid relid, int *nchunks);
+int			ToastFetchValue(Oid relid, Oid valueid, int32 extsize, char *dest);
+void		ToastPrefetchAdd(const struct varatt_external *pointer);
+void		ToastPrefetchStart(void);
+bool		ToastPrefetchTake(Oid toastrelid, Oid valueid, char **value,
+							  Size *size);
+void		ToastPrefetchFinish(void);
+
+/* toastcheck.c */
+extern bool toastCheck;
+void		ToastCheckCollect(const char *tupleData, unsigned int tupleSize,
+							  BlockNumber blkno, OffsetNumber offnum);
+int			ToastCheckReport(bool partial);
+
+/* Most columns --dedup-key, --unique-check and --fk-check accept */
+#define MAX_KEY_COLUMNS	32
+
+/* Receives the keys of another relation read by ScanRelationKeys() */
+typedef void (*RelationKeyCallback) (const char *key, int len, uint64 entries,
+									 BlockNumber blkno, OffsetNumber offnum);
+
+int			ScanRelationKeys(const char *path, const int *columns, int ncolumns,
+							 RelationKeyCallback add_key);
+
+/* Heap tuple flags, named as in the -i output */
+typedef struct InfomaskFlag
+{
+	const char *name;
+	uint16		mask;
+	bool		infomask2;		/* flag of t_infomask2 */
+} InfomaskFlag;
+
+extern const InfomaskFlag infomaskFlags[];
+
+/* structout.c */
+
+/* Possible values of --output-format */
+typedef enum outputFormats
+{
+	OUTPUT_TEXT,				/* Formatted text dump */
+	OUTPUT_JSON,				/* One JSON object per page and item */
+	OUTPUT_BINARY				/* Length-prefixed binary records */
+} outputFormats;
+
+extern int	outputFormat;
+
+/* Header fields of a page for --output-format */
+typedef struct PageRecord
+{
+	BlockNumber blkno;
+	bool		partial;		/* fewer bytes than the block size read */
+	bool		headerComplete; /* false if the block ends within the header */
+	bool		headerValid;
+	bool		checksumVerified;	/* -k given */
+	uint64		lsn;
+	uint16		checksum;
+	uint16		calculatedChecksum;
+	uint16		flags;
+	uint16		lower;
+	uint16		upper;
+	uint16		special;
+	uint16		pageSize;
+	uint8		version;
+	TransactionId pruneXid;
+	uint16		items;
+	unsigned int specialType;
+} PageRecord;
+
+/* Line pointer and tuple header fields of an item for --output-format */
+typedef struct ItemRecord
+{
+	BlockNumber blkno;
+	OffsetNumber offnum;
+	uint16		lpOffset;
+	uint16		lpLength;
+	uint8		lpFlags;
+	bool		beyondBlock;	/* item extends beyond the block */
+	bool		isHeap;			/* the fields below are set */
+	TransactionId xmin;
+	TransactionId xmax;
+	uint32		field3;			/* cmin, cmax or xvac */
+	BlockNumber ctidBlock;
+	OffsetNumber ctidOffset;
+	uint16		infomask;
+	uint16		infomask2;
+	uint8		hoff;
+} ItemRecord;
+
+void		EmitOutputStart(void);
+void		EmitPageRecord(const PageRecord *rec);
+void		EmitItemRecord(const ItemRecord *rec);
+
+/* outputwriter.c */
+
+/* Possible values of --compress */
+typedef enum outputCompressions
+{
+	OUTPUT_COMPRESS_NONE,		/* Plain output */
+	OUTPUT_COMPRESS_ZSTD,		/* zstd frames */
+	OUTPUT_COMPRESS_LZ4,		/* lz4 frames */
+	OUTPUT_COMPRESS_GZIP		/* gzip members */
+} outputCompressions;
+
+extern int	outputCompression;
+extern uint64 outputSplitSize;
+extern char *outputPath;
+
+/* Smallest --split-size, leaving room for a compressed chunk */
+#define MIN_SPLIT_SIZE	(1024 * 1024)
+
+int			OutputCompressionMethod(const char *name);
+int			OutputWriterStart(void);
+
+/* copysink.c */
+
+/* --copy-target and --copy-table: copy decoded rows into a table */
+extern char *copyConninfo;
+extern char *copyTable;
+
+int			CopySinkStart(void);
+void		CopySinkRow(const char *row, int len);
+int			CopySinkFinish(void);
+
+/* keytable.c */
+
+/*
+ * Entry of a KeyTable, the last member of the entry struct of the caller
+ * and followed by the key
+ */
+typedef struct KeyEntry
+{
+	struct KeyEntry *next;		/* next entry of the bucket */
+	uint32		hash;
+	uint32		keyLen;
+} KeyEntry;
+
+#define KeyEntryKey(entry)	((char *) ((entry) + 1))
+
+/* Entry struct of the given type holding a KeyEntry as member */
+#define KeyEntryContainer(type, member, entry) \
+	((type *) ((char *) (entry) - offsetof(type, member)))
+
+/* Chained hash table on keys */
+typedef struct KeyTable
+{
+	KeyEntry  **buckets;
+	uint32		numBuckets;
+	uint32		numEntries;
+	Size		memoryUsed;		/* by the buckets and entries */
+} KeyTable;
+
+void	   *KeyTableAlloc(Size size);
+void	   *KeyTableRealloc(void *ptr, Size size);
+KeyEntry  **KeyTableFind(KeyTable *table, const char *key, uint32 keyLen,
+						 uint32 hash);
+void		KeyTableInsert(KeyTable *table, KeyEntry **link, KeyEntry *entry,
+						   const char *key, uint32 keyLen, uint32 hash,
+						   Size size);
+bool		KeyTableFull(const KeyTable *table, Size limit);
+KeyEntry  **KeyTableTake(KeyTable *table, uint32 *count);
+FILE	   *SpillFileCreate(void);
+void		SpillFileWrite(FILE *file, const void *data, Size size);
+void		SpillFileRewind(FILE *file);
+bool		SpillFileNext(FILE *file, void *header, Size size);
+void		SpillFileRead(FILE *file, void *data, Size size);
+
+/* dedup.c */
+
+
+/* Possible values of --dedup-by */
+typedef enum dedupOrders
+{
+	DEDUP_BY_XMIN,				/* Newest xmin wins */
+	DEDUP_BY_LSN				/* Newest page LSN wins, then xmin */
+} dedupOrders;
+
+extern int	dedupKeys[MAX_KEY_COLUMNS];
+extern int	numDedupKeys;
+extern int	dedupBy;
+extern Size dedupMemory;
+extern XLogRecPtr dedupPageLsn;
+
+void		DedupAddRow(const char *row, int len, HeapTupleHeader header);
+void		DedupFinish(void);
+
+/* uniquecheck.c */
+extern int	uniqueKeys[MAX_KEY_COLUMNS];
+extern int	numUniqueKeys;
+extern char *uniqueIndexPath;
+extern Size uniqueMemory;
+
+void		UniqueCheckCollect(const char *tupleData, unsigned int tupleSize,
+							   BlockNumber blkno, OffsetNumber offnum);
+int			UniqueCheckReport(void);
+
+/* fkcheck.c */
+extern int	fkKeys[MAX_KEY_COLUMNS];
+extern int	numFkKeys;
+extern char *fkRefPath;
+extern char *fkRefTypes;
+extern int	fkRefKeys[MAX_KEY_COLUMNS];
+extern int	numFkRefKeys;
+
+int			FkCheckStart(void);
+void		FkCheckCollect(const char *tupleData, unsigned int tupleSize,
+						   BlockNumber blkno, OffsetNumber offnum);
+int			FkCheckReport(void);
+
+#endif
@@ -4,12 +4,11 @@
  */
 
 #include "postgres.h"
+#include "pg_filedump.h"
 #include <lib/stringinfo.h>
 #include <string.h>
 #include <assert.h>
 
-#define MaxAllocSize	((Size) 0x3fffffff) /* 1 gigabyte - 1 */
-
 /*-------------------------
  * StringInfoData holds information about an extensible string.
  *	  data	  is the current buffer for the string.
@@ -37,7 +36,12 @@ initStringInfo(StringInfo str)
 {
 	int			size = 1024;	/* initial default buffer size */
 
-	str->data = (char *) malloc(size);
+	str->data = (char *) TrackedAlloc(size);
+	if (str->data == NULL)
+	{
+		printf("Error: malloc() failed!\n");
+		exit(1);
+	}
 	str->maxlen = size;
 	resetStringInfo(str);
 }
@@ -159,11 +163,21 @@ enlargeStringInfo(StringInfo str, int needed)
 	if (newlen > limit)
 		newlen = limit;
 
+	/* Cached TOAST values give way to the data being decoded */
+	ToastCacheRelease(newlen - str->maxlen);
+	if (!MemoryBudgetAllows(newlen - str->maxlen))
+	{
+		printf("Error: cannot enlarge string buffer containing %d bytes to %zu bytes "
+			   "within memory budget of %zu bytes.\n",
+			   str->len, newlen, maxMemory);
+		exit(1);
+	}
+
 	old_data = str->data;
-	str->data = (char *) realloc(str->data, (Size) newlen);
+	str->data = (char *) TrackedRealloc(str->data, newlen);
 	if (str->data == NULL)
 	{
-		free(old_data);
+		TrackedFree(old_data);
 		printf("Error: realloc() failed!\n");
 		exit(1);
 	}
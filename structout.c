@@ -0,0 +1,277 @@
+/*
+ * Structured output of page and item metadata for pg_filedump
+ *
+ * With --output-format json or binary, FormatBlock() hands the header
+ * fields of each page and the line pointer and tuple header fields of each
+ * item to the functions here instead of printing them as text, so tools
+ * can read them without parsing the formatted dump.  json writes one
+ * object per line.  binary writes a magic followed by records of a 4 byte
+ * length and a body starting with a type byte, all integers little
+ * endian; readers must skip bytes past the fields they know, which
+ * may be added to the end of a body later.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+
+/* --output-format: text, json or binary */
+int			outputFormat = OUTPUT_TEXT;
+
+/* Start of a binary stream: "PGFDUMP" and the format version */
+static const char binaryMagic[8] = {'P', 'G', 'F', 'D', 'U', 'M', 'P', 1};
+
+/* Record types of the binary format */
+#define RECORD_PAGE		'P'
+#define RECORD_ITEM		'I'
+
+/* Page record status bits of the binary format */
+#define PAGE_PARTIAL			0x01	/* fewer bytes than the block size read */
+#define PAGE_HEADER_TRUNCATED	0x02	/* block ends within the header */
+#define PAGE_HEADER_INVALID		0x04	/* header fails the sanity checks */
+#define PAGE_CHECKSUM_VERIFIED	0x08	/* -k given */
+#define PAGE_CHECKSUM_FAILED	0x10	/* checksum does not match */
+
+/* Item record status bits of the binary format */
+#define ITEM_BEYOND_BLOCK		0x01	/* item extends beyond the block */
+#define ITEM_HEAP_TUPLE			0x02	/* tuple header fields follow */
+
+/* Largest record body, rounded up */
+#define MAX_RECORD_SIZE			64
+
+static const char *const lpFlagNames[4] = {
+	"UNUSED", "NORMAL", "REDIRECT", "DEAD"
+};
+
+static const char *
+SpecialTypeName(unsigned int type)
+{
+	switch (type)
+	{
+		case SPEC_SECT_NONE:
+			return "none";
+		case SPEC_SECT_SEQUENCE:
+			return "sequence";
+		case SPEC_SECT_INDEX_BTREE:
+			return "btree";
+		case SPEC_SECT_INDEX_HASH:
+			return "hash";
+		case SPEC_SECT_INDEX_GIST:
+			return "gist";
+		case SPEC_SECT_INDEX_GIN:
+			return "gin";
+		case SPEC_SECT_INDEX_SPGIST:
+			return "spgist";
+		case SPEC_SECT_ERROR_BOUNDARY:
+			return "boundary_error";
+		default:
+			return "unknown";
+	}
+}
+
+/* Little endian writers for binary record bodies */
+static char *
+PutUint8(char *p, uint8 value)
+{
+	*p++ = (char) value;
+	return p;
+}
+
+static char *
+PutUint16(char *p, uint16 value)
+{
+	*p++ = (char) (value & 0xff);
+	*p++ = (char) (value >> 8);
+	return p;
+}
+
+static char *
+PutUint32(char *p, uint32 value)
+{
+	p = PutUint16(p, (uint16) (value & 0xffff));
+	return PutUint16(p, (uint16) (value >> 16));
+}
+
+static char *
+PutUint64(char *p, uint64 value)
+{
+	p = PutUint32(p, (uint32) (value & 0xffffffff));
+	return PutUint32(p, (uint32) (value >> 32));
+}
+
+/* Write a binary record of the body from body to end */
+static void
+WriteRecord(const char *body, const char *end)
+{
+	char		length[4];
+
+	PutUint32(length, (uint32) (end - body));
+	fwrite(length, 1, sizeof(length), stdout);
+	fwrite(body, 1, end - body, stdout);
+}
+
+/* Begin the output, before the first page */
+void
+EmitOutputStart(void)
+{
+	if (outputFormat == OUTPUT_BINARY)
+		fwrite(binaryMagic, 1, sizeof(binaryMagic), stdout);
+}
+
+/* Emit the header fields of a page */
+void
+EmitPageRecord(const PageRecord *rec)
+{
+	if (outputFormat == OUTPUT_BINARY)
+	{
+		char		body[MAX_RECORD_SIZE];
+		char	   *p = body;
+		uint8		status = 0;
+
+		if (rec->partial)
+			status |= PAGE_PARTIAL;
+		if (!rec->headerComplete)
+			status |= PAGE_HEADER_TRUNCATED;
+		else if (!rec->headerValid)
+			status |= PAGE_HEADER_INVALID;
+		if (rec->checksumVerified)
+		{
+			status |= PAGE_CHECKSUM_VERIFIED;
+			if (rec->calculatedChecksum != rec->checksum)
+				status |= PAGE_CHECKSUM_FAILED;
+		}
+
+		p = PutUint8(p, RECORD_PAGE);
+		p = PutUint32(p, rec->blkno);
+		p = PutUint8(p, status);
+		p = PutUint64(p, rec->lsn);
+		p = PutUint16(p, rec->checksum);
+		p = PutUint16(p, rec->calculatedChecksum);
+		p = PutUint16(p, rec->flags);
+		p = PutUint16(p, rec->lower);
+		p = PutUint16(p, rec->upper);
+		p = PutUint16(p, rec->special);
+		p = PutUint16(p, rec->pageSize);
+		p = PutUint8(p, rec->version);
+		p = PutUint32(p, rec->pruneXid);
+		p = PutUint16(p, rec->items);
+		p = PutUint8(p, (uint8) rec->specialType);
+		WriteRecord(body, p);
+		return;
+	}
+
+	printf("{\"type\":\"page\",\"block\":%u,\"partial\":%s", rec->blkno,
+		   rec->partial ? "true" : "false");
+
+	if (!rec->headerComplete)
+	{
+		printf(",\"header_complete\":false}\n");
+		return;
+	}
+
+	printf(",\"lsn\":\"%X/%X\",\"checksum\":%u",
+		   (uint32) (rec->lsn >> 32), (uint32) rec->lsn, rec->checksum);
+	if (rec->checksumVerified)
+		printf(",\"calculated_checksum\":%u,\"checksum_ok\":%s",
+			   rec->calculatedChecksum,
+			   rec->calculatedChecksum == rec->checksum ? "true" : "false");
+
+	printf(",\"flags\":%u,\"flag_names\":[", rec->flags);
+	{
+		const char *sep = "";
+
+		if (rec->flags & PD_HAS_FREE_LINES)
+		{
+			printf("%s\"HAS_FREE_LINES\"", sep);
+			sep = ",";
+		}
+		if (rec->flags & PD_PAGE_FULL)
+		{
+			printf("%s\"PAGE_FULL\"", sep);
+			sep = ",";
+		}
+		if (rec->flags & PD_ALL_VISIBLE)
+			printf("%s\"ALL_VISIBLE\"", sep);
+	}
+
+	printf("],\"lower\":%u,\"upper\":%u,\"special\":%u,\"page_size\":%u"
+		   ",\"version\":%u,\"prune_xid\":%u,\"items\":%u"
+		   ",\"special_type\":\"%s\",\"header_valid\":%s}\n",
+		   rec->lower, rec->upper, rec->special, rec->pageSize,
+		   rec->version, rec->pruneXid, rec->items,
+		   SpecialTypeName(rec->specialType),
+		   rec->headerValid ? "true" : "false");
+}
+
+/* Emit the line pointer and, for heap tuples, tuple header fields of an
+ * item */
+void
+EmitItemRecord(const ItemRecord *rec)
+{
+	if (outputFormat == OUTPUT_BINARY)
+	{
+		char		body[MAX_RECORD_SIZE];
+		char	   *p = body;
+		uint8		status = 0;
+
+		if (rec->beyondBlock)
+			status |= ITEM_BEYOND_BLOCK;
+		if (rec->isHeap)
+			status |= ITEM_HEAP_TUPLE;
+
+		p = PutUint8(p, RECORD_ITEM);
+		p = PutUint32(p, rec->blkno);
+		p = PutUint16(p, rec->offnum);
+		p = PutUint16(p, rec->lpOffset);
+		p = PutUint16(p, rec->lpLength);
+		p = PutUint8(p, rec->lpFlags);
+		p = PutUint8(p, status);
+		if (rec->isHeap)
+		{
+			p = PutUint32(p, rec->xmin);
+			p = PutUint32(p, rec->xmax);
+			p = PutUint32(p, rec->field3);
+			p = PutUint32(p, rec->ctidBlock);
+			p = PutUint16(p, rec->ctidOffset);
+			p = PutUint16(p, rec->infomask);
+			p = PutUint16(p, rec->infomask2);
+			p = PutUint8(p, rec->hoff);
+		}
+		WriteRecord(body, p);
+		return;
+	}
+
+	printf("{\"type\":\"item\",\"block\":%u,\"item\":%u,\"offset\":%u"
+		   ",\"length\":%u,\"lp_flags\":\"%s\"",
+		   rec->blkno, rec->offnum, rec->lpOffset, rec->lpLength,
+		   lpFlagNames[rec->lpFlags & 0x03]);
+
+	if (rec->beyondBlock)
+		printf(",\"beyond_block\":true");
+
+	if (rec->isHeap)
+	{
+		const InfomaskFlag *f;
+		const char *sep = "";
+
+		printf(",\"xmin\":%u,\"xmax\":%u,\"field3\":%u,\"ctid\":[%u,%u]"
+			   ",\"infomask\":%u,\"infomask2\":%u,\"infomask_flags\":[",
+			   rec->xmin, rec->xmax, rec->field3, rec->ctidBlock,
+			   rec->ctidOffset, rec->infomask, rec->infomask2);
+
+		for (f = infomaskFlags; f->name != NULL; f++)
+		{
+			uint16		bits = f->infomask2 ? rec->infomask2 : rec->infomask;
+
+			if ((bits & f->mask) == f->mask)
+			{
+				printf("%s\"%s\"", sep, f->name);
+				sep = ",";
+			}
+		}
+
+		printf("],\"natts\":%u,\"hoff\":%u",
+			   rec->infomask2 & HEAP_NATTS_MASK, rec->hoff);
+	}
+
+	printf("}\n");
+}
@@ -7,7 +7,10 @@ use PostgreSQL::Test::Cluster;
 use PostgreSQL::Test::Utils;
 use Test::More;
 use File::Spec;
+use File::Copy;
 use IPC::Run qw( run timeout );
+use JSON::PP;
+use IO::Uncompress::Gunzip qw( gunzip );
 
 
 note "setting up PostgreSQL instance";
@@ -33,6 +36,25 @@ test_basic_output();
 test_btree_output();
 test_spgist_output();
 test_gin_output();
+test_memory_budget();
+test_float_output();
+test_bytea_output();
+test_jsonb_output();
+test_array_output();
+test_extra_types_output();
+test_generic_descriptors();
+test_record_output();
+test_raw_modifier();
+test_toast_cache();
+test_toast_prefetch();
+test_toast_check();
+test_item_filters();
+test_output_format();
+test_copy_target();
+test_dedup();
+test_unique_check();
+test_fk_check();
+test_output_writer();
 
 $node->stop;
 done_testing();
@@ -128,3 +150,598 @@ sub test_gin_output
     ok($out_ =~ qr/GIN Index Section/, "GIN Index Section found");
     ok($out_ =~ qr/ItemPointer   3/, "Item found");
 }
+
+sub test_memory_budget
+{
+    my $query = qq(
+        create table t3(a int, b text, c text);
+        alter table t3 alter column c set storage external;
+        insert into t3 values (1, repeat('x', 100000), repeat('y', 100000));
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t3', ('-D', 'int,text,text', '-t', '--stats'));
+
+    ok($out_ =~ qr/COPY: 1\tx+\ty+\n/, "values decoded");
+    ok($out_ =~ qr/Tuples decoded: +1\n/, "tuple count found");
+    ok($out_ =~ qr/TOAST values read: +1\n/, "TOAST value count found");
+    ok($out_ =~ qr/Peak memory: +\d+ bytes/, "peak memory found");
+
+    $out_ = run_pg_filedump('t3', ('-D', 'int,text,text', '-t', '--stats',
+                                   '--max-memory', '64kB'));
+
+    ok($out_ =~ qr/COPY: 1\t\(inline compressed, exceeds memory budget\)\t\(TOAST value exceeds memory budget\)/,
+       "values over budget skipped");
+    ok($out_ =~ qr/Values over memory budget: +2\n/, "skipped values counted");
+}
+
+sub test_float_output
+{
+    my $query = qq(
+        create table t4(a float4, b float8);
+        insert into t4 values (0.1, 0.1), (1e-40, 5e-324), (3.4028235e38, 1.7976931348623157e308),
+                              (-1.5, 123456.789), ('NaN', '-Infinity');
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t4', ('-D', 'float4,float8'));
+
+    ok($out_ =~ qr/COPY: 0.1\t0.1\n/, "shortest float found");
+    ok($out_ =~ qr/COPY: 1e-40\t5e-324\n/, "denormal floats found");
+    ok($out_ =~ qr/COPY: 3.4028235e\+38\t1.7976931348623157e\+308\n/, "maximum floats found");
+    ok($out_ =~ qr/COPY: -1.5\t123456.789\n/, "exact floats found");
+    ok($out_ =~ qr/COPY: NaN\t-Infinity\n/, "special floats found");
+}
+
+sub test_bytea_output
+{
+    my $query = qq(
+        create table t5(a bytea, b int);
+        insert into t5 values ('\\x00ff10', 1), ('', 2),
+            (decode(repeat('0123456789abcdeffedcba9876543210', 2), 'hex'), 3),
+            (decode(repeat('deadbeef', 2000), 'hex'), 4);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t5', ('-D', 'bytea,int'));
+
+    ok($out_ =~ qr/COPY: \\\\x00ff10\t1\n/, "short bytea found");
+    ok($out_ =~ qr/COPY: \\\\x\t2\n/, "empty bytea found");
+    ok($out_ =~ qr/COPY: \\\\x(0123456789abcdeffedcba9876543210){2}\t3\n/, "hex digits found");
+    ok($out_ =~ qr/COPY: \\\\x(deadbeef){2000}\t4\n/, "compressed bytea found");
+}
+
+sub test_jsonb_output
+{
+    my $query = qq(
+        create table t6(a jsonb, b int);
+        insert into t6 values ('{"b": [1, 2.5, null], "a": {"c": true}}', 1),
+            ('"line\\nbreak \\"quoted\\""', 2), ('[]', 3),
+            ((select jsonb_agg(g) from generate_series(1, 40) g), 4),
+            ((select jsonb_object_agg('key' || g, repeat('x', 100)) from generate_series(1, 100) g), 5);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t6', ('-D', 'jsonb,int'));
+
+    ok($out_ =~ qr/COPY: \{"a": \{"c": true\}, "b": \[1, 2.5, null\]\}\t1\n/, "jsonb object found");
+    ok($out_ =~ qr/COPY: "line\\\\nbreak \\\\"quoted\\\\""\t2\n/, "jsonb string found");
+    ok($out_ =~ qr/COPY: \[\]\t3\n/, "empty jsonb array found");
+    ok($out_ =~ qr/COPY: \[1, 2, 3, (\d+, ){36}40\]\t4\n/, "long jsonb array found");
+    ok($out_ =~ qr/COPY: \{"key1": "x{100}", "key2": "x{100}", .*"key100": "x{100}"\}\t5\n/, "compressed jsonb found");
+}
+
+sub test_array_output
+{
+    my $query = qq(
+        create table t7(a int[], b text[], c uuid[], d int);
+        insert into t7 values
+            ('{1,2,3}', '{a,"b c",NULL,""}', '{a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11}', 1),
+            ('{{1,NULL},{3,4}}', '{"x\\"y"}', NULL, 2),
+            ('[0:1]={5,6}', '{}', '{}', 3),
+            (array_fill(7, ARRAY[3000]), NULL, NULL, 4);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t7', ('-D', 'int[],text[],uuid[],int'));
+
+    ok($out_ =~ qr/COPY: \{1,2,3\}\t\{a,"b c",NULL,""\}\t\{a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11\}\t1\n/, "arrays found");
+    ok($out_ =~ qr/COPY: \{\{1,NULL\},\{3,4\}\}\t\{"x\\\\"y"\}\t\\N\t2\n/, "two-dimensional array with nulls found");
+    ok($out_ =~ qr/COPY: \[0:1\]=\{5,6\}\t\{\}\t\{\}\t3\n/, "lower bound and empty arrays found");
+    ok($out_ =~ qr/COPY: \{(7,){2999}7\}\t\\N\t\\N\t4\n/, "compressed array found");
+}
+
+sub test_extra_types_output
+{
+    my $query = qq(
+        set lc_monetary = 'C';
+        create type mood as enum ('sad', 'happy');
+        create table t8(a interval, b inet, c cidr, d money, e bit(4), f varbit,
+                        g mood, h int);
+        insert into t8 values
+            ('1 year 2 mons 3 days 04:05:06.789', '192.168.0.1', '10.0.0.0/8',
+             -1234.56, B'1010', B'110', 'happy', 1),
+            ('-1 days +02:00:00', '2001:db8::1/64', '::ffff:1.2.3.0/120',
+             0, B'0000', B'', 'sad', 2),
+            ('0', '::1', '192.168.1.0/24', 1000000, B'1111',
+             B'10000000011', 'happy', 3);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t8', ('-D', 'interval,inet,cidr,money,bit,varbit,enum,int'));
+
+    ok($out_ =~ qr/COPY: 1 year 2 mons 3 days 04:05:06.789\t192.168.0.1\t10.0.0.0\/8\t-\$1,234.56\t1010\t110\t\d+\t1\n/, "first row found");
+    ok($out_ =~ qr/COPY: -1 days \+02:00:00\t2001:db8::1\/64\t::ffff:1.2.3.0\/120\t\$0.00\t0000\t\t\d+\t2\n/, "second row found");
+    ok($out_ =~ qr/COPY: 00:00:00\t::1\t192.168.1.0\/24\t\$1,000,000.00\t1111\t10000000011\t\d+\t3\n/, "third row found");
+}
+
+sub test_generic_descriptors
+{
+    my $query = qq(
+        create table t9(a int, b point, c tsvector, d text, e int);
+        insert into t9 values (1, '(1,2)', 'a fat cat', 'abc', 2),
+            (3, NULL, NULL, NULL, 4);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t9', ('-D', 'int,skip:16:d,skip:-1:i,raw:-1:i,int'));
+
+    ok($out_ =~ qr/COPY: 1\t\\\\x616263\t2\n/, "skipped and raw columns found");
+    ok($out_ =~ qr/COPY: 3\t\\N\t4\n/, "skipped null columns found");
+
+    $out_ = run_pg_filedump('t9', ('-D', 'int,raw:16:d,~'));
+    ok($out_ =~ qr/COPY: 1\t\\\\x[0-9a-f]{32}\n/, "raw fixed-width column found");
+}
+
+sub test_record_output
+{
+    my $query = qq(
+        create type pair as (a int, b text);
+        create domain posint as int check (value > 0);
+        create table t10(p pair, q pair[], d posint, n int);
+        insert into t10 values (row(1, 'abc'), array[row(1, 'abc'), row(2, NULL)]::pair[], 5, 1),
+            (row(2, 'x y'), NULL, NULL, 2),
+            (row(NULL, NULL), '{}', 7, 3);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t10', ('-D', 'record(int,text),record(int,text)[],int,int'));
+
+    ok($out_ =~ qr/COPY: \(1,abc\)\t\{"\(1,abc\)","\(2,\)"\}\t5\t1\n/, "first row found");
+    ok($out_ =~ qr/COPY: \(2,"x y"\)\t\\N\t\\N\t2\n/, "second row found");
+    ok($out_ =~ qr/COPY: \(,\)\t\{\}\t7\t3\n/, "third row found");
+
+    $out_ = run_pg_filedump('t10', ('-D', 'record(int,text),~'));
+    ok($out_ =~ qr/COPY: \(2,"x y"\)\n/, "record followed by ignored columns found");
+}
+
+sub test_raw_modifier
+{
+    my $query = qq(
+        create table t11(a int, b text);
+        insert into t11 values (1, 'abc');
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t11', ('-D', 'int,text:raw'));
+    ok($out_ =~ qr/COPY: 1\t\\\\x616263\n/, "raw column found");
+
+    $out_ = run_pg_filedump('t11', ('-D', 'int,text:raw:base64'));
+    ok($out_ =~ qr/COPY: 1\tYWJj\n/, "base64 column found");
+
+    $out_ = run_pg_filedump('t11', ('-D', 'int,text:raw:stored'));
+    ok($out_ =~ qr/COPY: 1\t\\\\x09616263\n/, "stored column found");
+}
+
+sub test_toast_cache
+{
+    my $query = qq(
+        create table t12(a int, b text);
+        alter table t12 alter column b set storage external;
+        insert into t12 values (1, repeat('z', 100000));
+        update t12 set a = 2;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t12', ('-D', 'int,text', '-t', '--stats'));
+
+    ok($out_ =~ qr/COPY: 1\tz+\n/, "old version decoded");
+    ok($out_ =~ qr/COPY: 2\tz+\n/, "new version decoded");
+    ok($out_ =~ qr/TOAST cache hits: +1\n/, "TOAST cache hit counted");
+    ok($out_ =~ qr/TOAST cache misses: +1\n/, "TOAST cache miss counted");
+
+    $out_ = run_pg_filedump('t12', ('-D', 'int,text', '-t', '--stats',
+                                    '--toast-workers', '0'));
+
+    ok($out_ =~ qr/TOAST cache hits: +0\n/,
+       "TOAST value cached only once seen twice");
+
+    $out_ = run_pg_filedump('t12', ('-D', 'int,text', '-t', '--stats',
+                                    '--toast-cache', '0'));
+
+    ok($out_ =~ qr/COPY: 2\tz+\n/, "new version decoded without cache");
+    ok($out_ =~ qr/TOAST cache hits: +0\n/, "TOAST cache disabled");
+}
+
+sub test_toast_prefetch
+{
+    my $query = qq(
+        create table t13(a int, b text, c text, d text);
+        alter table t13 alter column b set storage external;
+        insert into t13 select g, repeat('x', 3000 * g), g::text,
+            string_agg(md5(g::text || h::text), '')
+            from generate_series(1, 20) g, generate_series(1, 200) h
+            group by g;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $serial = run_pg_filedump('t13', ('-D', 'int,text,text,text', '-t',
+                                         '--toast-workers', '0'));
+    my $parallel = run_pg_filedump('t13', ('-D', 'int,text,text,text', '-t',
+                                           '--toast-workers', '4'));
+
+    my @serial = $serial =~ /^(COPY: .*)$/mg;
+    my @parallel = $parallel =~ /^(COPY: .*)$/mg;
+
+    is(scalar(@serial), 20, "all rows decoded without TOAST workers");
+    is_deeply(\@parallel, \@serial, "same rows decoded with TOAST workers");
+    ok($serial =~ qr/^COPY: 20\tx{60000}\t20\t[0-9a-f]{6400}$/m,
+       "external and compressed values decoded");
+
+    $serial = run_pg_filedump('t13', ('-D', 'int,text,text,text', '-t',
+                                      '--max-memory', '64kB',
+                                      '--toast-workers', '0'));
+    $parallel = run_pg_filedump('t13', ('-D', 'int,text,text,text', '-t',
+                                        '--max-memory', '64kB',
+                                        '--toast-workers', '4'));
+
+    @serial = $serial =~ /^(COPY: .*)$/mg;
+    @parallel = $parallel =~ /^(COPY: .*)$/mg;
+
+    is(scalar(@serial), 20, "all rows decoded within memory budget");
+    is_deeply(\@parallel, \@serial,
+              "same values skipped with TOAST workers");
+    ok($parallel =~ qr/^COPY: 10\t\(TOAST value exceeds memory budget\)\t10\t/m,
+       "prefetched value over budget skipped");
+}
+
+sub test_toast_check
+{
+    my $query = qq(
+        create table t14(a int, b text);
+        alter table t14 alter column b set storage external;
+        insert into t14 select g, repeat('y', 50000) from generate_series(1, 3) g;
+        update t14 set a = 4 where a = 3;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t14', ('-D', 'int,text', '--toast-check'));
+
+    ok($out_ !~ qr/COPY:/, "tuples not printed");
+    ok($out_ =~ qr/TOAST pointers: +4\n/, "TOAST pointers collected");
+    ok($out_ =~ qr/TOAST values: +3\n/, "shared TOAST value counted once");
+    ok($out_ =~ qr/Incomplete values: +0\n/, "no incomplete TOAST values");
+    ok($out_ =~ qr/Orphaned values: +0\n/, "no orphaned TOAST values");
+
+    $out_ = run_pg_filedump('t14', ('-D', 'int,skip:-1:i', '--toast-check'));
+
+    ok($out_ =~ qr/TOAST pointers: +4\n/, "TOAST pointers of skipped column collected");
+    ok($out_ =~ qr/Orphaned values: +0\n/, "no orphans with skipped column");
+
+    my ($stdout, $stderr);
+    run [ 'pg_filedump', '-D', 'int,~', '--toast-check', get_table_location('t14') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    ok($stdout =~ qr/Error: Option <--toast-check> requires <D> without <~>/,
+       "undecoded columns rejected");
+
+    # Values of deleted rows are left behind when the TOAST table is not vacuumed
+    $query = qq(
+        create table t14o(a int, b text);
+        alter table t14o alter column b set storage external;
+        insert into t14o select g, repeat('o', 50000) from generate_series(1, 2) g;
+        delete from t14o where a = 2;
+        vacuum (process_toast false) t14o;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    run [ 'pg_filedump', '-D', 'int,text', '--toast-check', get_table_location('t14o') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 1, "orphaned value found");
+    ok($stdout =~ qr/^TOAST value \d+ in relation \d+: referenced by no heap tuple$/m,
+       "orphaned value reported");
+    ok($stdout =~ qr/Orphaned values: +1\n/, "orphaned value counted");
+
+    # Values of tuples outside the range are not taken for orphans
+    $query = qq(
+        create table t14r(a int, b text);
+        alter table t14r alter column b set storage external;
+        insert into t14r select g, repeat('r', 50000) from generate_series(1, 2) g;
+        insert into t14r select g, repeat('r', 8000) from generate_series(3, 1000) g;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    run [ 'pg_filedump', '-D', 'int,text', '--toast-check', '-R', '0',
+          get_table_location('t14r') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 0, "no orphans reported for a block range");
+    ok($stdout =~ qr/Orphaned values not checked/, "partial scan noted");
+
+    # Copy a heap with a TOAST file that lacks its last block
+    $query = qq(
+        create table t14m(a int, b text);
+        alter table t14m alter column b set storage external;
+        insert into t14m values (1, repeat('m', 50000));
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $dir = PostgreSQL::Test::Utils::tempdir;
+    my $toastrelid = $node->safe_psql('postgres',
+        qq(SELECT reltoastrelid FROM pg_class WHERE relname = 't14m';));
+    my $toast = File::Spec->catfile($dir, $toastrelid);
+    my $heap = File::Spec->catfile($dir, 't14m');
+
+    copy(get_table_location('t14m'), $heap) or die "copy failed: $!";
+    copy(File::Spec->catfile($node->data_dir,
+            $node->safe_psql('postgres', qq(SELECT pg_relation_filepath($toastrelid);))),
+         $toast) or die "copy failed: $!";
+    truncate($toast, (-s $toast) - 8192) or die "truncate failed: $!";
+
+    run [ 'pg_filedump', '-D', 'int,text', '--toast-check', $heap ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 1, "incomplete value found");
+    ok($stdout =~ qr/^TOAST value \d+ in relation $toastrelid \(block 0, item 1\): \d+ of \d+ chunks missing/m,
+       "missing chunks reported");
+    ok($stdout =~ qr/Incomplete values: +1\n/, "incomplete value counted");
+}
+
+sub test_item_filters
+{
+    my $query = qq(
+        create table t15(a int, b text);
+        insert into t15 values (1, 'x'), (2, 'x');
+        update t15 set b = 'y' where a = 1;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $out_ = run_pg_filedump('t15', ('-D', 'int,text', '--stats',
+                                       '--infomask', 'HEAP_ONLY'));
+    my @rows = $out_ =~ /^(COPY: .*)$/mg;
+
+    is_deeply(\@rows, ["COPY: 1\ty"], "only the heap-only tuple dumped");
+    ok($out_ =~ qr/Items filtered out: +2\n/, "filtered items counted");
+
+    $out_ = run_pg_filedump('t15', ('-D', 'int,text', '-i',
+                                    '--infomask', '!HEAP_ONLY'));
+    @rows = $out_ =~ /^(COPY: .*)$/mg;
+
+    is_deeply(\@rows, ["COPY: 1\tx", "COPY: 2\tx"],
+              "heap-only tuple left out");
+    ok($out_ !~ qr/HEAP_ONLY/, "filtered item not formatted");
+
+    $out_ = run_pg_filedump('t15', ('-D', 'int,text', '--lp-state', 'dead'));
+
+    ok($out_ !~ qr/Item +1 --/, "no items dumped for DEAD");
+}
+
+sub test_output_format
+{
+    my $out_ = run_pg_filedump('t15', ('--output-format', 'json'));
+    my @records = map { decode_json($_) } split(/\n/, $out_);
+
+    is($records[0]{type}, "page", "page record first");
+    is($records[0]{items}, 3, "page record lists the items");
+    is(scalar(grep { $_->{type} eq "item" } @records), 3, "item records");
+
+    my ($hot) = grep { $_->{type} eq "item" && $_->{item} == 3 } @records;
+    ok(grep({ $_ eq "HEAP_ONLY" } @{$hot->{infomask_flags}}),
+       "infomask flags named");
+
+    $out_ = run_pg_filedump('t15', ('--output-format', 'binary'));
+
+    is(substr($out_, 0, 8), "PGFDUMP\x01", "binary magic found");
+    my $pos = 8;
+    my %types;
+    while ($pos < length($out_))
+    {
+        my $len = unpack('V', substr($out_, $pos, 4));
+        $types{substr($out_, $pos + 4, 1)}++;
+        $pos += 4 + $len;
+    }
+    is($pos, length($out_), "binary records fill the output");
+    is_deeply(\%types, { P => 1, I => 3 }, "binary page and item records");
+}
+
+sub test_copy_target
+{
+    $node->safe_psql('postgres', "create table t15_copy(a int, b text);");
+
+    my $out_ = run_pg_filedump('t15', ('-D', 'int,text', '-o',
+                                       '--copy-target', $node->connstr('postgres'),
+                                       '--copy-table', 't15_copy'));
+
+    ok($out_ !~ qr/^COPY: /m, "rows not printed");
+    ok($out_ =~ qr/\*\*\* Copied 2 rows into t15_copy \*\*\*/,
+       "copied rows counted");
+    is($node->safe_psql('postgres', "select a, b from t15_copy order by a;"),
+       "1|y\n2|x", "rows copied into the table");
+}
+
+sub test_dedup
+{
+    my $query = qq(
+        create table t16(a int, b text);
+        insert into t16 select g, 'v1' from generate_series(1, 300) g;
+        update t16 set b = 'v2' where a % 2 = 0;
+        update t16 set b = 'v3' where a % 3 = 0;
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my @expected = map { "COPY: $_\t" . ($_ % 3 == 0 ? 'v3' : $_ % 2 == 0 ? 'v2' : 'v1') }
+        sort { "$a" cmp "$b" } 1 .. 300;
+
+    my $out_ = run_pg_filedump('t16', ('-D', 'int,text', '--dedup-key', '1',
+                                       '--stats'));
+    my @rows = $out_ =~ /^(COPY: .*)$/mg;
+
+    is_deeply(\@rows, \@expected, "newest version per key, sorted by key");
+    ok($out_ =~ qr/Versions superseded: +250\n/, "superseded versions counted");
+
+    $out_ = run_pg_filedump('t16', ('-D', 'int,text', '--dedup-key', '1',
+                                    '--dedup-memory', '16kB', '--stats'));
+    @rows = $out_ =~ /^(COPY: .*)$/mg;
+
+    is_deeply(\@rows, \@expected, "spilled runs merged");
+    ok($out_ !~ qr/Deduplication runs: +0\n/, "rows spilled to runs");
+}
+
+sub test_unique_check
+{
+    my $query = qq(
+        create table t17(a int, b text);
+        insert into t17 select g, 'x' from generate_series(1, 100) g;
+        create unique index i17 on t17(a);
+        update t17 set b = 'y' where a = 9;
+        create table t17_dup(a int, b text);
+        insert into t17_dup select * from t17;
+        insert into t17_dup values (5, 'dup'), (101, 'new');
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $index = get_table_location('i17');
+    my $out_ = run_pg_filedump('t17', ('-D', 'int,text', '-o',
+                                       '--unique-check', '1',
+                                       '--unique-index', $index));
+
+    ok($out_ !~ qr/COPY:/, "tuples not printed");
+    ok($out_ =~ qr/Keys: +100\n/, "keys collected");
+    ok($out_ =~ qr/Duplicate keys: +0\n/, "no duplicate keys");
+    ok($out_ =~ qr/Keys not in the index: +0\n/, "all keys in the index");
+
+    $out_ = run_pg_filedump('t17', ('-D', 'int,text', '--unique-check', '1'));
+
+    ok($out_ =~ qr/^Duplicate key \(9\): 2 tuples at /m,
+       "updated tuple counted without -o");
+
+    my ($stdout, $stderr);
+    run [ 'pg_filedump', '-D', 'int,text', '-o', '--unique-check', '1',
+          '--unique-index', $index, get_table_location('t17_dup') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 1, "violations found");
+    ok($stdout =~ qr/^Duplicate key \(5\): 2 tuples at /m,
+       "duplicate key reported");
+    ok($stdout =~ qr/^Key \(101\) of the tuple at \(0,\d+\) not in the index$/m,
+       "key missing from the index reported");
+}
+
+sub test_fk_check
+{
+    my $query = qq(
+        create table t18p(id int primary key, name text);
+        insert into t18p select g, 'p' || g from generate_series(1, 50) g;
+        create table t18c(id int, pid int);
+        insert into t18c select g, g % 50 + 1 from generate_series(1, 1000) g;
+        insert into t18c values (1001, null);
+        create table t18s(id int, pid int);
+        insert into t18s values (1, 7), (2, 77), (3, 77), (4, null);
+        checkpoint;
+    );
+    $node->safe_psql('postgres', $query);
+
+    my $heap = get_table_location('t18p');
+    my $index = get_table_location('t18p_pkey');
+
+    # The referenced relation is the smaller file and loaded first
+    my $out_ = run_pg_filedump('t18c', ('-D', 'int,int', '--fk-check', '2',
+                                        '--fk-ref', $heap,
+                                        '--fk-ref-types', 'int,text'));
+
+    ok($out_ !~ qr/COPY:/, "tuples not printed");
+    ok($out_ =~ qr/Referenced entries: +50\n/, "referenced heap keys read");
+    ok($out_ =~ qr/Tuples with NULL keys: +1\n/, "NULL key not looked up");
+    ok($out_ =~ qr/Orphaned tuples: +0\n/, "all keys referenced");
+
+    $out_ = run_pg_filedump('t18c', ('-D', 'int,int', '--fk-check', '2',
+                                     '--fk-ref', $index,
+                                     '--fk-ref-types', 'int'));
+
+    ok($out_ =~ qr/Referenced entries: +50\n/, "referenced index keys read");
+    ok($out_ =~ qr/Orphaned tuples: +0\n/, "all keys in the index");
+
+    # The referencing keys are the smaller side and collected first
+    my ($stdout, $stderr);
+    run [ 'pg_filedump', '-D', 'int,int', '--fk-check', '2',
+          '--fk-ref', $index, '--fk-ref-types', 'int',
+          get_table_location('t18s') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 1, "orphans found");
+    ok($stdout =~ qr/^Key \(77\) of 2 tuples, the first at \(0,2\), not in the referenced relation$/m,
+       "orphaned key reported");
+    ok($stdout =~ qr/Orphaned tuples: +2\n/, "orphaned tuples counted");
+
+    run [ 'pg_filedump', '-D', 'int,int', '--fk-check', '2',
+          '--fk-ref', $heap, '--fk-ref-types', 'int,text',
+          '--fk-ref-key', '1', get_table_location('t18s') ],
+        '>', \$stdout, '2>', \$stderr;
+
+    is($? >> 8, 1, "orphans found in the heap");
+    ok($stdout =~ qr/^Key \(77\) of 2 tuples/m, "orphaned key of the heap reported");
+}
+
+sub test_output_writer
+{
+    my $dir = PostgreSQL::Test::Utils::tempdir;
+    my $plain = run_pg_filedump('t1', ('-i', '-f'));
+
+    # The options are listed in the header
+    $plain =~ s/^\* Options used: .*$//m;
+
+    run_pg_filedump('t1', ('-i', '-f', '--split-size', '1MB',
+                           '--output', "$dir/split"));
+    my @files = sort glob("$dir/split.*");
+    my $split = join('', map { slurp_file($_) } @files);
+    $split =~ s/^\* Options used: .*$//m;
+
+    ok(scalar(@files) > 1, "output split into files");
+    ok(!grep({ -s $_ > 1024 * 1024 } @files), "split files within size");
+    ok($split eq $plain, "split output matches");
+
+    my ($stdout, $stderr);
+    run [ 'pg_filedump', '-i', '-f', '--compress', 'gzip',
+          '--output', "$dir/dump.gz", get_table_location('t1') ],
+        '>', \$stdout, '2>', \$stderr;
+
+  SKIP:
+    {
+        skip "pg_filedump built without zlib", 1
+          if $stdout =~ /Unsupported compression method/;
+
+        my $gzipped;
+        gunzip("$dir/dump.gz" => \$gzipped);
+        $gzipped =~ s/^\* Options used: .*$//m;
+        ok($gzipped eq $plain, "gzip output matches");
+    }
+}
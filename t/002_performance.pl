@@ -0,0 +1,166 @@
+#!/usr/bin/perl
+
+# Performance regression gate.
+#
+# Builds the same table at two scales and runs the key pg_filedump modes on
+# both.  Throughput and peak RSS of the large run are compared against the
+# baselines in t/perf_baselines.txt, and the scaling between the two runs
+# must stay linear in time and flat in memory.
+#
+# This test is expensive and only runs if PG_TEST_EXTRA contains "perf".
+# PG_FILEDUMP_PERF_ROWS sets the number of rows of the large table (default
+# 1000000) and PG_FILEDUMP_PERF_TOLERANCE the allowed relative deviation
+# from the baselines (default 0.5).
+
+use strict;
+use warnings;
+use Config;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+use File::Basename;
+use File::Spec;
+use IPC::Run qw( run timeout );
+use Time::HiRes qw( time );
+
+if (!$ENV{PG_TEST_EXTRA} || $ENV{PG_TEST_EXTRA} !~ /\bperf\b/)
+{
+    plan skip_all => 'performance tests not enabled in PG_TEST_EXTRA';
+}
+
+my $rows = $ENV{PG_FILEDUMP_PERF_ROWS} || 1000000;
+my $tolerance = $ENV{PG_FILEDUMP_PERF_TOLERANCE} || 0.5;
+my $scale = 4;
+
+# the large run may take at most this much longer per row than the small one
+my $max_time_growth = 2.0;
+# and may use at most this much more memory
+my $max_rss_growth = 1.5;
+
+my $time_cmd = -x '/usr/bin/time' ? '/usr/bin/time' : undef;
+
+my %baselines = read_baselines(
+    File::Spec->catfile(dirname(__FILE__), 'perf_baselines.txt'));
+
+note "setting up PostgreSQL instance";
+
+my $node = PostgreSQL::Test::Cluster->new('perf');
+$node->init(extra => ["--data-checksums"]);
+$node->start;
+
+# every 100th row carries an uncompressed and a compressed external value
+foreach my $table ([ 'perf_small', $rows / $scale ], [ 'perf_large', $rows ])
+{
+    my ($name, $n) = @$table;
+
+    $node->safe_psql('postgres', qq(
+        create table $name (id int, ts timestamptz, amount numeric,
+                            note text, doc text, blob text);
+        alter table $name alter column doc set storage external;
+        insert into $name
+            select g, '2024-01-01'::timestamptz + g * interval '1 second',
+                   g / 100.0, md5(g::text),
+                   case when g % 100 = 0 then repeat(md5(g::text), 100) end,
+                   case when g % 100 = 50 then
+                       (select string_agg(md5(g::text || i::text), '')
+                          from generate_series(1, 300) i) end
+              from generate_series(1, $n) g;
+        vacuum $name;
+        checkpoint;
+    ));
+}
+
+note "running tests";
+
+my @modes = (
+    [ '-D',    [ '-D', 'int,timestamptz,numeric,text,text,text' ] ],
+    [ '-D -t', [ '-D', 'int,timestamptz,numeric,text,text,text', '-t' ] ],
+    [ '-i',    [ '-i' ] ],
+    [ '-f',    [ '-f' ] ],
+    [ '-k',    [ '-k' ] ],
+);
+
+foreach my $mode (@modes)
+{
+    my ($name, $options) = @$mode;
+    my $small = run_timed('perf_small', @$options);
+    my $large = run_timed('perf_large', @$options);
+    my $baseline = $baselines{$name};
+    my $growth = ($large->{seconds} / $large->{size}) /
+                 ($small->{seconds} / $small->{size});
+
+    note sprintf("%-6s %8.1f MB/s  %8d kB peak RSS  time growth per MB %.2f",
+                 $name, $large->{mbps}, $large->{rss} // -1, $growth);
+
+    ok($growth <= $max_time_growth,
+       "$name: run time grows linearly with relation size");
+    ok($large->{mbps} >= $baseline->{mbps} * (1 - $tolerance),
+       "$name: throughput within tolerance of baseline")
+        if defined $baseline;
+
+    SKIP:
+    {
+        skip "/usr/bin/time not available", 2
+            unless defined $large->{rss} && defined $small->{rss};
+
+        ok($large->{rss} <= $small->{rss} * $max_rss_growth,
+           "$name: peak RSS does not grow with relation size");
+        ok($large->{rss} <= $baseline->{rss} * (1 + $tolerance),
+           "$name: peak RSS within tolerance of baseline")
+            if defined $baseline;
+    }
+}
+
+$node->stop;
+done_testing();
+
+# baseline lines are "<mode> <min MB/s> <max peak RSS kB>", mode may contain
+# spaces
+sub read_baselines
+{
+    my ($file) = @_;
+    my %result;
+
+    open(my $fh, '<', $file) or die "could not open $file: $!";
+    while (<$fh>)
+    {
+        next if /^\s*(#|$)/;
+        if (/^(.+?)\s+([\d.]+)\s+(\d+)\s*$/)
+        {
+            $result{$1} = { mbps => $2, rss => $3 };
+        }
+    }
+    close($fh);
+
+    return %result;
+}
+
+sub get_table_location
+{
+    return File::Spec->catfile(
+        $node->data_dir,
+        $node->safe_psql('postgres', qq(SELECT pg_relation_filepath('@_');))
+    );
+}
+
+# run pg_filedump with output discarded, return wall time, size and RSS
+sub run_timed
+{
+    my ($rel, @options) = @_;
+    my $stderr;
+
+    my $loc = get_table_location($rel);
+    my $cmd = [ 'pg_filedump', @options, $loc ];
+    unshift @$cmd, $time_cmd, '-f', 'RSS %M' if defined $time_cmd;
+
+    my $start = time();
+    run $cmd, '>', '/dev/null', '2>', \$stderr
+        or die "Error: could not execute pg_filedump";
+    my $seconds = time() - $start;
+    my $size = (-s $loc) / (1024 * 1024);
+
+    my ($rss) = ($stderr =~ /RSS (\d+)/);
+
+    return { seconds => $seconds, size => $size, mbps => $size / $seconds,
+             rss => $rss };
+}
@@ -0,0 +1,244 @@
+/*
+ * Cache of TOAST values for pg_filedump
+ *
+ * Updating a row without touching its toasted columns makes the old and
+ * the new tuple version point to the same TOAST value.  Reading such a
+ * value with -t means a sweep over the TOAST relation and possibly a
+ * decompression, so values already read are kept here, reassembled and
+ * decompressed, keyed by the TOAST relation and value id.  Most values
+ * are pointed to only once, so a value is only cached once a second
+ * pointer to it is seen.  The cache is bounded by --toast-cache and evicts
+ * the least recently used values.  Its memory is tracked like any other
+ * value and counts against the --max-memory budget.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+
+#include <stdlib.h>
+
+/* Number of hash buckets, a power of two */
+#define TOAST_CACHE_BUCKETS		1024
+
+/* Number of values remembered as seen, a power of two */
+#define TOAST_CACHE_SEEN		16384
+
+typedef struct ToastCacheEntry
+{
+	Oid			toastrelid;
+	Oid			valueid;
+	Size		size;
+	struct ToastCacheEntry *hashNext;	/* next entry of the bucket */
+	struct ToastCacheEntry *lruPrev;	/* more recently used entry */
+	struct ToastCacheEntry *lruNext;	/* less recently used entry */
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} ToastCacheEntry;
+
+/* --toast-cache: cache size in bytes, 0 disables the cache */
+Size		toastCacheSize = DEFAULT_TOAST_CACHE_SIZE;
+
+static ToastCacheEntry *buckets[TOAST_CACHE_BUCKETS];
+
+/* Most and least recently used entries */
+static ToastCacheEntry *lruHead = NULL;
+static ToastCacheEntry *lruTail = NULL;
+
+/* Bytes of values currently cached */
+static Size cachedBytes = 0;
+
+/*
+ * Values seen but not cached, by hash.  A value seen again while its slot
+ * still holds it is cached; otherwise it takes over the slot.
+ */
+typedef struct ToastCacheSeen
+{
+	Oid			toastrelid;
+	Oid			valueid;
+} ToastCacheSeen;
+
+static ToastCacheSeen seen[TOAST_CACHE_SEEN];
+
+static uint32
+ToastCacheHash(Oid toastrelid, Oid valueid)
+{
+	uint32		hash = (valueid * 0x9E3779B1) ^ toastrelid;
+
+	return (hash >> 16) ^ hash;
+}
+
+static ToastCacheEntry **
+ToastCacheBucket(Oid toastrelid, Oid valueid)
+{
+	return &buckets[ToastCacheHash(toastrelid, valueid) &
+					(TOAST_CACHE_BUCKETS - 1)];
+}
+
+/*
+ * Mark a value as seen.  Returns whether it was seen before, i.e. whether
+ * it is worth caching.
+ */
+static bool
+ToastCacheSeenBefore(Oid toastrelid, Oid valueid)
+{
+	ToastCacheSeen *slot = &seen[ToastCacheHash(toastrelid, valueid) &
+								 (TOAST_CACHE_SEEN - 1)];
+
+	/* Value ids are never 0, so empty slots match nothing */
+	if (slot->toastrelid == toastrelid && slot->valueid == valueid)
+		return true;
+
+	slot->toastrelid = toastrelid;
+	slot->valueid = valueid;
+	return false;
+}
+
+static void
+LruUnlink(ToastCacheEntry *entry)
+{
+	if (entry->lruPrev)
+		entry->lruPrev->lruNext = entry->lruNext;
+	else
+		lruHead = entry->lruNext;
+
+	if (entry->lruNext)
+		entry->lruNext->lruPrev = entry->lruPrev;
+	else
+		lruTail = entry->lruPrev;
+}
+
+static void
+LruPushFront(ToastCacheEntry *entry)
+{
+	entry->lruPrev = NULL;
+	entry->lruNext = lruHead;
+	if (lruHead)
+		lruHead->lruPrev = entry;
+	else
+		lruTail = entry;
+	lruHead = entry;
+}
+
+/* Remove the least recently used entry */
+static void
+ToastCacheEvict(void)
+{
+	ToastCacheEntry *entry = lruTail;
+	ToastCacheEntry **prev = ToastCacheBucket(entry->toastrelid, entry->valueid);
+
+	while (*prev != entry)
+		prev = &(*prev)->hashNext;
+	*prev = entry->hashNext;
+
+	LruUnlink(entry);
+	cachedBytes -= entry->size;
+	TrackedFree(entry);
+}
+
+/*
+ * Look up a value.  The returned data stays valid until the next call to
+ * ToastCacheInsert() or ToastCacheRelease().
+ */
+const char *
+ToastCacheLookup(Oid toastrelid, Oid valueid, Size *size)
+{
+	ToastCacheEntry *entry;
+
+	if (toastCacheSize == 0)
+		return NULL;
+
+	for (entry = *ToastCacheBucket(toastrelid, valueid); entry; entry = entry->hashNext)
+	{
+		if (entry->toastrelid == toastrelid && entry->valueid == valueid)
+		{
+			LruUnlink(entry);
+			LruPushFront(entry);
+			dumpStats.toastCacheHits++;
+			*size = entry->size;
+			return entry->data;
+		}
+	}
+
+	dumpStats.toastCacheMisses++;
+	return NULL;
+}
+
+/* Check for a value without counting a lookup or marking it used */
+bool
+ToastCacheContains(Oid toastrelid, Oid valueid)
+{
+	ToastCacheEntry *entry;
+
+	if (toastCacheSize == 0)
+		return false;
+
+	for (entry = *ToastCacheBucket(toastrelid, valueid); entry; entry = entry->hashNext)
+	{
+		if (entry->toastrelid == toastrelid && entry->valueid == valueid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Note that a value is pointed to more than once, so that it is cached
+ * when it is first read
+ */
+void
+ToastCacheNoteShared(Oid toastrelid, Oid valueid)
+{
+	if (toastCacheSize != 0)
+		(void) ToastCacheSeenBefore(toastrelid, valueid);
+}
+
+/*
+ * Add a value missing from the cache, evicting the least recently used
+ * ones to make room.  Values seen for the first time and values larger
+ * than the cache or the memory budget allows are not cached.
+ */
+void
+ToastCacheInsert(Oid toastrelid, Oid valueid, const char *data, Size size)
+{
+	ToastCacheEntry **bucket;
+	ToastCacheEntry *entry;
+
+	if (size > toastCacheSize || !ToastCacheSeenBefore(toastrelid, valueid))
+		return;
+
+	while (lruTail && cachedBytes > toastCacheSize - size)
+		ToastCacheEvict();
+
+	while (lruTail && !MemoryBudgetAllows(offsetof(ToastCacheEntry, data) + size))
+		ToastCacheEvict();
+
+	if (!MemoryBudgetAllows(offsetof(ToastCacheEntry, data) + size))
+		return;
+
+	if ((entry = TrackedAlloc(offsetof(ToastCacheEntry, data) + size)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	entry->toastrelid = toastrelid;
+	entry->valueid = valueid;
+	entry->size = size;
+	memcpy(entry->data, data, size);
+
+	bucket = ToastCacheBucket(toastrelid, valueid);
+	entry->hashNext = *bucket;
+	*bucket = entry;
+	LruPushFront(entry);
+	cachedBytes += size;
+}
+
+/*
+ * Evict cached values until size more bytes fit into the memory budget or
+ * the cache is empty
+ */
+void
+ToastCacheRelease(Size size)
+{
+	while (lruTail && !MemoryBudgetAllows(size))
+		ToastCacheEvict();
+}
@@ -0,0 +1,316 @@
+/*
+ * Consistency check of TOAST relations for pg_filedump
+ *
+ * With --toast-check, the TOAST pointers of all heap tuples decoded with -D
+ * are collected instead of printing the tuples.  After the heap is dumped
+ * the pointers are sorted and merged with the chunk index of their TOAST
+ * relation, which is built in a single sweep, to report values with missing,
+ * short or duplicate chunks and values no heap tuple points to.  Both sides
+ * are kept as sorted arrays of fixed-size entries.
+ */
+
+#include "postgres.h"
+#include "decode.h"
+#include "pg_filedump.h"
+
+#if PG_VERSION_NUM >= 130000
+#include <access/detoast.h>
+#include <access/heaptoast.h>
+#else
+#include <access/tuptoaster.h>
+#endif
+#include <stdlib.h>
+
+/* A TOAST pointer and the heap tuple it was found in */
+typedef struct ToastCheckPointer
+{
+	Oid			toastrelid;
+	Oid			valueid;
+	int32		extsize;
+	BlockNumber blkno;
+	OffsetNumber offnum;
+} ToastCheckPointer;
+
+/* --toast-check: collect TOAST pointers and check them after the dump */
+bool		toastCheck = false;
+
+static ToastCheckPointer *pointers = NULL;
+static uint64 npointers = 0;
+static uint64 maxpointers = 0;
+
+/* Location of the tuple being collected */
+static BlockNumber currentBlkno;
+static OffsetNumber currentOffnum;
+
+/*
+ * Remember a TOAST pointer.  All pointers are needed at once to be sorted,
+ * so exceeding the memory budget is fatal.
+ */
+static void
+ToastCheckAddPointer(const varatt_external *pointer)
+{
+	ToastCheckPointer *entry;
+
+	if (npointers == maxpointers)
+	{
+		Size		growth = (Size) Max(maxpointers, 1024) *
+			sizeof(ToastCheckPointer);
+
+		ToastCacheRelease(growth);
+		if (!MemoryBudgetAllows(growth))
+		{
+			printf("Error: TOAST pointers of --toast-check exceed memory "
+				   "budget of %zu bytes.\n", maxMemory);
+			exit(1);
+		}
+
+		maxpointers = Max(maxpointers * 2, 1024);
+		pointers = TrackedRealloc(pointers,
+								  maxpointers * sizeof(ToastCheckPointer));
+		if (pointers == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	entry = &pointers[npointers++];
+	entry->toastrelid = pointer->va_toastrelid;
+	entry->valueid = pointer->va_valueid;
+#if PG_VERSION_NUM >= 140000
+	entry->extsize = VARATT_EXTERNAL_GET_EXTSIZE(*pointer);
+#else
+	entry->extsize = pointer->va_extsize;
+#endif
+	entry->blkno = currentBlkno;
+	entry->offnum = currentOffnum;
+}
+
+/* Remember the TOAST pointers of a heap tuple */
+void
+ToastCheckCollect(const char *tupleData, unsigned int tupleSize,
+				  BlockNumber blkno, OffsetNumber offnum)
+{
+	currentBlkno = blkno;
+	currentOffnum = offnum;
+	CollectToastPointers(tupleData, tupleSize, ToastCheckAddPointer);
+}
+
+static int
+ToastCheckPointerCompare(const void *a, const void *b)
+{
+	const ToastCheckPointer *pa = (const ToastCheckPointer *) a;
+	const ToastCheckPointer *pb = (const ToastCheckPointer *) b;
+
+	if (pa->toastrelid != pb->toastrelid)
+		return pa->toastrelid < pb->toastrelid ? -1 : 1;
+	if (pa->valueid != pb->valueid)
+		return pa->valueid < pb->valueid ? -1 : 1;
+	if (pa->blkno != pb->blkno)
+		return pa->blkno < pb->blkno ? -1 : 1;
+	return (int) pa->offnum - (int) pb->offnum;
+}
+
+/*
+ * Check the chunks of a value against the pointers to it, the first of
+ * which is given, and report what is wrong.  Returns true if the value is
+ * complete.
+ */
+static bool
+ToastCheckValue(const ToastCheckPointer *pointer, int nrefs,
+				const ToastChunk *chunks, int nchunks)
+{
+	int32		expected;
+	int32		present = 0;
+	int32		extra = 0;
+	int32		firstMissing = -1;
+	int64		size = 0;
+	int			duplicates = 0;
+	const char *sep = "";
+	int			i;
+
+	if (pointer->extsize <= 0)
+	{
+		printf("TOAST value %u in relation %u (block %u, item %u): "
+			   "corrupted pointer, external size %d\n",
+			   pointer->valueid, pointer->toastrelid, pointer->blkno,
+			   pointer->offnum, pointer->extsize);
+		return false;
+	}
+
+	/* Computed as in ReadStringFromToast() */
+	expected = (pointer->extsize - 1) / TOAST_MAX_CHUNK_SIZE + 1;
+
+	for (i = 0; i < nchunks; i++)
+	{
+		/* Chunks are sorted by number, copies of a chunk are adjacent */
+		if (i > 0 && chunks[i].seq == chunks[i - 1].seq)
+		{
+			duplicates++;
+			continue;
+		}
+
+		if (chunks[i].seq >= expected)
+			extra++;
+		else
+		{
+			if (firstMissing < 0 && chunks[i].seq != present)
+				firstMissing = present;
+			present++;
+		}
+		size += chunks[i].size;
+	}
+
+	if (firstMissing < 0 && present < expected)
+		firstMissing = present;
+
+	if (firstMissing < 0 && extra == 0 && duplicates == 0 &&
+		size == pointer->extsize)
+		return true;
+
+	printf("TOAST value %u in relation %u (block %u, item %u",
+		   pointer->valueid, pointer->toastrelid, pointer->blkno,
+		   pointer->offnum);
+	if (nrefs > 1)
+		printf(", and %d more tuples", nrefs - 1);
+	printf("): ");
+
+	if (firstMissing >= 0)
+	{
+		printf("%d of %d chunks missing, first %d", expected - present,
+			   expected, firstMissing);
+		sep = "; ";
+	}
+	if (extra > 0)
+	{
+		printf("%s%d chunks beyond %d expected", sep, extra, expected);
+		sep = "; ";
+	}
+	if (duplicates > 0)
+	{
+		printf("%s%d duplicate chunks", sep, duplicates);
+		sep = "; ";
+	}
+	if (size != pointer->extsize)
+		printf("%schunks hold " INT64_FORMAT " bytes, expected %d", sep, size,
+			   pointer->extsize);
+	printf("\n");
+
+	return false;
+}
+
+/* Report the values of chunks [from, to) as referenced by no heap tuple */
+static uint64
+ToastCheckOrphans(Oid relid, const ToastChunk *chunks, int from, int to)
+{
+	uint64		orphaned = 0;
+	int			c;
+
+	for (c = from; c < to; c++)
+	{
+		if (c > 0 && chunks[c - 1].valueid == chunks[c].valueid)
+			continue;
+
+		printf("TOAST value %u in relation %u: referenced by no heap tuple\n",
+			   chunks[c].valueid, relid);
+		orphaned++;
+	}
+
+	return orphaned;
+}
+
+/*
+ * Check the collected TOAST pointers against their TOAST relations and
+ * report values with missing, short or duplicate chunks and orphaned
+ * values.  partial tells that not all tuples of the heap were scanned, in
+ * which case orphaned values are not reported.  Returns 1 if any problems
+ * were found.
+ */
+int
+ToastCheckReport(bool partial)
+{
+	uint64		values = 0;
+	uint64		broken = 0;
+	uint64		orphaned = 0;
+	uint64		chunksChecked = 0;
+	uint64		p = 0;
+
+	printf("\n*** TOAST Check ***\n");
+
+	if (npointers > 0)
+		qsort(pointers, npointers, sizeof(ToastCheckPointer),
+			  ToastCheckPointerCompare);
+
+	while (p < npointers)
+	{
+		Oid			relid = pointers[p].toastrelid;
+		const ToastChunk *chunks;
+		int			nchunks;
+		int			c = 0;
+
+		if ((chunks = ToastRelationChunks(relid, &nchunks)) == NULL)
+		{
+			/*
+			 * The relation could not be opened or indexed within the memory
+			 * budget, skip its pointers
+			 */
+			while (p < npointers && pointers[p].toastrelid == relid)
+			{
+				p++;
+				broken++;
+			}
+			continue;
+		}
+		chunksChecked += nchunks;
+
+		/* Merge the sorted pointers with the sorted chunks */
+		while (p < npointers && pointers[p].toastrelid == relid)
+		{
+			const ToastCheckPointer *pointer = &pointers[p];
+			int			nrefs = 0;
+			int			first;
+
+			while (p < npointers && pointers[p].toastrelid == relid &&
+				   pointers[p].valueid == pointer->valueid)
+			{
+				p++;
+				nrefs++;
+			}
+
+			first = c;
+			while (first < nchunks && chunks[first].valueid < pointer->valueid)
+				first++;
+			if (!partial)
+				orphaned += ToastCheckOrphans(relid, chunks, c, first);
+
+			c = first;
+			while (c < nchunks && chunks[c].valueid == pointer->valueid)
+				c++;
+
+			values++;
+			if (!ToastCheckValue(pointer, nrefs, &chunks[first], c - first))
+				broken++;
+		}
+
+		if (!partial)
+			orphaned += ToastCheckOrphans(relid, chunks, c, nchunks);
+	}
+
+	if (partial)
+		printf("Orphaned values not checked, as only part of the heap was "
+			   "scanned.\n");
+
+	printf("TOAST pointers:        " UINT64_FORMAT "\n"
+		   "TOAST values:          " UINT64_FORMAT "\n"
+		   "TOAST chunks:          " UINT64_FORMAT "\n"
+		   "Incomplete values:     " UINT64_FORMAT "\n",
+		   npointers, values, chunksChecked, broken);
+	if (!partial)
+		printf("Orphaned values:       " UINT64_FORMAT "\n", orphaned);
+
+	TrackedFree(pointers);
+	pointers = NULL;
+	npointers = maxpointers = 0;
+
+	return (broken > 0 || orphaned > 0) ? 1 : 0;
+}
@@ -0,0 +1,681 @@
+/*
+ * Reading of TOAST values for pg_filedump
+ *
+ * Finding the chunks of a TOAST value used to take a sweep over the whole
+ * TOAST relation, which made -t quadratic in the number of external
+ * values.  Instead, the first value read from a TOAST relation builds an
+ * index of all its chunks in one sweep, sorted by value id and chunk
+ * number, and the blocks holding a value are then read directly.  The
+ * index is kept for the whole run; if it does not fit into --max-memory,
+ * it is dropped and the values of the relation are found by sweeping it
+ * as before.
+ *
+ * Before the tuples of a heap page are decoded, the TOAST pointers of the
+ * page are collected, and a pool of worker threads reads and decompresses
+ * their values while the main thread formats the tuples.  The main thread
+ * takes the values in column order as it reaches them, reading a value
+ * itself if no worker has started on it yet.
+ */
+
+#include "postgres.h"
+#include "decode.h"
+#include "pg_filedump.h"
+
+#include <access/htup_details.h>
+#if PG_VERSION_NUM >= 130000
+#include <access/detoast.h>
+#else
+#include <access/tuptoaster.h>
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct ToastRelation
+{
+	Oid			relid;
+	int			fd;
+	unsigned int blockSize;
+	ToastChunk *chunks;			/* sorted by valueid and seq */
+	int			nchunks;
+	int			maxchunks;
+	bool		overBudget;		/* chunks not indexed within --max-memory */
+	struct ToastRelation *next;
+} ToastRelation;
+
+static ToastRelation *toastRelations = NULL;
+
+typedef enum
+{
+	TOAST_JOB_QUEUED,
+	TOAST_JOB_RUNNING,
+	TOAST_JOB_DONE
+} ToastJobState;
+
+/* A value of the current page read ahead */
+typedef struct ToastJob
+{
+	varatt_external pointer;
+	int32		extsize;
+	ToastRelation *rel;
+	ToastJobState state;
+	bool		taken;			/* handed to the main thread */
+	char	   *value;			/* decompressed value, NULL on failure */
+	Size		size;
+	uint64		blocksRead;
+} ToastJob;
+
+/* --toast-workers: number of threads, -1 until set from the CPU count */
+int			toastWorkers = -1;
+
+/* Upper limit of the default number of worker threads */
+#define MAX_DEFAULT_TOAST_WORKERS	8
+
+static ToastJob *jobs = NULL;
+static int	njobs = 0;
+static int	maxjobs = 0;
+static int	queuedJobs = 0;		/* jobs handed to the workers */
+static int	nextJob = 0;		/* first job no worker has looked at */
+static int	startedWorkers = 0;
+
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobsQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobFinished = PTHREAD_COND_INITIALIZER;
+
+/* Build the path of a TOAST relation next to the dumped file */
+void
+ToastRelationPath(Oid relid, char *path)
+{
+	char	   *dir = strdup(fileName);
+
+	get_parent_directory(dir);
+	snprintf(path, MAXPGPATH, "%s/%u", *dir ? dir : ".", relid);
+	free(dir);
+}
+
+static int
+ToastChunkCompare(const void *a, const void *b)
+{
+	const ToastChunk *ca = (const ToastChunk *) a;
+	const ToastChunk *cb = (const ToastChunk *) b;
+
+	if (ca->valueid != cb->valueid)
+		return ca->valueid < cb->valueid ? -1 : 1;
+	if (ca->seq != cb->seq)
+		return ca->seq < cb->seq ? -1 : 1;
+	if (ca->blkno != cb->blkno)
+		return ca->blkno < cb->blkno ? -1 : 1;
+	return (int) ca->offset - (int) cb->offset;
+}
+
+/*
+ * Parse a TOAST chunk tuple (Oid chunk_id, int4 chunk_seq, bytea
+ * chunk_data).  Returns false if the tuple is not a valid chunk.
+ */
+static bool
+ToastChunkParse(const char *tuple, unsigned int size, Oid *valueid,
+				int32 *seq, const char **data, unsigned int *datasize)
+{
+	HeapTupleHeader header = (HeapTupleHeader) tuple;
+	const char *p;
+	unsigned int left;
+	uint32		len;
+
+	if (size < SizeofHeapTupleHeader || header->t_hoff < SizeofHeapTupleHeader ||
+		header->t_hoff + 2 * sizeof(int32) >= size ||
+		(header->t_infomask & HEAP_HASNULL))
+		return false;
+
+	p = tuple + header->t_hoff;
+	left = size - header->t_hoff;
+	memcpy(valueid, p, sizeof(Oid));
+	memcpy(seq, p + sizeof(Oid), sizeof(int32));
+	p += 2 * sizeof(int32);
+	left -= 2 * sizeof(int32);
+
+	if (VARATT_IS_1B_E(p))
+		return false;
+	else if (VARATT_IS_1B(p))
+	{
+		len = VARSIZE_1B(p);
+		if (len < VARHDRSZ_SHORT || len > left)
+			return false;
+		*data = p + VARHDRSZ_SHORT;
+		*datasize = len - VARHDRSZ_SHORT;
+	}
+	else
+	{
+		if (left < VARHDRSZ || !VARATT_IS_4B_U(p))
+			return false;
+		len = VARSIZE_4B(p);
+		if (len < VARHDRSZ || len > left)
+			return false;
+		*data = p + VARHDRSZ;
+		*datasize = len - VARHDRSZ;
+	}
+
+	return *seq >= 0;
+}
+
+/*
+ * Add the chunks on a block of a TOAST relation to its index.  If the index
+ * cannot grow within the memory budget, it is dropped and the relation is
+ * marked overBudget.
+ */
+static void
+ToastIndexBlock(ToastRelation *rel, const char *block, BlockNumber blkno)
+{
+	Page		page = (Page) block;
+	int			maxOffset;
+	int			x;
+
+	if (PageIsNew(page) || ((PageHeader) page)->pd_lower > rel->blockSize)
+		return;
+
+	maxOffset = PageGetMaxOffsetNumber(page);
+	for (x = 1; x <= maxOffset; x++)
+	{
+		ItemId		itemId = PageGetItemId(page, x);
+		unsigned int itemOffset = ItemIdGetOffset(itemId);
+		unsigned int itemSize = ItemIdGetLength(itemId);
+		ToastChunk *chunk;
+		const char *data;
+		unsigned int datasize;
+		Oid			valueid;
+		int32		seq;
+
+		if (ItemIdGetFlags(itemId) != LP_NORMAL ||
+			itemOffset + itemSize > rel->blockSize ||
+			!ToastChunkParse(block + itemOffset, itemSize, &valueid, &seq,
+							 &data, &datasize))
+			continue;
+
+		if (rel->nchunks == rel->maxchunks)
+		{
+			int			maxchunks = Max(rel->maxchunks * 2, 64);
+
+			ToastCacheRelease((Size) (maxchunks - rel->maxchunks) *
+							  sizeof(ToastChunk));
+			if (!MemoryBudgetAllows((Size) (maxchunks - rel->maxchunks) *
+									sizeof(ToastChunk)))
+			{
+				TrackedFree(rel->chunks);
+				rel->chunks = NULL;
+				rel->nchunks = rel->maxchunks = 0;
+				rel->overBudget = true;
+				return;
+			}
+
+			rel->maxchunks = maxchunks;
+			rel->chunks = TrackedRealloc(rel->chunks,
+										 rel->maxchunks * sizeof(ToastChunk));
+			if (rel->chunks == NULL)
+			{
+				perror("realloc");
+				exit(1);
+			}
+		}
+
+		chunk = &rel->chunks[rel->nchunks++];
+		chunk->valueid = valueid;
+		chunk->seq = seq;
+		chunk->blkno = blkno;
+		chunk->offset = (uint16) (data - block);
+		chunk->size = (uint16) datasize;
+	}
+}
+
+/*
+ * Find a TOAST relation, building the index of its chunks the first time.
+ * Returns NULL if the relation cannot be opened.
+ */
+static ToastRelation *
+ToastRelationGet(Oid relid)
+{
+	ToastRelation *rel;
+	char		path[MAXPGPATH];
+	FILE	   *fp;
+	char	   *block;
+	BlockNumber blkno = 0;
+
+	for (rel = toastRelations; rel != NULL; rel = rel->next)
+	{
+		if (rel->relid == relid)
+			return rel;
+	}
+
+	ToastRelationPath(relid, path);
+	if ((fp = fopen(path, "rb")) == NULL)
+	{
+		printf("Cannot open TOAST relation %s\n", path);
+		return NULL;
+	}
+
+	if ((rel = calloc(1, sizeof(ToastRelation))) == NULL)
+	{
+		perror("calloc");
+		exit(1);
+	}
+	rel->relid = relid;
+	rel->blockSize = GetBlockSize(fp);
+
+	if (rel->blockSize == 0 || (block = TrackedAlloc(rel->blockSize)) == NULL)
+	{
+		printf("Error: Unable to read TOAST relation %s\n", path);
+		fclose(fp);
+		free(rel);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_SET);
+	while (!rel->overBudget &&
+		   fread(block, 1, rel->blockSize, fp) == rel->blockSize)
+	{
+		dumpStats.toastBlocks++;
+		ToastIndexBlock(rel, block, blkno++);
+	}
+	TrackedFree(block);
+
+	if (rel->overBudget)
+		printf("WARNING: Chunk index of TOAST relation %s exceeds memory "
+			   "budget, its values are read by sweeping it instead.\n", path);
+
+	if (rel->nchunks > 0)
+		qsort(rel->chunks, rel->nchunks, sizeof(ToastChunk), ToastChunkCompare);
+
+	/* Blocks of the values are read with pread() from now on */
+	rel->fd = dup(fileno(fp));
+	fclose(fp);
+	if (rel->fd < 0)
+	{
+		perror("dup");
+		exit(1);
+	}
+
+	rel->next = toastRelations;
+	toastRelations = rel;
+	return rel;
+}
+
+/*
+ * Get the index of a TOAST relation, its chunks sorted by value id and
+ * chunk number.  Returns NULL if the relation cannot be opened or its index
+ * exceeds the memory budget.
+ */
+const ToastChunk *
+ToastRelationChunks(Oid relid, int *nchunks)
+{
+	ToastRelation *rel = ToastRelationGet(relid);
+
+	if (rel == NULL || rel->overBudget)
+		return NULL;
+
+	*nchunks = rel->nchunks;
+	return rel->chunks;
+}
+
+/*
+ * Read the chunks of a value into dest, which has room for extsize bytes.
+ * Returns 0 on success, or 1 if chunks are missing or do not add up to
+ * extsize.  Called by worker threads, so it must not print anything.
+ */
+static int
+ToastReadChunks(ToastRelation *rel, Oid valueid, int32 extsize, char *dest,
+				uint64 *blocksRead)
+{
+	int			lo = 0;
+	int			hi = rel->nchunks;
+	int32		expected = 0;
+	int32		done = 0;
+	BlockNumber current = InvalidBlockNumber;
+	char	   *block;
+	int			result = 0;
+	int			i;
+
+	/* Find the first chunk of the value */
+	while (lo < hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (rel->chunks[mid].valueid < valueid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((block = TrackedAlloc(rel->blockSize)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = lo; i < rel->nchunks && rel->chunks[i].valueid == valueid; i++)
+	{
+		const ToastChunk *chunk = &rel->chunks[i];
+
+		/* A second copy of a chunk already read */
+		if (chunk->seq < expected)
+			continue;
+
+		if (chunk->seq > expected || chunk->size > extsize - done)
+		{
+			result = 1;
+			break;
+		}
+
+		if (chunk->blkno != current)
+		{
+			if (pread(rel->fd, block, rel->blockSize,
+					  (off_t) chunk->blkno * rel->blockSize) != rel->blockSize)
+			{
+				result = 1;
+				break;
+			}
+			current = chunk->blkno;
+			(*blocksRead)++;
+		}
+
+		memcpy(dest + done, block + chunk->offset, chunk->size);
+		done += chunk->size;
+		expected++;
+	}
+
+	TrackedFree(block);
+
+	if (done != extsize)
+		result = 1;
+
+	return result;
+}
+
+/*
+ * Read the external data of a TOAST value into dest, which has room for
+ * extsize bytes.  Returns 0 on success, -1 if the TOAST relation cannot be
+ * opened, -2 if its chunks are not indexed within the memory budget, or 1
+ * if the value is missing or incomplete.
+ */
+int
+ToastFetchValue(Oid relid, Oid valueid, int32 extsize, char *dest)
+{
+	ToastRelation *rel = ToastRelationGet(relid);
+	uint64		blocksRead = 0;
+	int			result;
+
+	if (rel == NULL)
+		return -1;
+	if (rel->overBudget)
+		return -2;
+
+	result = ToastReadChunks(rel, valueid, extsize, dest, &blocksRead);
+	dumpStats.toastBlocks += blocksRead;
+	return result;
+}
+
+/* Read and decompress the value of a job */
+static void
+ToastJobRun(ToastJob *job)
+{
+	char	   *data = TrackedAlloc(job->extsize);
+
+	if (data == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	if (ToastReadChunks(job->rel, job->pointer.va_valueid, job->extsize, data,
+						&job->blocksRead) != 0)
+		TrackedFree(data);
+	else if (VARATT_EXTERNAL_IS_COMPRESSED(job->pointer))
+	{
+		int			size = DecompressToastValue(data, job->extsize,
+												job->pointer.va_rawsize - VARHDRSZ,
+												&job->value);
+
+		if (job->value != NULL)
+			job->size = size;
+		TrackedFree(data);
+	}
+	else
+	{
+		job->value = data;
+		job->size = job->extsize;
+	}
+}
+
+static void *
+ToastWorkerMain(void *arg)
+{
+	for (;;)
+	{
+		ToastJob   *job;
+
+		pthread_mutex_lock(&jobLock);
+		while (nextJob >= queuedJobs)
+			pthread_cond_wait(&jobsQueued, &jobLock);
+		job = &jobs[nextJob++];
+		if (job->state != TOAST_JOB_QUEUED)
+		{
+			pthread_mutex_unlock(&jobLock);
+			continue;
+		}
+		job->state = TOAST_JOB_RUNNING;
+		pthread_mutex_unlock(&jobLock);
+
+		ToastJobRun(job);
+
+		pthread_mutex_lock(&jobLock);
+		job->state = TOAST_JOB_DONE;
+		pthread_cond_broadcast(&jobFinished);
+		pthread_mutex_unlock(&jobLock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Remember a TOAST pointer of the page about to be decoded.  Called by the
+ * main thread before ToastPrefetchStart().
+ */
+void
+ToastPrefetchAdd(const varatt_external *pointer)
+{
+	ToastJob   *job;
+	int32		extsize;
+	int			i;
+
+	if (toastWorkers == 0)
+		return;
+
+#if PG_VERSION_NUM >= 140000
+	extsize = VARATT_EXTERNAL_GET_EXTSIZE(*pointer);
+#else
+	extsize = pointer->va_extsize;
+#endif
+
+	/* Corrupted pointers are reported when the value is decoded */
+	if (pointer->va_rawsize < VARHDRSZ ||
+		(Size) pointer->va_rawsize > MaxAllocSize ||
+		extsize < 0 || extsize > pointer->va_rawsize - VARHDRSZ)
+		return;
+
+	if (ToastCacheContains(pointer->va_toastrelid, pointer->va_valueid))
+		return;
+
+	/* A value pointed to twice on the page is cached when it is taken */
+	for (i = 0; i < njobs; i++)
+	{
+		if (jobs[i].pointer.va_toastrelid == pointer->va_toastrelid &&
+			jobs[i].pointer.va_valueid == pointer->va_valueid)
+		{
+			ToastCacheNoteShared(pointer->va_toastrelid, pointer->va_valueid);
+			return;
+		}
+	}
+
+	if (njobs == maxjobs)
+	{
+		maxjobs = Max(maxjobs * 2, 64);
+		if ((jobs = TrackedRealloc(jobs, maxjobs * sizeof(ToastJob))) == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	job = &jobs[njobs++];
+	memset(job, 0, sizeof(ToastJob));
+	job->pointer = *pointer;
+	job->extsize = extsize;
+	job->state = TOAST_JOB_DONE;	/* not queued until started */
+}
+
+/*
+ * Hand the collected values to the worker threads, as far as the memory
+ * budget allows reading them all at once
+ */
+void
+ToastPrefetchStart(void)
+{
+	Size		reserved = 0;
+	int			i;
+
+	if (njobs == 0)
+		return;
+
+	if (toastWorkers < 0)
+	{
+		long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		toastWorkers = (int) Min(Max(ncpus, 1), MAX_DEFAULT_TOAST_WORKERS);
+	}
+
+	for (i = 0; i < njobs; i++)
+	{
+		ToastJob   *job = &jobs[i];
+		Size		needed = ToastValueMemory(&job->pointer);
+
+		job->rel = ToastRelationGet(job->pointer.va_toastrelid);
+		if (job->rel == NULL || job->rel->overBudget ||
+			!MemoryBudgetAllows(reserved + needed))
+			continue;
+
+		reserved += needed;
+		job->state = TOAST_JOB_QUEUED;
+	}
+
+	while (startedWorkers < toastWorkers)
+	{
+		pthread_t	thread;
+
+		if (pthread_create(&thread, NULL, ToastWorkerMain, NULL) != 0)
+		{
+			/* Values not taken by a worker are read by the main thread */
+			if (startedWorkers == 0)
+				toastWorkers = 0;
+			break;
+		}
+		pthread_detach(thread);
+		startedWorkers++;
+	}
+
+	pthread_mutex_lock(&jobLock);
+	nextJob = 0;
+	queuedJobs = njobs;
+	pthread_cond_broadcast(&jobsQueued);
+	pthread_mutex_unlock(&jobLock);
+}
+
+/*
+ * Take a value read ahead for the page.  Returns true and the value, which
+ * the caller frees, if it was read and decompressed successfully; values
+ * that failed are read again by the caller, to report the failure.
+ */
+bool
+ToastPrefetchTake(Oid toastrelid, Oid valueid, char **value, Size *size)
+{
+	ToastJob   *job = NULL;
+	bool		run = false;
+	int			i;
+
+	for (i = 0; i < njobs; i++)
+	{
+		if (jobs[i].pointer.va_toastrelid == toastrelid &&
+			jobs[i].pointer.va_valueid == valueid && !jobs[i].taken)
+		{
+			job = &jobs[i];
+			break;
+		}
+	}
+
+	if (job == NULL)
+		return false;
+
+	pthread_mutex_lock(&jobLock);
+	if (job->state == TOAST_JOB_QUEUED)
+	{
+		/* No worker got to it yet, so read it here */
+		job->state = TOAST_JOB_RUNNING;
+		run = true;
+	}
+	else
+	{
+		while (job->state != TOAST_JOB_DONE)
+			pthread_cond_wait(&jobFinished, &jobLock);
+	}
+	pthread_mutex_unlock(&jobLock);
+
+	if (run)
+	{
+		ToastJobRun(job);
+		pthread_mutex_lock(&jobLock);
+		job->state = TOAST_JOB_DONE;
+		pthread_mutex_unlock(&jobLock);
+	}
+
+	job->taken = true;
+	dumpStats.toastBlocks += job->blocksRead;
+	job->blocksRead = 0;
+
+	*value = job->value;
+	*size = job->size;
+	job->value = NULL;
+	return *value != NULL;
+}
+
+/*
+ * Called after the page is decoded: cancel the values no worker started
+ * on, wait for the rest and free the values not taken
+ */
+void
+ToastPrefetchFinish(void)
+{
+	int			i;
+
+	if (njobs == 0)
+		return;
+
+	pthread_mutex_lock(&jobLock);
+	for (i = 0; i < njobs; i++)
+	{
+		if (jobs[i].state == TOAST_JOB_QUEUED)
+			jobs[i].state = TOAST_JOB_DONE;
+		while (jobs[i].state != TOAST_JOB_DONE)
+			pthread_cond_wait(&jobFinished, &jobLock);
+	}
+
+	pthread_mutex_unlock(&jobLock);
+
+	for (i = 0; i < njobs; i++)
+	{
+		dumpStats.toastBlocks += jobs[i].blocksRead;
+		if (jobs[i].value != NULL)
+			TrackedFree(jobs[i].value);
+	}
+
+	/* Workers only look at jobs again once ToastPrefetchStart() queues them */
+	pthread_mutex_lock(&jobLock);
+	nextJob = queuedJobs = 0;
+	pthread_mutex_unlock(&jobLock);
+	njobs = 0;
+}
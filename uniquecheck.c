@@ -0,0 +1,409 @@
+/*
+ * Unique key check of heap and btree data for pg_filedump
+ *
+ * With --unique-check, the given columns of every heap tuple decoded with
+ * -D are collected instead of printing the tuples, and after the heap is
+ * dumped the keys held by more than one tuple are reported.  With
+ * --unique-index, the keys of the leaf tuples of a btree index file on
+ * those columns are collected as well, to report the keys of tuples the
+ * index lacks.  Keys are aggregated in a hash table; once it outgrows
+ * --unique-memory, it and all further keys are written to partition files
+ * by hash, which are then aggregated one at a time, partitioning them
+ * again on other hash bits if needed.
+ */
+
+#include "postgres.h"
+#include "pg_filedump.h"
+#include "decode.h"
+
+/* Default of --unique-memory */
+#define DEFAULT_UNIQUE_MEMORY	(256 * 1024 * 1024)
+
+/* Partition files per spill, and the hash bits choosing among them */
+#define UNIQUE_PARTITION_BITS	6
+#define UNIQUE_PARTITIONS		(1 << UNIQUE_PARTITION_BITS)
+
+/* Times a partition is partitioned again before exceeding the memory */
+#define UNIQUE_MAX_DEPTH		4
+
+/* Location of a heap tuple */
+typedef struct UniqueTid
+{
+	BlockNumber blkno;
+	OffsetNumber offnum;
+} UniqueTid;
+
+/* Tuples and index entries holding a key, followed by the key */
+typedef struct UniqueGroup
+{
+	uint32		numTids;		/* heap tuples */
+	uint32		maxTids;		/* allocated in tids */
+	uint64		indexEntries;
+	UniqueTid  *tids;			/* beyond the first */
+	UniqueTid	firstTid;
+	KeyEntry	entry;
+} UniqueGroup;
+
+/*
+ * Record of a partition file, followed by the key: a heap tuple, or a
+ * number of index entries
+ */
+typedef struct UniqueRecord
+{
+	uint32		hash;
+	uint32		keyLen;
+	uint64		indexEntries;	/* 0 for a heap tuple */
+	UniqueTid	tid;
+} UniqueRecord;
+
+/* Hash table and, once spilled, the partition files of one level */
+typedef struct UniqueTable
+{
+	KeyTable	groups;
+	int			depth;
+	FILE	   *partitions[UNIQUE_PARTITIONS];
+	bool		spilled;
+} UniqueTable;
+
+/* --unique-check: 1-based columns of the COPY output forming the key */
+int			uniqueKeys[MAX_KEY_COLUMNS];
+int			numUniqueKeys = 0;
+
+/* --unique-index: btree index on the key columns to compare with */
+char	   *uniqueIndexPath = NULL;
+
+/* --unique-memory: size of the hash table before it is spilled */
+Size		uniqueMemory = DEFAULT_UNIQUE_MEMORY;
+
+/* Keys collected from the heap, before the report */
+static UniqueTable collected = {0};
+
+/* Key being built for a tuple */
+static KeyBuffer uniqueKey = {0};
+
+/* Counts of the report */
+static uint64 heapTuples = 0;
+static uint64 nullKeys = 0;
+static uint64 indexEntries = 0;
+static uint64 keysChecked = 0;
+static uint64 duplicateKeys = 0;
+static uint64 missingKeys = 0;
+static uint64 staleKeys = 0;
+static uint64 partitionsWritten = 0;
+
+static void
+UniqueWriteRecord(FILE *file, const UniqueRecord *record, const char *key)
+{
+	SpillFileWrite(file, record, sizeof(UniqueRecord));
+	SpillFileWrite(file, key, record->keyLen);
+}
+
+static void
+UniqueFreeGroup(UniqueGroup *group)
+{
+	TrackedFree(group->tids);
+	TrackedFree(group);
+}
+
+/*
+ * Partition file of a table a key with the given hash goes to, chosen by
+ * the high bits of the hash so that the low bits still spread the keys of
+ * a partition over the buckets
+ */
+static FILE *
+UniquePartition(UniqueTable *table, uint32 hash)
+{
+	int			shift = 32 - (table->depth + 1) * UNIQUE_PARTITION_BITS;
+
+	return table->partitions[(hash >> shift) & (UNIQUE_PARTITIONS - 1)];
+}
+
+/*
+ * Write the groups of a table to its partition files, creating them on
+ * the first spill, and empty the table.  Keys added afterwards go to the
+ * partition files directly.
+ */
+static void
+UniqueSpill(UniqueTable *table)
+{
+	KeyEntry  **groups;
+	uint32		count;
+	uint32		i;
+
+	if (!table->spilled)
+	{
+		for (i = 0; i < UNIQUE_PARTITIONS; i++)
+			table->partitions[i] = SpillFileCreate();
+		table->spilled = true;
+		partitionsWritten += UNIQUE_PARTITIONS;
+	}
+
+	groups = KeyTableTake(&table->groups, &count);
+	for (i = 0; i < count; i++)
+	{
+		UniqueGroup *group = KeyEntryContainer(UniqueGroup, entry, groups[i]);
+		FILE	   *file = UniquePartition(table, group->entry.hash);
+		UniqueRecord record;
+		uint32		t;
+
+		memset(&record, 0, sizeof(record));
+		record.hash = group->entry.hash;
+		record.keyLen = group->entry.keyLen;
+
+		for (t = 0; t < group->numTids; t++)
+		{
+			record.tid = t == 0 ? group->firstTid : group->tids[t - 1];
+			UniqueWriteRecord(file, &record, KeyEntryKey(&group->entry));
+		}
+
+		if (group->indexEntries > 0)
+		{
+			record.indexEntries = group->indexEntries;
+			memset(&record.tid, 0, sizeof(record.tid));
+			UniqueWriteRecord(file, &record, KeyEntryKey(&group->entry));
+		}
+
+		UniqueFreeGroup(group);
+	}
+	TrackedFree(groups);
+}
+
+/* Add a heap tuple or index entries of a key to a table */
+static void
+UniqueAdd(UniqueTable *table, const UniqueRecord *record, const char *key)
+{
+	KeyEntry  **link;
+	UniqueGroup *group;
+
+	/* Once spilled, the table only holds the keys read back */
+	if (table->spilled)
+	{
+		UniqueWriteRecord(UniquePartition(table, record->hash), record, key);
+		return;
+	}
+
+	link = KeyTableFind(&table->groups, key, record->keyLen, record->hash);
+	if (*link != NULL)
+		group = KeyEntryContainer(UniqueGroup, entry, *link);
+	else
+	{
+		Size		size = sizeof(UniqueGroup) + record->keyLen;
+
+		group = KeyTableAlloc(size);
+		memset(group, 0, sizeof(UniqueGroup));
+		KeyTableInsert(&table->groups, link, &group->entry, key,
+					   record->keyLen, record->hash, size);
+	}
+
+	if (record->indexEntries > 0)
+		group->indexEntries += record->indexEntries;
+	else if (group->numTids++ == 0)
+		group->firstTid = record->tid;
+	else
+	{
+		if (group->numTids - 1 > group->maxTids)
+		{
+			uint32		maxTids = Max(group->maxTids * 2, 4);
+
+			group->tids = KeyTableRealloc(group->tids,
+										  maxTids * sizeof(UniqueTid));
+			table->groups.memoryUsed += (maxTids - group->maxTids) *
+				sizeof(UniqueTid);
+			group->maxTids = maxTids;
+		}
+		group->tids[group->numTids - 2] = record->tid;
+	}
+
+	/* A single key cannot be split by spilling it */
+	if (KeyTableFull(&table->groups, uniqueMemory) &&
+		table->groups.numEntries > 1 && table->depth < UNIQUE_MAX_DEPTH)
+		UniqueSpill(table);
+}
+
+/* Report duplicates and keys missing from the index among the groups */
+static void
+UniqueReportGroups(UniqueTable *table)
+{
+	KeyEntry  **groups;
+	uint32		count;
+	uint32		i;
+
+	groups = KeyTableTake(&table->groups, &count);
+	for (i = 0; i < count; i++)
+	{
+		UniqueGroup *group = KeyEntryContainer(UniqueGroup, entry, groups[i]);
+		uint32		t;
+
+		keysChecked++;
+
+		if (group->numTids > 1)
+		{
+			duplicateKeys++;
+			printf("Duplicate key (");
+			PrintKey(KeyEntryKey(&group->entry), group->entry.keyLen);
+			printf("): %u tuples at (%u,%u)", group->numTids,
+				   group->firstTid.blkno, group->firstTid.offnum);
+			for (t = 0; t < group->numTids - 1; t++)
+				printf(", (%u,%u)", group->tids[t].blkno, group->tids[t].offnum);
+			printf("\n");
+		}
+
+		if (uniqueIndexPath != NULL && group->indexEntries == 0)
+		{
+			missingKeys++;
+			printf("Key (");
+			PrintKey(KeyEntryKey(&group->entry), group->entry.keyLen);
+			printf(") of the tuple at (%u,%u) not in the index\n",
+				   group->firstTid.blkno, group->firstTid.offnum);
+		}
+		else if (group->numTids == 0)
+			staleKeys++;
+
+		UniqueFreeGroup(group);
+	}
+	TrackedFree(groups);
+}
+
+/*
+ * Report the keys of a table, reading its partition files back one at a
+ * time if it was spilled.
+ */
+static void
+UniqueFinishTable(UniqueTable *table)
+{
+	int			p;
+
+	if (!table->spilled)
+	{
+		UniqueReportGroups(table);
+		return;
+	}
+
+	/* Move the keys still in memory to the partitions as well */
+	UniqueSpill(table);
+
+	for (p = 0; p < UNIQUE_PARTITIONS; p++)
+	{
+		FILE	   *file = table->partitions[p];
+		UniqueTable partition = {0};
+		UniqueRecord record;
+		char	   *key = NULL;
+		Size		keySize = 0;
+
+		partition.depth = table->depth + 1;
+
+		SpillFileRewind(file);
+		while (SpillFileNext(file, &record, sizeof(UniqueRecord)))
+		{
+			if (record.keyLen > keySize)
+			{
+				TrackedFree(key);
+				keySize = Max(record.keyLen, 1024);
+				key = KeyTableAlloc(keySize);
+			}
+			SpillFileRead(file, key, record.keyLen);
+			UniqueAdd(&partition, &record, key);
+		}
+
+		TrackedFree(key);
+		fclose(file);
+		table->partitions[p] = NULL;
+
+		UniqueFinishTable(&partition);
+	}
+	table->spilled = false;
+}
+
+/*
+ * Decode a heap tuple and collect its key, unless the inserting transaction
+ * is marked aborted by the hint bits.  Tuples with a NULL key column are
+ * only counted.
+ */
+void
+UniqueCheckCollect(const char *tupleData, unsigned int tupleSize,
+				   BlockNumber blkno, OffsetNumber offnum)
+{
+	UniqueRecord record;
+	const char *row;
+	int			len;
+	int			keyLen;
+
+	if (HeapTupleHeaderXminInvalid((HeapTupleHeader) tupleData))
+		return;
+
+	if ((row = DecodeRow(tupleData, tupleSize, &len)) == NULL)
+		return;
+	heapTuples++;
+
+	keyLen = BuildRowKey(&uniqueKey, row, len, uniqueKeys, numUniqueKeys);
+	if (keyLen < 0)
+	{
+		nullKeys++;
+		return;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.hash = KeyHash(uniqueKey.data, keyLen);
+	record.keyLen = keyLen;
+	record.tid.blkno = blkno;
+	record.tid.offnum = offnum;
+	UniqueAdd(&collected, &record, uniqueKey.data);
+}
+
+/* Collect a key of the --unique-index file */
+static void
+UniqueAddIndexKey(const char *key, int len, uint64 entries,
+				  BlockNumber blkno, OffsetNumber offnum)
+{
+	UniqueRecord record;
+
+	indexEntries += entries;
+	if (key == NULL)
+		return;
+
+	memset(&record, 0, sizeof(record));
+	record.hash = KeyHash(key, len);
+	record.keyLen = len;
+	record.indexEntries = entries;
+	UniqueAdd(&collected, &record, key);
+}
+
+/*
+ * Report the keys held by more than one heap tuple and, with
+ * --unique-index, the keys of heap tuples missing from the index.  Returns
+ * 1 if any were found or the index could not be read.
+ */
+int
+UniqueCheckReport(void)
+{
+	int			rc = 0;
+
+	printf("\n*** Unique Check ***\n");
+
+	if (uniqueIndexPath != NULL &&
+		ScanRelationKeys(uniqueIndexPath, uniqueKeys, numUniqueKeys,
+						 UniqueAddIndexKey) != 0)
+		rc = 1;
+
+	UniqueFinishTable(&collected);
+
+	printf("Heap tuples:           " UINT64_FORMAT "\n"
+		   "Tuples with NULL keys: " UINT64_FORMAT "\n"
+		   "Keys:                  " UINT64_FORMAT "\n"
+		   "Duplicate keys:        " UINT64_FORMAT "\n",
+		   heapTuples, nullKeys, keysChecked, duplicateKeys);
+	if (uniqueIndexPath != NULL)
+		printf("Index entries:         " UINT64_FORMAT "\n"
+			   "Keys not in the index: " UINT64_FORMAT "\n"
+			   "Index keys without a tuple: " UINT64_FORMAT "\n",
+			   indexEntries, missingKeys, staleKeys);
+	if (partitionsWritten > 0)
+		printf("Partition files:       " UINT64_FORMAT "\n", partitionsWritten);
+
+	FreeKeyBuffer(&uniqueKey);
+
+	if (duplicateKeys > 0 || missingKeys > 0)
+		rc = 1;
+
+	return rc;
+}